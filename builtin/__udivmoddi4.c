@@ -2,19 +2,57 @@
 
 #include <stdint.h>
 
+/* The R3000A has no count leading zeros instruction, so binary search. */
+static int clz32(uint32_t x)
+{
+	int n = 0;
+
+	if (!(x & 0xffff0000)) { n += 16; x <<= 16; }
+	if (!(x & 0xff000000)) { n +=  8; x <<=  8; }
+	if (!(x & 0xf0000000)) { n +=  4; x <<=  4; }
+	if (!(x & 0xc0000000)) { n +=  2; x <<=  2; }
+	if (!(x & 0x80000000)) { n +=  1; }
+
+	return n;
+}
+
+static int clz64(uint64_t x)
+{
+	const uint32_t hi = x >> 32;
+
+	return hi ? clz32(hi) : 32 + clz32(x);
+}
+
 uint64_t __udivmoddi4(uint64_t num, uint64_t den, uint64_t * rem_p)
 {
-	uint64_t quot = 0, qbit = 1;
+	uint64_t quot = 0, qbit;
+	int shift;
 
 	if (den == 0)
 		return 0;
 
-	/* Left-justify denominator and count shift */
-	while ((int64_t)den >= 0) {
-		den <<= 1;
-		qbit <<= 1;
+	/* Both operands fit in 32 bits so the hardware divu can do it */
+	if (!((num | den) >> 32)) {
+		const uint32_t n = num, d = den;
+
+		if (rem_p)
+			*rem_p = n % d;
+
+		return n / d;
+	}
+
+	if (den > num) {
+		if (rem_p)
+			*rem_p = num;
+
+		return 0;
 	}
 
+	/* Align the most significant bits of denominator and numerator */
+	shift = clz64(den) - clz64(num);
+	den <<= shift;
+	qbit = (uint64_t)1 << shift;
+
 	while (qbit) {
 		if (den <= num) {
 			num -= den;
@@ -14,7 +14,8 @@
  * @arg: optional argument passed back to the callback function, can be %NULL
  *
  * Drivers should use request_irq() instead. This function is used by the main
- * interrupt controller.
+ * interrupt controller, which chains shared handlers on top of the single
+ * intrman handler that each line can have.
  *
  * Context: thread
  * Return: 0 on success, negative errno on error
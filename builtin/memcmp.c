@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#include "iopmod/string.h"
+
+int memcmp(const void *a, const void *b, size_t nbytes)
+{
+	const u8 *x = a;
+	const u8 *y = b;
+
+	if ((((uintptr_t)x ^ (uintptr_t)y) & 3) == 0 && nbytes >= 8) {
+		while ((uintptr_t)x & 3) {
+			if (*x != *y)
+				return *x - *y;
+			x++;
+			y++;
+			nbytes--;
+		}
+
+		const u32 *xw = (const u32 *)x;
+		const u32 *yw = (const u32 *)y;
+
+		/* Skip equal words, and compare a differing one bytewise. */
+		for (; nbytes >= 4 && *xw == *yw; nbytes -= 4) {
+			xw++;
+			yw++;
+		}
+
+		x = (const u8 *)xw;
+		y = (const u8 *)yw;
+	}
+
+	for (; nbytes; nbytes--, x++, y++)
+		if (*x != *y)
+			return *x - *y;
+
+	return 0;
+}
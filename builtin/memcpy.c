@@ -2,13 +2,70 @@
 
 #include "iopmod/string.h"
 
+/* Unaligned words are loaded with LWL and LWR. */
+struct unaligned_u32 {
+	u32 w;
+} __attribute__((packed));
+
+static inline bool aligned4(const void *p)
+{
+	return ((uintptr_t)p & 3) == 0;
+}
+
+/*
+ * Bytes are copied forwards, in ascending address order, also by the word
+ * loops that load each word before storing it. memmove() relies on this for
+ * overlapping buffers with the destination below the source.
+ */
 void *memcpy(void *dst, const void *src, size_t nbytes)
 {
-	char *d = dst;
-	char *e = &d[nbytes];
-	const char *s = src;
+	u8 *d = dst;
+	const u8 *s = src;
+
+	if (nbytes >= 8) {
+		/* Align the destination, and with it often the source. */
+		while (!aligned4(d)) {
+			*d++ = *s++;
+			nbytes--;
+		}
+
+		u32 *dw = (u32 *)d;
+
+		if (aligned4(s)) {
+			const u32 *sw = (const u32 *)s;
+
+			/* SIF payloads are typically multiples of 16 bytes. */
+			for (; nbytes >= 16; nbytes -= 16, dw += 4, sw += 4) {
+				dw[0] = sw[0];
+				dw[1] = sw[1];
+				dw[2] = sw[2];
+				dw[3] = sw[3];
+			}
+
+			for (; nbytes >= 4; nbytes -= 4)
+				*dw++ = *sw++;
+
+			s = (const u8 *)sw;
+		} else {
+			const struct unaligned_u32 *sw = (const void *)s;
+
+			for (; nbytes >= 16; nbytes -= 16, dw += 4, sw += 4) {
+				dw[0] = sw[0].w;
+				dw[1] = sw[1].w;
+				dw[2] = sw[2].w;
+				dw[3] = sw[3].w;
+			}
+
+			for (; nbytes >= 4; nbytes -= 4)
+				*dw++ = (sw++)->w;
+
+			s = (const u8 *)sw;
+		}
+
+		d = (u8 *)dw;
+	}
 
-	while (d != e)
+	while (nbytes--)
 		*d++ = *s++;
 
 	return dst;
@@ -0,0 +1,40 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#include "iopmod/string.h"
+
+void *memmove(void *dst, const void *src, size_t nbytes)
+{
+	u8 *d = dst;
+	const u8 *s = src;
+
+	/*
+	 * Copying forwards is safe unless the destination is above, since
+	 * memcpy() copies forwards.
+	 */
+	if (d <= s || d >= s + nbytes)
+		return memcpy(dst, src, nbytes);
+
+	d += nbytes;
+	s += nbytes;
+
+	if ((((uintptr_t)d ^ (uintptr_t)s) & 3) == 0 && nbytes >= 8) {
+		while ((uintptr_t)d & 3) {
+			*--d = *--s;
+			nbytes--;
+		}
+
+		u32 *dw = (u32 *)d;
+		const u32 *sw = (const u32 *)s;
+
+		for (; nbytes >= 4; nbytes -= 4)
+			*--dw = *--sw;
+
+		d = (u8 *)dw;
+		s = (const u8 *)sw;
+	}
+
+	while (nbytes--)
+		*--d = *--s;
+
+	return dst;
+}
@@ -4,10 +4,32 @@
 
 void *memset(void *buf, int byte, size_t nbytes)
 {
-	char *b = buf;
-	char *e = &b[nbytes];
+	u8 *b = buf;
 
-	while (b != e)
+	if (nbytes >= 8) {
+		const u32 w = (u8)byte * 0x01010101u;
+
+		while ((uintptr_t)b & 3) {
+			*b++ = byte;
+			nbytes--;
+		}
+
+		u32 *bw = (u32 *)b;
+
+		for (; nbytes >= 16; nbytes -= 16, bw += 4) {
+			bw[0] = w;
+			bw[1] = w;
+			bw[2] = w;
+			bw[3] = w;
+		}
+
+		for (; nbytes >= 4; nbytes -= 4)
+			*bw++ = w;
+
+		b = (u8 *)bw;
+	}
+
+	while (nbytes--)
 		*b++ = byte;
 
 	return buf;
@@ -0,0 +1,167 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2021 Fredrik Noring
+ */
+
+/**
+ * DOC: Pools of fixed-size objects
+ *
+ * A pool reserves memory for a given number of objects of the same size
+ * with a single allocation from a thfpool fixed-length pool, and then hands
+ * out objects from a free list. Allocating and freeing objects are O(1) and
+ * safe in any context, unlike the thfpool functions themselves, so request
+ * queues, SIF packets and timers can be allocated on demand rather than
+ * reserved statically for the worst case. The high-water mark of allocated
+ * objects shows how many a pool really needs.
+ */
+
+#include "iopmod/types.h"
+
+#include "iopmod/compare.h"
+#include "iopmod/errno.h"
+#include "iopmod/interrupt.h"
+#include "iopmod/iop-error.h"
+#include "iopmod/pool.h"
+#include "iopmod/thread.h"
+
+#include "iopmod/asm/macro.h"
+
+/**
+ * pool_create - create a pool of fixed-size objects
+ * @pool: pool to create
+ * @size: object size in bytes, rounded up to a multiple of 4
+ * @count: number of objects
+ *
+ * Context: thread
+ * Return: 0 on success, -EINVAL if @count is zero or the objects exceed a
+ * 	32-bit block, otherwise negative errno on error
+ */
+int pool_create(struct pool *pool, size_t size, u32 count)
+{
+	size = max_t(size_t, size, sizeof(void *));
+
+	/* Sizes below the rounded down limit remain below it when aligned. */
+	if (!count || size > ((u32)~0 / count & ~3))
+		return -EINVAL;
+
+	size = ALIGN(size, 4);
+
+	struct iop_fpl_param param = {
+		.attr = FA_THFIFO,
+		.block_size = size * count,
+		.blocks = 1,
+	};
+
+	const int fpl_id = thfpool_create_fpl(&param);
+	if (fpl_id < 0)
+		return errno_for_iop_error(fpl_id);
+
+	u8 *memory = thfpool_pallocate_fpl(fpl_id);
+	if (!memory) {
+		thfpool_delete_fpl(fpl_id);
+		return -ENOMEM;
+	}
+
+	*pool = (struct pool) {
+		.memory = memory,
+		.fpl_id = fpl_id,
+		.size = size,
+		.count = count,
+	};
+
+	for (u32 i = count; i > 0; i--) {
+		void **obj = (void **)&memory[(i - 1) * size];
+
+		*obj = pool->free;
+		pool->free = obj;
+	}
+
+	return 0;
+}
+
+/**
+ * pool_destroy - destroy a pool and free its memory
+ * @pool: pool to destroy, with all objects freed
+ *
+ * Context: thread
+ */
+void pool_destroy(struct pool *pool)
+{
+	thfpool_free_fpl(pool->fpl_id, pool->memory);
+	thfpool_delete_fpl(pool->fpl_id);
+
+	*pool = (struct pool) { };
+}
+
+/**
+ * pool_alloc - allocate an object from a pool
+ * @pool: pool to allocate from
+ *
+ * Context: any
+ * Return: pointer to object, or %NULL if the pool is exhausted
+ */
+void *pool_alloc(struct pool *pool)
+{
+	unsigned int flags;
+	void **obj;
+
+	irq_save(flags);
+
+	obj = pool->free;
+	if (obj) {
+		pool->free = *obj;
+		pool->used++;
+		pool->max_used = max(pool->max_used, pool->used);
+	} else
+		pool->failed++;
+
+	irq_restore(flags);
+
+	return obj;
+}
+
+/**
+ * pool_free - free an object allocated from a pool
+ * @pool: pool the object was allocated from
+ * @obj: object to free, or %NULL
+ *
+ * Context: any
+ */
+void pool_free(struct pool *pool, void *obj)
+{
+	unsigned int flags;
+
+	if (!obj)
+		return;
+
+	irq_save(flags);
+
+	*(void **)obj = pool->free;
+	pool->free = obj;
+	pool->used--;
+
+	irq_restore(flags);
+}
+
+/**
+ * pool_stat - pool statistics
+ * @pool: pool to obtain statistics for
+ * @stat: statistics since the pool was created
+ *
+ * Context: any
+ */
+void pool_stat(const struct pool *pool, struct pool_stat *stat)
+{
+	unsigned int flags;
+
+	irq_save(flags);
+
+	*stat = (struct pool_stat) {
+		.count = pool->count,
+		.used = pool->used,
+		.max_used = pool->max_used,
+		.failed = pool->failed,
+	};
+
+	irq_restore(flags);
+}
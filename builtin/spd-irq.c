@@ -18,6 +18,17 @@
 #include "iopmod/string.h"
 #include "iopmod/types.h"
 
+#include "iopmod/asm/macro.h"
+
+#define SPD_IRQ_LINES (IRQ_IOP_SPD_LAST - IRQ_IOP_SPD_BASE + 1)
+#define SPD_IRQ_BIT(irq_) ((irq_) - IRQ_IOP_SPD_BASE)
+
+/*
+ * Pending interrupts arriving while others are dispatched are serviced in
+ * up to this many rounds, without having to take another DEV9 interrupt.
+ */
+#define SPD_IRQ_ROUNDS 4
+
 static int spd_irq_count;
 
 #define SPD_IRQ_TYPE(irq_) [irq_ - IRQ_IOP_SPD_BASE] = { }
@@ -25,7 +36,8 @@ static int spd_irq_count;
 static struct spd_irq_desc {
 	irq_handler_t cb;
 	void *arg;
-} spd_irqs[IRQ_IOP_SPD_LAST - IRQ_IOP_SPD_BASE + 1] = {
+	u32 spurious;
+} spd_irqs[SPD_IRQ_LINES] = {
 	SPD_IRQ_TYPE(IRQ_IOP_SPD_ATA0),
 	SPD_IRQ_TYPE(IRQ_IOP_SPD_ATA1),
 	SPD_IRQ_TYPE(IRQ_IOP_SPD_TXDNV),
@@ -68,23 +80,96 @@ static void spd_disable_irq____(unsigned int irq)
 	iowr16(iord16(SPD_REG(SPD_REG_INTR_MASK)) & ~m, SPD_REG(SPD_REG_INTR_MASK));
 }
 
+/*
+ * Dispatch order of SPD interrupt bits when several are pending, with the
+ * unassigned bits last. ATA completions are serviced first by default, see
+ * spd_set_irq_priority__().
+ */
+static u8 spd_irq_order[SPD_IRQ_LINES] = {
+	SPD_IRQ_BIT(IRQ_IOP_SPD_ATA0),
+	SPD_IRQ_BIT(IRQ_IOP_SPD_ATA1),
+	SPD_IRQ_BIT(IRQ_IOP_SPD_RXEND),
+	SPD_IRQ_BIT(IRQ_IOP_SPD_TXEND),
+	SPD_IRQ_BIT(IRQ_IOP_SPD_RXDNV),
+	SPD_IRQ_BIT(IRQ_IOP_SPD_TXDNV),
+	SPD_IRQ_BIT(IRQ_IOP_SPD_EMAC3),
+	SPD_IRQ_BIT(IRQ_IOP_SPD_DVR),
+	SPD_IRQ_BIT(IRQ_IOP_SPD_UART),
+	7, 8, 10, 11,
+};
+
+/*
+ * A single pending bit is by far the most common case. Its bit number is
+ * looked up with a de Bruijn sequence, indexed by spd_single_irq().
+ */
+static const u8 spd_irq_bit[32] = {
+	 0,  1, 28,  2, 29, 14, 24,  3, 30, 22, 20, 15, 25, 17,  4,  8,
+	31, 27, 13, 23, 21, 19, 16,  7, 26, 12, 18,  6, 11,  5, 10,  9,
+};
+
+static unsigned int spd_single_irq(u16 pending)
+{
+	return spd_irq_bit[(pending * 0x077cb531u) >> 27];
+}
+
+static void spd_dispatch_irq(unsigned int irq_spd, enum irq_status *status)
+{
+	struct spd_irq_desc *desc = &spd_irqs[irq_spd];
+
+	if (desc->cb) {
+		desc->cb(desc->arg);
+		*status = IRQ_HANDLED;
+	} else
+		desc->spurious++;
+}
+
 static enum irq_status spd_handle_irq(void *arg)
 {
-	u16 pending = iord16(SPD_REG(SPD_REG_INTR_STAT)) &
-		      iord16(SPD_REG(SPD_REG_INTR_MASK));
+	enum irq_status status = IRQ_NONE;
+
+	for (int round = 0; round < SPD_IRQ_ROUNDS; round++) {
+		u16 pending = iord16(SPD_REG(SPD_REG_INTR_STAT)) &
+			      iord16(SPD_REG(SPD_REG_INTR_MASK)) &
+			      (BIT(SPD_IRQ_LINES) - 1);
 
-	iowr16(pending, SPD_REG(SPD_REG_INTR_STAT));  /* Acknowledge IRQs. */
+		if (!pending)
+			break;
 
-	while (pending) {
-		const unsigned int irq_spd = fls(pending) - 1;
+		iowr16(pending, SPD_REG(SPD_REG_INTR_STAT));  /* Acknowledge IRQs. */
 
-		if (spd_irqs[irq_spd].cb)
-			spd_irqs[irq_spd].cb(spd_irqs[irq_spd].arg);
+		if (!(pending & (pending - 1))) {
+			spd_dispatch_irq(spd_single_irq(pending), &status);
+			continue;
+		}
 
-		pending &= ~BIT(irq_spd);
+		for (int i = 0; pending && i < ARRAY_SIZE(spd_irq_order); i++) {
+			const unsigned int irq_spd = spd_irq_order[i];
+
+			if (!(pending & BIT(irq_spd)))
+				continue;
+
+			spd_dispatch_irq(irq_spd, &status);
+			pending &= ~BIT(irq_spd);
+		}
 	}
 
-	return IRQ_HANDLED;
+	return status;
+}
+
+/**
+ * spd_spurious_irq__ - number of spurious DEV9 SPD interrupts
+ * @irq: interrupt line to count spurious interrupts for
+ *
+ * Spurious interrupts are pending and unmasked without a handler, which can
+ * happen for example if an interrupt fires as its line is being released.
+ * This function is used by the main interrupt controller.
+ *
+ * Context: any
+ * Return: number of spurious interrupts since the module was loaded
+ */
+u32 spd_spurious_irq__(unsigned int irq)
+{
+	return spd_valid_irq(irq) ? spd_irqs[irq - IRQ_IOP_SPD_BASE].spurious : 0;
 }
 
 /**
@@ -103,7 +188,7 @@ int spd_request_irq__(unsigned int irq, irq_handler_t cb, void *arg)
 {
 	struct spd_irq_desc *desc = spd_irq(irq);
 	unsigned int flags;
-	int ioperr = 0;
+	int err = 0;
 
 	if (!desc || !cb || desc->cb)
 		return -EINVAL;
@@ -111,9 +196,9 @@ int spd_request_irq__(unsigned int irq, irq_handler_t cb, void *arg)
 	irq_save(flags);
 
 	if (!spd_irq_count)
-		ioperr = request_irq(IRQ_IOP_DEV9, spd_handle_irq, NULL);
+		err = request_irq(IRQ_IOP_DEV9, spd_handle_irq, spd_irqs);
 
-	if (ioperr >= 0) {
+	if (err >= 0) {
 		spd_irq_count++;
 
 		desc->cb = cb;
@@ -125,7 +210,7 @@ int spd_request_irq__(unsigned int irq, irq_handler_t cb, void *arg)
 
 	irq_restore(flags);
 
-	return ioperr < 0 ? errno_for_iop_error(ioperr) : 0;
+	return err;
 }
 
 /**
@@ -142,7 +227,7 @@ int spd_release_irq__(unsigned int irq)
 {
 	struct spd_irq_desc *desc = spd_irq(irq);
 	unsigned int flags;
-	int ioperr = 0;
+	int err = 0;
 
 	if (!desc || !desc->cb)
 		return -EINVAL;
@@ -152,9 +237,9 @@ int spd_release_irq__(unsigned int irq)
 	spd_disable_irq____(irq);
 
 	if (spd_irq_count == 1)
-		ioperr = release_irq(IRQ_IOP_DEV9);
+		err = release_irq(IRQ_IOP_DEV9, spd_handle_irq, spd_irqs);
 
-	if (ioperr >= 0)
+	if (err >= 0)
 		spd_irq_count--;
 
 	desc->cb = NULL;
@@ -162,7 +247,7 @@ int spd_release_irq__(unsigned int irq)
 
 	irq_restore(flags);
 
-	return ioperr < 0 ? errno_for_iop_error(ioperr) : 0;
+	return err;
 }
 
 /**
@@ -218,3 +303,49 @@ void spd_disable_irq__(unsigned int irq)
 
 	irq_restore(flags);
 }
+
+/**
+ * spd_set_irq_priority__ - set the dispatch order of DEV9 SPD interrupts
+ * @irqs: interrupt lines to dispatch first, in order of priority
+ * @count: number of interrupt lines in @irqs
+ *
+ * Drivers should use set_irq_priority() instead. This function is used by
+ * the main interrupt controller.
+ *
+ * Interrupt lines not given keep their relative order after the given ones.
+ *
+ * Context: any
+ * Return: 0 on success, negative errno on error
+ */
+int spd_set_irq_priority__(const unsigned int *irqs, size_t count)
+{
+	u8 order[ARRAY_SIZE(spd_irq_order)];
+	unsigned int flags;
+	u16 placed = 0;
+	size_t n = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		if (!spd_valid_irq(irqs[i]))
+			return -EINVAL;
+
+		const unsigned int irq_spd = SPD_IRQ_BIT(irqs[i]);
+
+		if (placed & BIT(irq_spd))
+			continue;
+
+		placed |= BIT(irq_spd);
+		order[n++] = irq_spd;
+	}
+
+	irq_save(flags);
+
+	for (int i = 0; i < ARRAY_SIZE(spd_irq_order); i++)
+		if (!(placed & BIT(spd_irq_order[i])))
+			order[n++] = spd_irq_order[i];
+
+	memcpy(spd_irq_order, order, sizeof(spd_irq_order));
+
+	irq_restore(flags);
+
+	return 0;
+}
@@ -2,12 +2,28 @@
 
 #include "iopmod/string.h"
 
+/* Nonzero if any byte of the word is zero. */
+static inline u32 zero_byte(u32 w)
+{
+	return (w - 0x01010101u) & ~w & 0x80808080u;
+}
+
 size_t strlen(const char *s)
 {
 	const char *b = s;
 
-	while (*s)
-		s++;
+	for (; (uintptr_t)s & 3; s++)
+		if (!*s)
+			return s - b;
+
+	/* Aligned words never cross a page, so reading past the end is fine. */
+	const u32 *w = (const u32 *)s;
+
+	while (!zero_byte(*w))
+		w++;
+
+	for (s = (const char *)w; *s; s++)
+		;
 
 	return s - b;
 }
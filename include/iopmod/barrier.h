@@ -6,4 +6,25 @@
 /* The "volatile" is due to gcc bugs */
 #define barrier() asm volatile ("": : :"memory")
 
+/**
+ * READ_ONCE - read a variable exactly once
+ * @x: variable to read
+ *
+ * The compiler can neither omit, repeat nor merge the read, which is
+ * necessary for variables that an interrupt handler may change.
+ */
+#define READ_ONCE(x) (*(const volatile typeof(x) *)&(x))
+
+/**
+ * WRITE_ONCE - write a variable exactly once
+ * @x: variable to write
+ * @val: value to write
+ *
+ * The compiler can neither omit, repeat nor merge the write.
+ */
+#define WRITE_ONCE(x, val)						\
+	do {								\
+		*(volatile typeof(x) *)&(x) = (val);			\
+	} while (0)
+
 #endif /* IOPMOD_BARRIER_H */
@@ -0,0 +1,24 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#ifndef IOPMOD_DMACMAN_H
+#define IOPMOD_DMACMAN_H
+
+#include "iopmod/types.h"
+
+#define DMAC_CH_SIO2_IN		11	/* From memory to SIO2 */
+#define DMAC_CH_SIO2_OUT	12	/* From SIO2 to memory */
+
+/**
+ * enum dmac_dir - DMA transfer direction
+ * @DMAC_TO_MEM: transfer from device to memory
+ * @DMAC_FROM_MEM: transfer from memory to device
+ */
+enum dmac_dir {
+	DMAC_TO_MEM   = 0,
+	DMAC_FROM_MEM = 1,
+};
+
+#include "iopmod/module-prototype.h"
+#include "iopmod/module/dmacman.h"
+
+#endif /* IOPMOD_DMACMAN_H */
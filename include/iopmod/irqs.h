@@ -3,6 +3,8 @@
 #ifndef IOPMOD_IRQS_H
 #define IOPMOD_IRQS_H
 
+#include "iopmod/types.h"
+
 enum {
 	IRQ_IOP_VBLANK       =  0,
 	IRQ_IOP_SBUS         =  1,
@@ -82,11 +84,37 @@ enum irq_mode {
 };
 
 /**
- * enum irq_status - FIXME
- * @IRQ_HANDLED: FIXME
+ * enum irq_status - interrupt handler return status
+ * @IRQ_NONE: interrupt was not from this device, or was not serviced
+ * @IRQ_HANDLED: interrupt was serviced by this device
+ * @IRQ_WAKE_THREAD: handler requests to wake its thread, or thread function
+ * 	requests to be polled again, see request_threaded_irq()
+ *
+ * Handlers on shared lines must return %IRQ_NONE for interrupts they did
+ * not service, to have the other handlers of the line called.
  */
 enum irq_status {
+	IRQ_NONE = 0,
 	IRQ_HANDLED = 1,
+	IRQ_WAKE_THREAD = 2,
+};
+
+/**
+ * enum irq_poll - how thread functions asking to be called again are polled
+ * @IRQ_POLL_YIELD: poll with the line masked, below the workqueues and RPC
+ * 	threads, yielding to threads of that priority between polls
+ * @IRQ_POLL_DRAIN: poll with the line masked, at the priority of the
+ * 	interrupt thread, until done
+ * @IRQ_POLL_UNMASKED: unmask the line between calls, so that the device
+ * 	interrupts for every event, which disables interrupt mitigation
+ *
+ * %IRQ_POLL_YIELD is the default. %IRQ_POLL_DRAIN has the lowest latency,
+ * but a busy device can starve the workqueues and RPC threads.
+ */
+enum irq_poll {
+	IRQ_POLL_YIELD = 0,
+	IRQ_POLL_DRAIN = 1,
+	IRQ_POLL_UNMASKED = 2,
 };
 
 /**
@@ -97,4 +125,24 @@ enum irq_status {
  */
 typedef enum irq_status (*irq_handler_t)(void *arg);
 
+/**
+ * struct irq_stat - interrupt line statistics
+ * @count: number of times the line has been dispatched
+ * @spurious: number of dispatches not serviced by any handler
+ * @max_cycles: longest time in system clock cycles spent in handlers
+ * @cycles: total time in system clock cycles spent in handlers
+ *
+ * Handler time covers the handlers running in the interrupt context, but
+ * not the thread functions of threaded handlers. Time spent in the virtual
+ * DEV9 SPD interrupts is included in the time of %IRQ_IOP_DEV9 as well.
+ * Handler time is only accounted while enabled with
+ * set_irq_time_accounting(), whereas dispatches are always counted.
+ */
+struct irq_stat {
+	u32 count;
+	u32 spurious;
+	u32 max_cycles;
+	u64 cycles;
+};
+
 #endif /* IOPMOD_IRQS_H */
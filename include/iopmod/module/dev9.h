@@ -1,22 +1,29 @@
 // SPDX-License-Identifier: GPL-2.0
 
-MODULE_ID(dev9, 0x0100);
-LIBRARY_ID(dev9, 0x0100);
+MODULE_ID(dev9, 0x0101);
+LIBRARY_ID(dev9, 0x0101);
 
 /**
  * dev9_request - request DEV9 hardware access
  *
- * FIXME: The DEV9 hardware is powered on, if necessary.
+ * The DEV9 hardware is powered on, if necessary, which resets it. Drivers
+ * request access around bursts of use and reinitialise their hardware
+ * whenever it was powered on. Drivers that cannot reinitialise their
+ * hardware, such as ATA, hold their request while they are resident.
  *
- * Return: zero on success, or a negative error number
+ * Context: thread
+ * Return: 1 if powered on, zero if already on, or a negative error number
  */
 id_(0) int dev9_request();
 
 /**
  * dev9_release - release DEV9 hardware access
  *
- * FIXME: The DEV9 hardware is powered off, if it's no longer used.
+ * The DEV9 hardware is powered off by a low priority thread when it has
+ * been unused for a while, so that bursts of requests and releases do not
+ * power cycle it.
  *
+ * Context: thread
  * Return: zero on success, or a negative error number
  */
 id_(1) int dev9_release();
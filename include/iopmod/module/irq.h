@@ -1,12 +1,23 @@
 // SPDX-License-Identifier: GPL-2.0
 
-MODULE_ID(irq, 0x0100);
-LIBRARY_ID(irq, 0x0100);
+MODULE_ID(irq, 0x0202);
+LIBRARY_ID(irq, 0x0202);
 
 id_(0) int request_irq(unsigned int irq, irq_handler_t cb, void *arg);
 
-id_(1) int release_irq(unsigned int irq);
+id_(1) int release_irq(unsigned int irq, irq_handler_t handler, void *arg);
 
 id_(2) void enable_irq(unsigned int irq);
 
 id_(3) void disable_irq(unsigned int irq);
+
+id_(4) int request_threaded_irq(unsigned int irq, irq_handler_t handler,
+	irq_handler_t thread_fn, void *arg);
+
+id_(5) int irq_stat(unsigned int irq, struct irq_stat *stat);
+
+id_(6) int set_irq_priority(const unsigned int *irqs, size_t count);
+
+id_(7) void set_irq_time_accounting(bool enable);
+
+id_(8) int set_irq_poll(unsigned int irq, enum irq_poll poll);
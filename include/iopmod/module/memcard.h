@@ -0,0 +1,3 @@
+// SPDX-License-Identifier: GPL-2.0
+
+MODULE_ID(memcard, 0x0100);
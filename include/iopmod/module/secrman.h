@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: GPL-2.0
+
+MODULE_ID(secrman_for_cex, 0x0103);
+LIBRARY_ID(secrman, 0x0103);
+
+/**
+ * secrman_set_mc_cmd_handler - set memory card SIO2 transfer handler
+ * @handler: function doing the SIO2 transfers of card authentication
+ *
+ * The memory card driver owns the SIO2, so secrman does its transfers
+ * through this handler.
+ *
+ * Context: thread
+ */
+id_(4) void secrman_set_mc_cmd_handler(secrman_mc_cmd_handler_t handler)
+	alias_(SetMcCommandHandler);
+
+/**
+ * secrman_set_mc_dev_id_handler - set memory card type handler
+ * @handler: function returning the type of a card
+ *
+ * Context: thread
+ */
+id_(5) void secrman_set_mc_dev_id_handler(secrman_mc_dev_id_handler_t handler)
+	alias_(SetMcDevIDHandler);
+
+/**
+ * secrman_auth_card - authenticate a memory card
+ * @port: SIO2 port of the card
+ * @slot: multitap slot of the card
+ * @cnum: card number, the low bit of @port shifted left by 3, plus @slot
+ *
+ * PS2 memory cards fail commands other than authentication until they are
+ * authenticated, which is done with the MagicGate keys of the secrman ROM
+ * module.
+ *
+ * Context: thread
+ * Return: nonzero on success, zero on failure
+ */
+id_(6) int secrman_auth_card(int port, int slot, int cnum)
+	alias_(SecrAuthCard);
+
+/**
+ * secrman_reset_auth_card - forget the authentication of a memory card
+ * @port: SIO2 port of the card
+ * @slot: multitap slot of the card
+ * @cnum: card number, as for secrman_auth_card()
+ *
+ * Context: thread
+ */
+id_(7) void secrman_reset_auth_card(int port, int slot, int cnum)
+	alias_(SecrResetAuthCard);
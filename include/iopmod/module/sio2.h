@@ -0,0 +1,34 @@
+// SPDX-License-Identifier: GPL-2.0
+
+MODULE_ID(sio2, 0x0100);
+LIBRARY_ID(sio2, 0x0100);
+
+/**
+ * sio2_request - request exclusive use of the SIO2, waiting if necessary
+ *
+ * Drivers sharing the SIO2, such as gamepad and memcard, request it before
+ * configuring and starting a command queue, and release it once the queue
+ * has completed. Only the owner can have a queue in progress, so its
+ * interrupt handler can claim the completion interrupt.
+ *
+ * Context: thread
+ * Return: zero on success, or a negative error number
+ */
+id_(0) int sio2_request();
+
+/**
+ * sio2_try_request - request exclusive use of the SIO2 without waiting
+ *
+ * Context: any
+ * Return: zero on success, or -EBUSY if the SIO2 is in use
+ */
+id_(1) int sio2_try_request();
+
+/**
+ * sio2_release - release exclusive use of the SIO2
+ *
+ * The SIO2 is handed over to a thread waiting in sio2_request(), if any.
+ *
+ * Context: any
+ */
+id_(2) void sio2_release();
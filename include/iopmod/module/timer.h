@@ -0,0 +1,10 @@
+// SPDX-License-Identifier: GPL-2.0
+
+MODULE_ID(timer, 0x0100);
+LIBRARY_ID(timer, 0x0100);
+
+id_(0) int mod_timer(struct timer_list *timer, u32 expires);
+
+id_(1) int del_timer(struct timer_list *timer);
+
+id_(2) u32 timer_jiffies(void);
@@ -0,0 +1,3 @@
+// SPDX-License-Identifier: GPL-2.0
+
+MODULE_ID(usb, 0x0100);
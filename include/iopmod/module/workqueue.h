@@ -0,0 +1,13 @@
+// SPDX-License-Identifier: GPL-2.0
+
+MODULE_ID(workqueue, 0x0200);
+LIBRARY_ID(workqueue, 0x0200);
+
+id_(0) bool queue_work(unsigned int wq, struct work_struct *work);
+
+id_(1) bool queue_delayed_work(unsigned int wq,
+	struct delayed_work *dwork, u32 delay_us);
+
+id_(2) bool cancel_work(struct work_struct *work);
+
+id_(3) bool cancel_delayed_work(struct delayed_work *dwork);
@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#ifndef IOPMOD_OHCI_H
+#define IOPMOD_OHCI_H
+
+#include "iopmod/bits.h"
+#include "iopmod/io.h"
+#include "iopmod/types.h"
+
+/* USB OHCI registers, see the OpenHCI specification release 1.0a. */
+
+#define OHCI_REGBASE			0xbf801600
+#define OHCI_REG(offset)		(OHCI_REGBASE + (offset))
+
+#define OHCI_REG_REVISION		0x00
+#define OHCI_REG_CONTROL		0x04
+#define OHCI_REG_CMDSTATUS		0x08
+#define OHCI_REG_INTR_STATUS		0x0c
+#define OHCI_REG_INTR_ENABLE		0x10
+#define OHCI_REG_INTR_DISABLE		0x14
+#define   OHCI_INTR_SO			  BIT(0)	/* Scheduling overrun */
+#define   OHCI_INTR_WDH			  BIT(1)	/* Writeback of done head */
+#define   OHCI_INTR_SF			  BIT(2)	/* Start of frame */
+#define   OHCI_INTR_RD			  BIT(3)	/* Resume detected */
+#define   OHCI_INTR_UE			  BIT(4)	/* Unrecoverable error */
+#define   OHCI_INTR_FNO			  BIT(5)	/* Frame number overflow */
+#define   OHCI_INTR_RHSC		  BIT(6)	/* Root hub status change */
+#define   OHCI_INTR_OC			  BIT(30)	/* Ownership change */
+#define   OHCI_INTR_MIE			  BIT(31)	/* Master interrupt enable */
+#define OHCI_REG_HCCA			0x18
+#define OHCI_REG_DONE_HEAD		0x30
+
+/**
+ * struct ohci_hcca - host controller communications area
+ * @int_table: interrupt endpoint descriptor lists
+ * @frame_no: current frame number
+ * @pad1: set to zero by the host controller when @frame_no is updated
+ * @done_head: last completed transfer descriptor, with bit 0 set if other
+ * 	interrupt causes are pending as well
+ * @reserved: reserved for the host controller
+ *
+ * The host controller writes @done_head, at most once per frame, and then
+ * raises %OHCI_INTR_WDH. It does not write @done_head again until the
+ * interrupt has been cleared.
+ */
+struct ohci_hcca {
+	u32 int_table[32];
+	u16 frame_no;
+	u16 pad1;
+	u32 done_head;
+	u8 reserved[116];
+} __attribute__((aligned(256)));
+
+#define OHCI_DONE_HEAD_MASK		0xfffffff0
+
+/**
+ * struct ohci_td - general transfer descriptor
+ * @info: control bits, including the condition code
+ * @cbp: current buffer pointer
+ * @next: next transfer descriptor, in the done queue the previously
+ * 	completed one
+ * @be: buffer end
+ */
+struct ohci_td {
+	u32 info;
+	u32 cbp;
+	u32 next;
+	u32 be;
+};
+
+#endif /* IOPMOD_OHCI_H */
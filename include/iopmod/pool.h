@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#ifndef IOPMOD_POOL_H
+#define IOPMOD_POOL_H
+
+#include "iopmod/types.h"
+
+/**
+ * struct pool - pool of fixed-size objects
+ * @free: list of free objects, linked by their first word
+ * @memory: memory of all objects
+ * @fpl_id: fixed-length pool the memory is allocated from
+ * @size: object size in bytes, a multiple of 4
+ * @count: number of objects
+ * @used: number of allocated objects
+ * @max_used: high-water mark of allocated objects
+ * @failed: number of failed allocations due to exhaustion
+ */
+struct pool {
+	void *free;
+	void *memory;
+	int fpl_id;
+	size_t size;
+	u32 count;
+	u32 used;
+	u32 max_used;
+	u32 failed;
+};
+
+/**
+ * struct pool_stat - pool statistics
+ * @count: number of objects
+ * @used: number of allocated objects
+ * @max_used: high-water mark of allocated objects
+ * @failed: number of failed allocations due to exhaustion
+ */
+struct pool_stat {
+	u32 count;
+	u32 used;
+	u32 max_used;
+	u32 failed;
+};
+
+int pool_create(struct pool *pool, size_t size, u32 count);
+
+void pool_destroy(struct pool *pool);
+
+void *pool_alloc(struct pool *pool);
+
+void pool_free(struct pool *pool, void *obj);
+
+void pool_stat(const struct pool *pool, struct pool_stat *stat);
+
+/**
+ * pool_create_of - create a pool of objects of a given type
+ * @pool: pool to create
+ * @type: type of the objects
+ * @count: number of objects
+ *
+ * Context: thread
+ * Return: 0 on success, negative errno on error
+ */
+#define pool_create_of(pool, type, count)				\
+	pool_create((pool), sizeof(type), (count))
+
+/**
+ * pool_alloc_of - allocate an object of a given type from a pool
+ * @pool: pool created with pool_create_of() for @type
+ * @type: type of the object
+ *
+ * Context: any
+ * Return: pointer to object, or %NULL if the pool is exhausted
+ */
+#define pool_alloc_of(pool, type) ((type *)pool_alloc(pool))
+
+#endif /* IOPMOD_POOL_H */
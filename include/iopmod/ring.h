@@ -0,0 +1,158 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#ifndef IOPMOD_RING_H
+#define IOPMOD_RING_H
+
+#include "iopmod/types.h"
+
+#include "iopmod/barrier.h"
+#include "iopmod/build-bug.h"
+#include "iopmod/interrupt.h"
+#include "iopmod/thread.h"
+
+#include "iopmod/asm/macro.h"
+
+/**
+ * DOC: Single-producer, single-consumer ring buffers
+ *
+ * A ring buffer hands entries from one producer, typically an interrupt
+ * handler, to one consumer, typically a thread, without disabling
+ * interrupts. The producer only writes the head index and the consumer
+ * only writes the tail index. The IOP has a single in-order processor, so
+ * compiler barriers order the entry accesses against the index updates.
+ *
+ * Several events between two wakeups of the consumer are thereby kept,
+ * rather than being lost with a semaphore having a maximum of one. The
+ * ring_put_signal() and ring_wait_get() helpers pair a ring with a counting
+ * semaphore created by ring_create_sema(), for a consumer that sleeps until
+ * entries are available.
+ */
+
+/**
+ * DECLARE_RING - declare a ring buffer structure
+ * @name: structure name
+ * @type: entry type
+ * @n: number of entries, which must be a power of two
+ *
+ * A ring is empty when zero initialised.
+ */
+#define DECLARE_RING(name, type, n)					\
+	struct name {							\
+		u32 head;						\
+		u32 tail;						\
+		type entry[n];						\
+	}
+
+/**
+ * ring_capacity - number of entries a ring can hold
+ * @r: pointer to ring
+ */
+#define ring_capacity(r) ({						\
+	BUILD_BUG_ON(ARRAY_SIZE((r)->entry) &				\
+		(ARRAY_SIZE((r)->entry) - 1));				\
+	(u32)ARRAY_SIZE((r)->entry); })
+
+/**
+ * ring_count - number of entries in a ring
+ * @r: pointer to ring
+ *
+ * Context: any, where the count is exact for the producer and consumer
+ */
+#define ring_count(r) (READ_ONCE((r)->head) - READ_ONCE((r)->tail))
+
+/**
+ * ring_empty - is a ring empty?
+ * @r: pointer to ring
+ */
+#define ring_empty(r) (ring_count(r) == 0)
+
+/**
+ * ring_full - is a ring full?
+ * @r: pointer to ring
+ */
+#define ring_full(r) (ring_count(r) == ring_capacity(r))
+
+/**
+ * ring_put - put an entry into a ring, by the producer
+ * @r: pointer to ring
+ * @value: entry to put
+ *
+ * Return: %true if put, %false if the ring is full
+ */
+#define ring_put(r, value) ({						\
+	typeof(r) r__ = (r);						\
+	const u32 head__ = r__->head;					\
+	const bool put__ = head__ - READ_ONCE(r__->tail) <		\
+		ring_capacity(r__);					\
+	if (put__) {							\
+		r__->entry[head__ & (ring_capacity(r__) - 1)] = (value);\
+		barrier();	/* Entry before head. */		\
+		WRITE_ONCE(r__->head, head__ + 1);			\
+	}								\
+	put__; })
+
+/**
+ * ring_get - get an entry from a ring, by the consumer
+ * @r: pointer to ring
+ * @p: pointer to where the entry is stored
+ *
+ * Return: %true if got, %false if the ring is empty
+ */
+#define ring_get(r, p) ({						\
+	typeof(r) r__ = (r);						\
+	const u32 tail__ = r__->tail;					\
+	const bool got__ = READ_ONCE(r__->head) != tail__;		\
+	if (got__) {							\
+		barrier();	/* Head before entry. */		\
+		*(p) = r__->entry[tail__ & (ring_capacity(r__) - 1)];	\
+		barrier();	/* Entry before tail. */		\
+		WRITE_ONCE(r__->tail, tail__ + 1);			\
+	}								\
+	got__; })
+
+/**
+ * ring_create_sema - create a counting semaphore for a ring
+ * @r: pointer to ring
+ *
+ * Context: thread
+ * Return: semaphore id, or negative IOP error number
+ */
+#define ring_create_sema(r) ({						\
+	const struct iop_sema sema__ = {				\
+		.initial = 0,						\
+		.max = ring_capacity(r),				\
+	};								\
+	thsemap_create_sema(&sema__); })
+
+/**
+ * ring_put_signal - put an entry into a ring and signal its semaphore
+ * @r: pointer to ring
+ * @value: entry to put
+ * @sema_id: semaphore created with ring_create_sema()
+ *
+ * Context: any
+ * Return: %true if put, %false if the ring is full
+ */
+#define ring_put_signal(r, value, sema_id) ({				\
+	const bool signal__ = ring_put((r), (value));			\
+	if (signal__) {							\
+		if (in_irq())						\
+			thsemap_isignal_sema(sema_id);			\
+		else							\
+			thsemap_signal_sema(sema_id);			\
+	}								\
+	signal__; })
+
+/**
+ * ring_wait_get - wait for an entry and get it from a ring
+ * @r: pointer to ring
+ * @p: pointer to where the entry is stored
+ * @sema_id: semaphore created with ring_create_sema()
+ *
+ * Context: thread
+ * Return: %true if got, %false if the wait failed
+ */
+#define ring_wait_get(r, p, sema_id)					\
+	(thsemap_wait_sema(sema_id) >= 0 && ring_get((r), (p)))
+
+#endif /* IOPMOD_RING_H */
@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#ifndef IOPMOD_SECRMAN_H
+#define IOPMOD_SECRMAN_H
+
+#include "iopmod/types.h"
+
+#define SECRMAN_CARD_TYPE_PS2	2
+
+/**
+ * struct secrman_sio2_dma - DMA part of a SIO2 transfer requested by secrman
+ * @addr: 4-byte aligned buffer
+ * @size: block size in 32-bit words, or zero if unused
+ * @count: number of blocks
+ */
+struct secrman_sio2_dma {
+	void *addr;
+	int size;
+	int count;
+};
+
+/**
+ * struct secrman_sio2_transfer - SIO2 transfer requested by secrman
+ * @cmd_stat: command status register after the transfer
+ * @port_ctrl0: CTRL0 registers of ports 0-3 for the transfer
+ * @port_ctrl1: CTRL1 registers of ports 0-3 for the transfer
+ * @port_stat: port status register after the transfer
+ * @cmd: command queue, terminated by a zero command unless full
+ * @fifo_stat: FIFO status register after the transfer
+ * @tx_size: number of bytes in @tx
+ * @rx_size: number of bytes to receive into @rx
+ * @tx: bytes to write to the transmit FIFO
+ * @rx: buffer for bytes read from the receive FIFO
+ * @tx_dma: bytes to transfer to the transmit FIFO with DMA
+ * @rx_dma: buffer for bytes to transfer from the receive FIFO with DMA
+ */
+struct secrman_sio2_transfer {
+	u32 cmd_stat;
+	u32 port_ctrl0[4];
+	u32 port_ctrl1[4];
+	u32 port_stat;
+	u32 cmd[16];
+	u32 fifo_stat;
+	u32 tx_size;
+	u32 rx_size;
+	u8 *tx;
+	u8 *rx;
+	struct secrman_sio2_dma tx_dma;
+	struct secrman_sio2_dma rx_dma;
+};
+
+/**
+ * typedef secrman_mc_cmd_handler_t - memory card SIO2 transfer handler
+ * @port: SIO2 port of the card
+ * @slot: multitap slot of the card
+ * @transfer: SIO2 transfer to be done
+ *
+ * Return: nonzero on success, zero on failure
+ */
+typedef int (*secrman_mc_cmd_handler_t)(int port, int slot,
+	struct secrman_sio2_transfer *transfer);
+
+/**
+ * typedef secrman_mc_dev_id_handler_t - memory card type handler
+ * @port: SIO2 port of the card
+ * @slot: multitap slot of the card
+ *
+ * Return: card type, for example %SECRMAN_CARD_TYPE_PS2
+ */
+typedef int (*secrman_mc_dev_id_handler_t)(int port, int slot);
+
+#include "iopmod/module-prototype.h"
+#include "iopmod/module/secrman.h"
+
+#endif /* IOPMOD_SECRMAN_H */
@@ -30,6 +30,9 @@
 #define SIF_CMD_IRQ_RELAY	(SIF_CMD_ID_SYS | 0x20)
 #define SIF_CMD_PRINTK		(SIF_CMD_ID_SYS | 0x21)
 #define SIF_CMD_GAMEPAD		(SIF_CMD_ID_SYS | 0x22)
+#define SIF_CMD_MEMCARD		(SIF_CMD_ID_SYS | 0x23)
+#define SIF_CMD_SMAP		(SIF_CMD_ID_SYS | 0x24)
+#define SIF_CMD_USB		(SIF_CMD_ID_SYS | 0x25)
 
 #define	SIF_SID_ID_SYS		0x80000000
 #define	SIF_SID_ID_USR		0x00000000
@@ -0,0 +1,159 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#ifndef IOPMOD_SMAP_H
+#define IOPMOD_SMAP_H
+
+#include <stddef.h>
+
+#include "iopmod/bits.h"
+#include "iopmod/io.h"
+#include "iopmod/spd.h"
+#include "iopmod/types.h"
+
+/* SMAP Ethernet registers, relative to the SPD register base. */
+
+#define SMAP_REG(offset)		SPD_REG(offset)
+
+#define SMAP_REG_BD_MODE		0x0102
+#define   SMAP_BD_SWAP			  BIT(0)
+#define SMAP_REG_INTR_CLR		0x0128
+
+#define SMAP_REG_TXFIFO_CTRL		0x1000
+#define   SMAP_TXFIFO_RESET		  BIT(0)
+#define   SMAP_TXFIFO_DMAEN		  BIT(1)
+#define SMAP_REG_TXFIFO_WR_PTR		0x1004
+#define SMAP_REG_TXFIFO_SIZE		0x1008
+#define SMAP_REG_TXFIFO_FRAME_CNT	0x100c
+#define SMAP_REG_TXFIFO_FRAME_INC	0x1010
+#define SMAP_REG_TXFIFO_DATA		0x1100
+
+#define SMAP_REG_RXFIFO_CTRL		0x1030
+#define   SMAP_RXFIFO_RESET		  BIT(0)
+#define   SMAP_RXFIFO_DMAEN		  BIT(1)
+#define SMAP_REG_RXFIFO_RD_PTR		0x1034
+#define SMAP_REG_RXFIFO_SIZE		0x1038
+#define SMAP_REG_RXFIFO_FRAME_CNT	0x103c
+#define SMAP_REG_RXFIFO_FRAME_DEC	0x1040
+#define SMAP_REG_RXFIFO_DATA		0x1200
+
+/* EMAC3 registers are 32 bits wide, accessed as two 16-bit halves. */
+
+#define SMAP_REG_EMAC3_MODE0		0x2000
+#define   SMAP_E3_RXMAC_IDLE		  BIT(31)
+#define   SMAP_E3_TXMAC_IDLE		  BIT(30)
+#define   SMAP_E3_SOFT_RESET		  BIT(29)
+#define   SMAP_E3_TXMAC_ENABLE		  BIT(28)
+#define   SMAP_E3_RXMAC_ENABLE		  BIT(27)
+#define SMAP_REG_EMAC3_MODE1		0x2004
+#define   SMAP_E3_FDX_ENABLE		  BIT(31)
+#define   SMAP_E3_MEDIA_100M		  BIT(22)
+#define SMAP_REG_EMAC3_TX_MODE0		0x2008
+#define   SMAP_E3_TX_GNP_0		  BIT(31)
+#define SMAP_REG_EMAC3_TX_MODE1		0x200c
+#define SMAP_REG_EMAC3_RX_MODE		0x2010
+#define   SMAP_E3_RX_STRIP_PAD		  BIT(31)
+#define   SMAP_E3_RX_STRIP_FCS		  BIT(30)
+#define   SMAP_E3_RX_INDIVID_ADDR	  BIT(23)
+#define   SMAP_E3_RX_BCAST		  BIT(20)
+#define SMAP_REG_EMAC3_INTR_STAT	0x2014
+#define SMAP_REG_EMAC3_INTR_ENABLE	0x2018
+#define SMAP_REG_EMAC3_ADDR_HI		0x201c
+#define SMAP_REG_EMAC3_ADDR_LO		0x2020
+#define SMAP_REG_EMAC3_STA_CTRL		0x205c
+#define   SMAP_E3_PHY_DATA_SHIFT	  16
+#define   SMAP_E3_PHY_OP_COMPLETE	  BIT(15)
+#define   SMAP_E3_PHY_READ_ERROR	  BIT(14)
+#define   SMAP_E3_PHY_WRITE		  BIT(13)
+#define   SMAP_E3_PHY_READ		  BIT(12)
+#define   SMAP_E3_PHY_ADDR_SHIFT	  5
+
+/* The PHY is reached over the STA interface of the EMAC3. */
+
+#define SMAP_PHY_ADDR			1
+
+#define SMAP_MII_BMCR			0x00
+#define   SMAP_BMCR_RESET		  BIT(15)
+#define   SMAP_BMCR_ANENABLE		  BIT(12)
+#define   SMAP_BMCR_ANRESTART		  BIT(9)
+#define SMAP_MII_BMSR			0x01
+#define   SMAP_BMSR_ANEGCOMPLETE	  BIT(5)
+#define   SMAP_BMSR_LSTATUS		  BIT(2)
+#define SMAP_MII_ADVERTISE		0x04
+#define SMAP_MII_LPA			0x05
+#define   SMAP_LPA_100FULL		  BIT(8)
+#define   SMAP_LPA_100HALF		  BIT(7)
+#define   SMAP_LPA_10FULL		  BIT(6)
+#define   SMAP_LPA_10HALF		  BIT(5)
+#define   SMAP_ADVERTISE_CSMA		  BIT(0)
+
+/* The EEPROM is a serial 93C46, reached over the SPEED PIO pins. */
+
+#define SMAP_EEPROM_OP_READ		0x2	/* Preceded by a start bit */
+#define SMAP_EEPROM_ADDR_BITS		6
+#define SMAP_EEPROM_MAC_WORDS		3	/* Followed by a checksum */
+
+/* Buffer descriptors, 64 each for transmit and receive. */
+
+#define SMAP_BD_TX_BASE			0x3000
+#define SMAP_BD_RX_BASE			0x3200
+#define SMAP_BD_COUNT			64
+
+#define SMAP_BD_TX_READY		BIT(15)
+#define SMAP_BD_TX_GENFCS		BIT(9)
+#define SMAP_BD_TX_GENPAD		BIT(8)
+#define SMAP_BD_TX_ERROR		0x03ff	/* Error bits once sent. */
+
+#define SMAP_BD_RX_EMPTY		BIT(15)
+#define SMAP_BD_RX_ERROR		0x03ff	/* Error bits once received. */
+
+/**
+ * struct smap_bd - SMAP buffer descriptor
+ * @ctrl_stat: control bits to transmit, or status bits once received
+ * @reserved: unused
+ * @length: frame length in bytes
+ * @pointer: frame address in the FIFO buffer
+ */
+struct smap_bd {
+	u16 ctrl_stat;
+	u16 reserved;
+	u16 length;
+	u16 pointer;
+};
+
+/* FIFO buffers addressed by buffer descriptor pointers. */
+
+#define SMAP_TX_BASE			0x1000
+#define SMAP_TX_BUFSIZE			4096
+#define SMAP_RX_BASE			0x4000
+#define SMAP_RX_BUFSIZE			16384
+
+#define SMAP_FRAME_MAX			1518
+
+static inline u32 smap_tx_bd(int i)
+{
+	return SMAP_REG(SMAP_BD_TX_BASE + i * sizeof(struct smap_bd));
+}
+
+static inline u32 smap_rx_bd(int i)
+{
+	return SMAP_REG(SMAP_BD_RX_BASE + i * sizeof(struct smap_bd));
+}
+
+#define smap_rd_bd(bd, field)						\
+	iord16((bd) + offsetof(struct smap_bd, field))
+
+#define smap_wr_bd(value, bd, field)					\
+	iowr16((value), (bd) + offsetof(struct smap_bd, field))
+
+static inline u32 smap_rd_emac3(u32 offset)
+{
+	return (iord16(SMAP_REG(offset)) << 16) | iord16(SMAP_REG(offset + 2));
+}
+
+static inline void smap_wr_emac3(u32 value, u32 offset)
+{
+	iowr16(value >> 16, SMAP_REG(offset));
+	iowr16(value & 0xffff, SMAP_REG(offset + 2));
+}
+
+#endif /* IOPMOD_SMAP_H */
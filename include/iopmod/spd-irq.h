@@ -24,4 +24,8 @@ void spd_enable_irq__(unsigned int irq);
 
 void spd_disable_irq__(unsigned int irq);
 
+u32 spd_spurious_irq__(unsigned int irq);
+
+int spd_set_irq_priority__(const unsigned int *irqs, size_t count);
+
 #endif /* IOPMOD_SPD_IRQ_H */
@@ -14,6 +14,12 @@
 #define SPD_REG_DMA_CTRL	0x24
 #define SPD_REG_INTR_STAT	0x28
 #define SPD_REG_INTR_MASK	0x2a
+#define SPD_REG_PIO_DIR		0x2c
+#define SPD_REG_PIO_DATA	0x2e
+#define   SPD_PIO_DOUT		  0x10	/* EEPROM data out, read */
+#define   SPD_PIO_DIN		  0x20	/* EEPROM data in, write */
+#define   SPD_PIO_SCLK		  0x40	/* EEPROM clock, write */
+#define   SPD_PIO_CSEL		  0x80	/* EEPROM chip select, write */
 
 #define SPD_REG_XFR_CTRL	0x32
 #define SPD_REG_0x38		0x38
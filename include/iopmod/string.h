@@ -6,7 +6,9 @@
 #include "iopmod/types.h"
 
 void *memcpy(void *dst, const void *src, size_t nbytes);
+void *memmove(void *dst, const void *src, size_t nbytes);
 void *memset(void *buf, int byte, size_t nbytes);
+int memcmp(const void *a, const void *b, size_t nbytes);
 size_t strlen(const char *s);
 
 #endif /* IOPMOD_STRING_H */
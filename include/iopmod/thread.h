@@ -205,4 +205,23 @@ struct iop_vpl_status {
 #include "iopmod/module-prototype.h"
 #include "iopmod/module/thread.h"
 
+/**
+ * sys_clock_cycles - low 32 bits of the system clock
+ *
+ * The system clock is driven by an IOP root counter. Its low 32 bits wrap
+ * around in about two minutes, so this is only suitable for measuring short
+ * intervals, by unsigned subtraction of two readings.
+ *
+ * Context: any
+ * Return: system clock cycles
+ */
+static inline u32 sys_clock_cycles(void)
+{
+	struct iop_sys_clock clock;
+
+	thbase_get_system_time(&clock);
+
+	return clock.lo;
+}
+
 #endif /* IOPMOD_THREAD_H */
@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#ifndef IOPMOD_TIMER_H
+#define IOPMOD_TIMER_H
+
+#include "iopmod/types.h"
+
+#define TIMER_TICK_US	1000	/* Duration of a jiffy in microseconds. */
+
+struct timer_list;
+
+typedef void (*timer_func_t)(struct timer_list *timer);
+
+/**
+ * struct timer_list - timer on the timer wheel
+ * @next: next timer in the same wheel slot, or %NULL if last
+ * @pprev: link to this timer in its wheel slot, or %NULL if not pending
+ * @expires: jiffy when the timer expires
+ * @function: function called back in the interrupt context on expiry
+ */
+struct timer_list {
+	struct timer_list *next;
+	struct timer_list **pprev;
+	u32 expires;
+	timer_func_t function;
+};
+
+#define timer_setup(t, f)						\
+	(*(t) = (struct timer_list) { .function = (f) })
+
+/**
+ * timer_pending - is a timer pending?
+ * @timer: timer to check
+ *
+ * Context: any
+ * Return: %true if @timer is pending, %false otherwise
+ */
+static inline bool timer_pending(const struct timer_list *timer)
+{
+	return timer->pprev != NULL;
+}
+
+/**
+ * us_to_jiffies - convert microseconds to jiffies, rounding up
+ * @us: microseconds to convert
+ *
+ * Return: number of jiffies
+ */
+static inline u32 us_to_jiffies(u32 us)
+{
+	return us / TIMER_TICK_US + (us % TIMER_TICK_US != 0);
+}
+
+#include "iopmod/module-prototype.h"
+#include "iopmod/module/timer.h"
+
+#endif /* IOPMOD_TIMER_H */
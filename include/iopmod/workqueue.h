@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#ifndef IOPMOD_WORKQUEUE_H
+#define IOPMOD_WORKQUEUE_H
+
+#include "iopmod/struct.h"
+#include "iopmod/timer.h"
+#include "iopmod/types.h"
+
+/**
+ * enum workqueue_id - shared workqueues
+ * @WQ_HIGHPRI: for latency sensitive work, such as completing transfers
+ * @WQ_NORMAL: for ordinary work
+ *
+ * Each workqueue has %WQ_WORKERS worker threads of its own priority. Work
+ * queued on the same workqueue starts in the order it was queued, and up
+ * to %WQ_WORKERS work items run concurrently, so that work that sleeps does
+ * not hold up the rest. A work item never runs concurrently with itself.
+ */
+enum workqueue_id {
+	WQ_HIGHPRI,
+	WQ_NORMAL,
+	WQ_COUNT
+};
+
+#define WQ_WORKERS 2	/* Worker threads per workqueue */
+
+struct work_struct;
+
+typedef void (*work_func_t)(struct work_struct *work);
+
+/**
+ * struct work_struct - deferred work
+ * @func: function called back in the worker thread
+ * @next: next work queued on the same workqueue, or %NULL if last
+ * @wq: workqueue the work is queued on
+ * @pending: %true if queued and not yet started
+ * @running: %true while the function runs in a worker thread
+ */
+struct work_struct {
+	work_func_t func;
+	struct work_struct *next;
+	unsigned int wq;
+	bool pending;
+	bool running;
+};
+
+/**
+ * struct delayed_work - deferred work started after a delay
+ * @work: work queued when the delay has expired
+ * @timer: timer pending until the delay has expired
+ * @wq: workqueue to queue @work on
+ */
+struct delayed_work {
+	struct work_struct work;
+	struct timer_list timer;
+	unsigned int wq;
+};
+
+#define INIT_WORK(w, f)							\
+	(*(w) = (struct work_struct) { .func = (f) })
+
+#define INIT_DELAYED_WORK(dw, f)					\
+	(*(dw) = (struct delayed_work) { .work = { .func = (f) } })
+
+/**
+ * to_delayed_work - delayed work of a work item
+ * @work: work embedded in a delayed work item
+ *
+ * Return: delayed work containing @work
+ */
+#define to_delayed_work(work) container_of(work, struct delayed_work, work)
+
+#include "iopmod/module-prototype.h"
+#include "iopmod/module/workqueue.h"
+
+#endif /* IOPMOD_WORKQUEUE_H */
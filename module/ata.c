@@ -15,7 +15,6 @@
 #include "iopmod/errno.h"
 #include "iopmod/interrupt.h"
 #include "iopmod/io.h"
-#include "iopmod/iop-error.h"
 #include "iopmod/irq.h"
 #include "iopmod/module.h"
 #include "iopmod/printk.h"
@@ -24,7 +23,7 @@
 #include "iopmod/sifcmd.h"
 #include "iopmod/sifman.h"
 #include "iopmod/spd.h"
-#include "iopmod/thread.h"
+#include "iopmod/workqueue.h"
 
 #include "iopmod/asm/macro.h"
 
@@ -89,8 +88,7 @@ struct ata_dev {
 
 	struct ata_sif_bb bb;
 
-	int sg_stid;
-	int sg_sema_id;
+	struct work_struct sg_work;
 };
 
 static void ata_direction(struct ata_dev *dev, const bool write)
@@ -300,6 +298,8 @@ static void ata_sif_cmd_sg_ack(struct ata_dev *dev)
 
 static void ata_sif_cmd_sg_transfer(struct ata_dev *dev)
 {
+	ata_direction(dev, dev->opt.write);
+
 	while (dev->index < dev->opt.count) {
 		struct ata_sif_sg_entry *e = &dev->sg.entry[dev->index];
 
@@ -331,18 +331,17 @@ static void ata_sif_cmd_sg_transfer(struct ata_dev *dev)
 static void ata_sif_cmd_sg(struct ata_dev *dev,
 	const union ata_sif_opt opt, const struct ata_sif_sg *sg)
 {
-	ata_direction(dev, opt.write);
-
 	dev->opt = opt;
 	memcpy(&dev->sg.entry[0], &sg->entry[0],
 		opt.count * sizeof(sg->entry[0]));
 	dev->index = 0;
 
-#if 0
-	thsemap_isignal_sema(dev->sg_sema_id);	// FIXME
-#else
-	ata_sif_cmd_sg_transfer(dev);
-#endif
+	/*
+	 * Transfers wait for DMA, so they are done in a worker rather than in
+	 * the SIF command handler. The main processor waits for the
+	 * acknowledgement before it requests the next list.
+	 */
+	queue_work(WQ_HIGHPRI, &dev->sg_work);
 }
 
 static void ata_sif_cmd(const struct sif_cmd_header *header, void *arg)
@@ -366,15 +365,11 @@ static void ata_sif_cmd(const struct sif_cmd_header *header, void *arg)
 	}
 }
 
-static void sg_event(void *arg)
+static void sg_work(struct work_struct *work)
 {
-	struct ata_dev *dev = arg;
-
-	for (;;) {
-		thsemap_wait_sema(dev->sg_sema_id);
+	struct ata_dev *dev = container_of(work, struct ata_dev, sg_work);
 
-		ata_sif_cmd_sg_transfer(dev);
-	}
+	ata_sif_cmd_sg_transfer(dev);
 }
 
 static enum module_init_status ata_init(int argc, char *argv[])
@@ -386,52 +381,22 @@ static enum module_init_status ata_init(int argc, char *argv[])
 	BUILD_BUG_ON(sizeof(union ata_sif_opt) != sizeof(u32));
 	BUILD_BUG_ON(sizeof(struct ata_sif_sg) > CMD_PACKET_PAYLOAD_MAX);
 
-	int err = dev9_request();
+	/*
+	 * Powering DEV9 off and on again resets the drive and its transfer
+	 * mode behind the back of the main processor, so DEV9 is requested
+	 * for as long as the module is resident. This also keeps power on,
+	 * which sleeps, out of the transfers.
+	 */
+	const int err = dev9_request();
 	if (err < 0) {
 		pr_err("%s: dev9_request failed with %d\n", __func__, err);
 		return MODULE_EXIT;
 	}
 
-	static const struct iop_thread sg_th = {
-		.attr = THREAD_ATTR_C,
-		.thread = sg_event,
-		.stacksize = 1024,
-		.priority = 0x26,	/* FIXME: What are reasonable priorities? */
-	};
-
-	dev.sg_stid = thbase_create(&sg_th);
-	if (dev.sg_stid < 0) {
-		pr_err("%s: thbase_create failed with %d: %s\n",
-			__func__, dev.sg_stid, iop_error_message(dev.sg_stid));
-		goto err_sg_thread_create;
-	}
-
-	const struct iop_sema sg_sema = { .initial = 1, .max = 1 };
-	dev.sg_sema_id = thsemap_create_sema(&sg_sema);
-	if (dev.sg_sema_id < 0) {
-		pr_err("%s: thsemap_create_sema failed with %d: %s\n",
-			__func__, dev.sg_sema_id, iop_error_message(dev.sg_sema_id));
-		goto err_sema_create;
-	}
-
-	int ioperr = thbase_start(dev.sg_stid, &dev);
-	if (ioperr < 0) {
-		pr_err("%s: thbase_start failed with %d: %s\n",
-			__func__, ioperr, iop_error_message(ioperr));
-		goto err_sg_thread_start;
-	}
+	INIT_WORK(&dev.sg_work, sg_work);
 
 	sif_request_cmd(SIF_CMD_ATA, ata_sif_cmd, &dev);
 
 	return MODULE_RESIDENT;
-
-err_sg_thread_start:
-	thsemap_delete_sema(dev.sg_sema_id);
-
-err_sema_create:
-	thbase_delete(dev.sg_stid);
-
-err_sg_thread_create:
-	return MODULE_EXIT;
 }
 module_init(ata_init);
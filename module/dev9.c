@@ -5,6 +5,7 @@
  * Copyright (C) 2021 Fredrik Noring
  */
 
+#include "iopmod/barrier.h"
 #include "iopmod/bits.h"
 #include "iopmod/dev9.h"
 #include "iopmod/errno.h"
@@ -14,24 +15,78 @@
 #include "iopmod/module.h"
 #include "iopmod/printk.h"
 #include "iopmod/spd.h"
+#include "iopmod/thread.h"
 
-/* FIXME: mutex */
-static int dev9_use_count;
+#include "iopmod/asm/macro.h"
+
+#define DEV9_POWER_DELAY_US	500000
+#define DEV9_POWER_OFF_US	1000000
+#define DEV9_IDLE_US		5000000	/* Power off after being unused. */
+
+/*
+ * Powering off sleeps for a second, so it is done by a thread of its own,
+ * below the workqueues, rather than by a shared worker.
+ */
+#define DEV9_IDLE_THREAD_PRIORITY	0x40
+#define DEV9_IDLE_THREAD_STACKSIZE	0x400
+
+/**
+ * struct dev9 - DEV9 expansion bay state
+ * @sema_id: semaphore serialising requests, releases and power changes
+ * @use_count: number of requests not yet released
+ * @release_seq: number of times @use_count has dropped to zero
+ * @powered: %true if powered on by this module
+ * @ssbus: SSBUS timings saved at power on, restored at power off
+ * @idle_thid: thread powering off when unused
+ * @idle_sema_id: semaphore waking the idle thread
+ */
+static struct dev9 {
+	int sema_id;
+	int use_count;
+	u32 release_seq;
+	bool powered;
+	u32 ssbus[3];
+	int idle_thid;
+	int idle_sema_id;
+} dev9;
+
+static const u32 dev9_ssbus_regs[] = {
+	SSBUS_REG_1420, SSBUS_REG_1418, SSBUS_REG_141c
+};
+
+static void dev9_set_power(u16 set, u16 clear)
+{
+	iowr16((iord16(DEV9_REG(DEV9_REG_POWER)) & ~clear) | set,
+		DEV9_REG(DEV9_REG_POWER));
+}
+
+static void dev9_reset()
+{
+	dev9_set_power(0x04, 0x01);
+	thbase_delay(DEV9_POWER_DELAY_US);
+
+	iowr16(iord16(DEV9_REG(DEV9_REG_1460)) | 0x01, DEV9_REG(DEV9_REG_1460));
+	dev9_set_power(0x01, 0);
+	thbase_delay(DEV9_POWER_DELAY_US);
+}
 
 static void dev9_power_on()
 {
+	for (int i = 0; i < ARRAY_SIZE(dev9_ssbus_regs); i++)
+		dev9.ssbus[i] = iord32(dev9_ssbus_regs[i]);
+
 	iowr32(0x51011,    SSBUS_REG_1420);
 	iowr32(0xe01a3043, SSBUS_REG_1418);
 	iowr32(0xef1a3043, SSBUS_REG_141c);
 
-	if (!(DEV9_REG(DEV9_REG_POWER) & 0x04)) {
+	if (!(iord16(DEV9_REG(DEV9_REG_POWER)) & 0x04)) {
 		pr_info("dev9: power is off\n");
 
 		iowr16(1, DEV9_REG(DEV9_REG_1466));
 		iowr16(0, DEV9_REG(DEV9_REG_1464));
 		iowr16(iord16(DEV9_REG(DEV9_REG_1464)), DEV9_REG(DEV9_REG_1460));
 
-		/* FIXME: Init Speed device */
+		dev9_reset();
 	} else {
 		pr_info("dev9: power is already on\n");
 	}
@@ -42,41 +97,151 @@ static void dev9_power_on()
 	pr_info("dev9: spdrev %x\n", spdrev);
 
 	pr_info("dev9: rev %x\n", iord8(DEV9_REG(DEV9_REG_REV)));
+
+	dev9.powered = true;
 }
 
 static void dev9_power_off()
 {
-	/* FIXME */
+	iowr16(1, DEV9_REG(DEV9_REG_1466));
+	iowr16(0, DEV9_REG(DEV9_REG_1464));
+	iowr16(iord16(DEV9_REG(DEV9_REG_1464)), DEV9_REG(DEV9_REG_1460));
+
+	dev9_set_power(0, 0x04);
+	dev9_set_power(0, 0x01);
+	thbase_delay(DEV9_POWER_OFF_US);
+
+	/* The SSBUS timings are left as they were before power on. */
+	if (dev9.powered)
+		for (int i = 0; i < ARRAY_SIZE(dev9_ssbus_regs); i++)
+			iowr32(dev9.ssbus[i], dev9_ssbus_regs[i]);
+
+	dev9.powered = false;
+
+	pr_info("dev9: power off\n");
+}
+
+/*
+ * Power off once unused for %DEV9_IDLE_US after a release. Requests hold the
+ * power on, and later releases wake the thread again to restart the wait.
+ */
+static void dev9_idle_thread(void *arg)
+{
+	for (;;) {
+		thsemap_wait_sema(dev9.idle_sema_id);
+
+		const u32 seq = READ_ONCE(dev9.release_seq);
+
+		thbase_delay(DEV9_IDLE_US);
+
+		thsemap_wait_sema(dev9.sema_id);
+
+		if (!dev9.use_count && dev9.release_seq == seq && dev9.powered)
+			dev9_power_off();
+
+		thsemap_signal_sema(dev9.sema_id);
+	}
 }
 
 int dev9_request()
 {
-	int err = 0;
+	const int ioperr = thsemap_wait_sema(dev9.sema_id);
+	if (ioperr < 0)
+		return errno_for_iop_error(ioperr);
 
-	if (!dev9_use_count)
+	const bool power_on = !dev9.powered;
+
+	if (power_on)
 		dev9_power_on();
 
-	dev9_use_count++;
+	dev9.use_count++;
 
-	return err;
+	thsemap_signal_sema(dev9.sema_id);
+
+	return power_on;
 }
 
 int dev9_release()
 {
 	int err = 0;
 
-	dev9_use_count--;
+	const int ioperr = thsemap_wait_sema(dev9.sema_id);
+	if (ioperr < 0)
+		return errno_for_iop_error(ioperr);
 
-	if (!dev9_use_count)
-		dev9_power_off();
+	if (!dev9.use_count) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	if (!--dev9.use_count) {
+		dev9.release_seq++;
+		thsemap_signal_sema(dev9.idle_sema_id);
+	}
+
+out:
+	thsemap_signal_sema(dev9.sema_id);
 
 	return err;
 }
 
 static enum module_init_status dev9_init(int argc, char *argv[])
 {
-	dev9_power_off();
+	int ioperr;
+
+	const struct iop_sema sema = { .initial = 1, .max = 1 };
+	dev9.sema_id = thsemap_create_sema(&sema);
+	if (dev9.sema_id < 0) {
+		pr_err("%s: thsemap_create_sema failed with %d: %s\n",
+			__func__, dev9.sema_id, iop_error_message(dev9.sema_id));
+		return MODULE_EXIT;
+	}
+
+	const struct iop_sema idle_sema = { .initial = 0, .max = 1 };
+	dev9.idle_sema_id = thsemap_create_sema(&idle_sema);
+	if (dev9.idle_sema_id < 0) {
+		pr_err("%s: thsemap_create_sema failed with %d: %s\n",
+			__func__, dev9.idle_sema_id,
+			iop_error_message(dev9.idle_sema_id));
+		goto err_idle_sema_create;
+	}
+
+	const struct iop_thread th = {
+		.attr = THREAD_ATTR_C,
+		.thread = dev9_idle_thread,
+		.stacksize = DEV9_IDLE_THREAD_STACKSIZE,
+		.priority = DEV9_IDLE_THREAD_PRIORITY,
+	};
+
+	dev9.idle_thid = thbase_create(&th);
+	if (dev9.idle_thid < 0) {
+		pr_err("%s: thbase_create failed with %d: %s\n",
+			__func__, dev9.idle_thid,
+			iop_error_message(dev9.idle_thid));
+		goto err_create;
+	}
+
+	ioperr = thbase_start(dev9.idle_thid, NULL);
+	if (ioperr < 0) {
+		pr_err("%s: thbase_start failed with %d: %s\n",
+			__func__, ioperr, iop_error_message(ioperr));
+		goto err_start;
+	}
+
+	if (iord16(DEV9_REG(DEV9_REG_POWER)) & 0x04)
+		dev9_power_off();
 
 	return MODULE_RESIDENT;
+
+err_start:
+	thbase_delete(dev9.idle_thid);
+
+err_create:
+	thsemap_delete_sema(dev9.idle_sema_id);
+
+err_idle_sema_create:
+	thsemap_delete_sema(dev9.sema_id);
+
+	return MODULE_EXIT;
 }
 module_init(dev9_init);
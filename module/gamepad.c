@@ -5,10 +5,12 @@
  * Copyright (C) 2020 Fredrik Noring
  */
 
+#include "iopmod/bits.h"
+#include "iopmod/build-bug.h"
+#include "iopmod/compare.h"
 #include "iopmod/errno.h"
 #include "iopmod/interrupt.h"
 #include "iopmod/io.h"
-#include "iopmod/iop-error.h"
 #include "iopmod/irq.h"
 #include "iopmod/module.h"
 #include "iopmod/printk.h"
@@ -16,7 +18,9 @@
 #include "iopmod/sifcmd.h"
 #include "iopmod/sifman.h"
 #include "iopmod/sio2.h"
+#include "iopmod/string.h"
 #include "iopmod/thread.h"
+#include "iopmod/timer.h"
 
 #include "iopmod/asm/macro.h"
 
@@ -29,6 +33,158 @@
 
 #define SIO2_REG(reg) { #reg, SIO2_REG_##reg }
 
+#define GAMEPAD_PERIOD_US	5000
+#define GAMEPAD_PERIOD_MIN_US	1000
+#define GAMEPAD_TIMEOUT_US	100000	/* Reset SIO2 if a poll is stuck. */
+
+#define GAMEPAD_DEADZONE_STICK		4
+#define GAMEPAD_DEADZONE_PRESSURE	8
+
+#define CONTROLLER_CMD_POLL	0x42
+#define CONTROLLER_CMD_CONFIG	0x43
+#define CONTROLLER_CMD_MODE	0x44
+#define CONTROLLER_CMD_MOTOR	0x4d
+#define CONTROLLER_CMD_RESPONSE	0x4f
+
+#define CONTROLLER_MODE_DIGITAL		0x41
+#define CONTROLLER_MODE_ANALOGUE	0x73
+#define CONTROLLER_MODE_PRESSURE	0x79
+#define CONTROLLER_MODE_CONFIG		0xf3
+
+/*
+ * Multitaps answer commands addressed to 0x21 rather than 0x01. Ports
+ * without an attached controller are queried for a multitap, and a
+ * multitap slot is selected before each of its controllers is polled.
+ */
+#define MULTITAP_CMD_QUERY	0x12
+#define MULTITAP_CMD_SELECT	0x21
+#define MULTITAP_CMD_SIZE	6
+#define MULTITAP_SLOTS		4
+
+#define SIO2_PAD_PORTS		2
+#define SIO2_CMD_QUEUE_SIZE	16
+
+#define CONTROLLER_HEADER_SIZE	3	/* Address, mode and 0x5a. */
+#define CONTROLLER_DISCOVER_SIZE 5
+#define CONTROLLER_CONFIG_SIZE	9
+#define CONTROLLER_MAX_SIZE	(CONTROLLER_HEADER_SIZE + sizeof(union controller))
+
+/**
+ * enum iop_gamepad_rops - IOP gamepad remote operations
+ * @rop_report: Controller report to the main processor
+ * @rop_period: Set poll period in microseconds, at least 1 ms and rounded
+ * 	up to whole timer jiffies
+ * @rop_deadzone: Set deadzones of sticks and pressure sensitive buttons
+ * @rop_attach: Controller attached event to the main processor
+ * @rop_detach: Controller detached event to the main processor
+ * @rop_batch: Enable or disable batched reports
+ * @rop_reports: Batch of controller reports to the main processor
+ * @rop_rumble: Set vibration motors of a controller
+ * @rop_multitap: Enable or disable multitaps, which are enabled by default
+ */
+enum iop_gamepad_rops {
+	rop_report   = 0,
+	rop_period   = 1,
+	rop_deadzone = 2,
+	rop_attach   = 3,
+	rop_detach   = 4,
+	rop_batch    = 5,
+	rop_reports  = 6,
+	rop_rumble   = 7,
+	rop_multitap = 8,
+};
+
+union gamepad_sif_opt {
+	u32 raw;
+	struct {
+		u32 op : 4;
+		u32 : 28;
+	};
+};
+
+struct gamepad_sif_period {
+	u32 us;
+};
+
+/**
+ * struct gamepad_sif_deadzone - deadzones for analogue values
+ * @stick: change of stick positions required to report a stick
+ * @pressure: change of pressure required to report a pressure button
+ *
+ * Digital buttons are always reported when changed.
+ */
+struct gamepad_sif_deadzone {
+	u8 stick;
+	u8 pressure;
+};
+
+/**
+ * struct gamepad_sif_batch - batched reports mode
+ * @enable: %true to send all reports of a poll cycle in one SIF command
+ */
+struct gamepad_sif_batch {
+	u8 enable;
+};
+
+/**
+ * struct gamepad_sif_multitap - multitap mode
+ * @enable: %true to query ports for multitaps and poll their slots, %false
+ * 	to poll ports directly and detach any multitaps
+ */
+struct gamepad_sif_multitap {
+	u8 enable;
+};
+
+/**
+ * struct gamepad_sif_rumble - vibration motors of a controller
+ * @port: controller port
+ * @slot: multitap slot, or 0 without multitap
+ * @small: small motor, off if zero and otherwise on
+ * @large: large motor speed, off if zero
+ *
+ * The motors are set with the next regular poll of the controller.
+ */
+struct gamepad_sif_rumble {
+	u8 port;
+	u8 slot;
+	u8 small;
+	u8 large;
+};
+
+/**
+ * struct gamepad_sif_event - controller attached or detached event
+ * @port: controller port
+ * @slot: multitap slot, or 0 without multitap
+ * @mode: controller mode, for example %CONTROLLER_MODE_PRESSURE
+ */
+struct gamepad_sif_event {
+	u8 port;
+	u8 slot;
+	u8 mode;
+};
+
+/**
+ * struct gamepad_sif_report - delta-compressed controller report
+ * @changed: bit n is set if byte n of union controller is included in @byte
+ * @timestamp: low 32 bits of the system clock when the poll completed
+ * @port: controller port
+ * @slot: multitap slot, or 0 without multitap
+ * @mode: controller mode, for example %CONTROLLER_MODE_PRESSURE
+ * @byte: changed bytes of union controller, in order
+ *
+ * Only the changed bytes are sent, so the size of the report varies. In
+ * batched mode, the reports of a poll cycle follow each other with sizes
+ * rounded up to multiples of 4 bytes, in as few SIF commands as possible.
+ */
+struct gamepad_sif_report {
+	u32 changed;
+	u32 timestamp;
+	u8 port;
+	u8 slot;
+	u8 mode;
+	u8 byte[18];
+};
+
 struct digital_pad {
 	struct {
 		u8 select : 1;
@@ -73,186 +229,701 @@ struct analogue_pad {
 	u8 r2;
 };
 
+/**
+ * union controller - controller data, in the order of poll responses
+ * @digital_pad: digital buttons, active low
+ * @analogue_pad: stick positions and button pressures, if supported
+ * @byte: raw data
+ */
 union controller {
-	struct digital_pad digital_pad;
-	u8 byte[2];
+	struct {
+		struct digital_pad digital_pad;
+		struct analogue_pad analogue_pad;
+	};
+	u8 byte[18];
 };
 
-static struct {
-	enum {
-		CONTROLLER_DISCOVER,
-		CONTROLLER_ATTACHED,
-	} state;
-	struct {
-		u32 us;
-	} event;
+/**
+ * enum controller_state - controller state
+ * @CONTROLLER_DISCOVER: poll to discover an attached controller
+ * @CONTROLLER_CONFIG_ENTER: enter configuration mode
+ * @CONTROLLER_CONFIG_MODE: set analogue mode and lock it
+ * @CONTROLLER_CONFIG_RESPONSE: enable stick and pressure bytes in polls
+ * @CONTROLLER_CONFIG_MOTOR: map the vibration motors to poll bytes
+ * @CONTROLLER_CONFIG_EXIT: exit configuration mode
+ * @CONTROLLER_ATTACHED: poll and report an attached controller
+ *
+ * Every discovered controller is configured, also one that already is in
+ * pressure mode, for example after the module has been reloaded, since
+ * the vibration motors must be mapped again. Digital controllers that
+ * cannot be configured are attached as they are.
+ */
+enum controller_state {
+	CONTROLLER_DISCOVER,
+	CONTROLLER_CONFIG_ENTER,
+	CONTROLLER_CONFIG_MODE,
+	CONTROLLER_CONFIG_RESPONSE,
+	CONTROLLER_CONFIG_MOTOR,
+	CONTROLLER_CONFIG_EXIT,
+	CONTROLLER_ATTACHED,
+};
+
+/**
+ * struct controller_port - controller port state
+ * @state: controller state
+ * @mode: most recent controller mode
+ * @size: size of the next transfer, which depends on @mode
+ * @report_all: report all values of a newly attached controller
+ * @small: small vibration motor, off if zero and otherwise on
+ * @large: large vibration motor speed, off if zero
+ * @controller: most recently reported controller data
+ */
+static struct controller_port {
+	enum controller_state state;
+	u8 mode;
+	u8 size;
+	bool report_all;
+	u8 small;
+	u8 large;
 	union controller controller;
-} controller_state[2];
+} controller_state[SIO2_PAD_PORTS * MULTITAP_SLOTS];
+
+/**
+ * struct sio2_pad_port - SIO2 controller port
+ * @port: SIO2 port
+ * @multitap: %true if a multitap is attached, with a controller per slot
+ */
+static struct sio2_pad_port {
+	u8 port;
+	bool multitap;
+} sio2_pad_ports[SIO2_PAD_PORTS] = {
+	{ .port = 1 },
+	{ .port = 0 },
+};
+
+/**
+ * enum sio2_xfer_type - type of queued SIO2 transfer
+ * @XFER_MULTITAP_QUERY: query whether a multitap is attached
+ * @XFER_MULTITAP_SELECT: select multitap slot for the next transfer
+ * @XFER_CONTROLLER: controller poll or configuration command
+ */
+enum sio2_xfer_type {
+	XFER_MULTITAP_QUERY,
+	XFER_MULTITAP_SELECT,
+	XFER_CONTROLLER,
+};
+
+/**
+ * struct sio2_xfer - queued SIO2 transfer
+ * @type: type of transfer
+ * @port: index of SIO2 controller port
+ * @slot: multitap slot
+ * @size: transmit and receive size in bytes
+ */
+struct sio2_xfer {
+	u8 type;
+	u8 port;
+	u8 slot;
+	u8 size;
+};
+
+/*
+ * All controllers are polled with a single SIO2 command queue, so that a
+ * poll cycle takes a single interrupt. Two multitaps with four controllers
+ * each need 16 commands and at most 216 bytes of the 256 byte FIFO. The
+ * transmit and receive streams of all commands are transferred at once.
+ */
+static struct {
+	struct sio2_xfer xfer[SIO2_CMD_QUEUE_SIZE];
+	int count;
+	size_t size;
+	u8 tx[SIO2_FIFO_SIZE] __attribute__((aligned(4)));
+	u8 rx[SIO2_FIFO_SIZE] __attribute__((aligned(4)));
+} queue;
+
+/*
+ * A poll is busy from its transfer until it has been received, and
+ * completed once the SIO2 has interrupted. A poll that does not complete
+ * within %GAMEPAD_TIMEOUT_US resets the SIO2.
+ */
+static struct {
+	struct timer_list timer;
+	u32 period;
+	u32 start;
+	u32 timestamp;
+	bool busy;
+	bool completed;
+} poll;
 
-static int event_stid;
-static int event_sema_id;
+static bool multitap_enable = true;
+
+static struct {
+	bool enable;
+	size_t size;
+	u8 buffer[CMD_PACKET_PAYLOAD_MAX] __attribute__((aligned(4)));
+} batch;
+
+static struct gamepad_sif_deadzone deadzone = {
+	.stick = GAMEPAD_DEADZONE_STICK,
+	.pressure = GAMEPAD_DEADZONE_PRESSURE,
+};
+
+static struct controller_port *controller_port(int port, int slot)
+{
+	return &controller_state[port * MULTITAP_SLOTS + slot];
+}
 
 static enum irq_status sio2_irq(void *arg)
 {
-	thsemap_isignal_sema(event_sema_id);
+	/* Pass on completions of transfers that were not ours. */
+	if (!poll.busy)
+		return IRQ_NONE;
+
+	poll.timestamp = sys_clock_cycles();
+	poll.completed = true;
 
 	sio2_cl_irq_stat();
 
-	return IRQ_HANDLED;
+	return IRQ_WAKE_THREAD;
+}
+
+static size_t controller_cmd(const struct controller_port *cp, u8 *tx)
+{
+	memset(tx, 0, CONTROLLER_MAX_SIZE);
+
+	tx[0] = 0x01;
+
+	switch (cp->state) {
+	case CONTROLLER_DISCOVER:
+		tx[1] = CONTROLLER_CMD_POLL;
+		return cp->size;
+
+	case CONTROLLER_ATTACHED:
+		tx[1] = CONTROLLER_CMD_POLL;
+		tx[3] = cp->small ? 0x01 : 0x00;
+		tx[4] = cp->large;
+		return cp->size;
+
+	case CONTROLLER_CONFIG_ENTER:
+		/* The response is a poll in the current mode. */
+		tx[1] = CONTROLLER_CMD_CONFIG;
+		tx[3] = 0x01;
+		return cp->size;
+
+	case CONTROLLER_CONFIG_MODE:
+		tx[1] = CONTROLLER_CMD_MODE;
+		tx[3] = 0x01;		/* Analogue */
+		tx[4] = 0x03;		/* Lock mode button */
+		return CONTROLLER_CONFIG_SIZE;
+
+	case CONTROLLER_CONFIG_RESPONSE:
+		tx[1] = CONTROLLER_CMD_RESPONSE;
+		tx[3] = 0xff;		/* Sticks and pressures */
+		tx[4] = 0xff;
+		tx[5] = 0x03;
+		return CONTROLLER_CONFIG_SIZE;
+
+	case CONTROLLER_CONFIG_MOTOR:
+		tx[1] = CONTROLLER_CMD_MOTOR;
+		tx[3] = 0x00;		/* Small motor in poll byte 3 */
+		tx[4] = 0x01;		/* Large motor in poll byte 4 */
+		memset(&tx[5], 0xff, 4);
+		return CONTROLLER_CONFIG_SIZE;
+
+	case CONTROLLER_CONFIG_EXIT:
+		tx[1] = CONTROLLER_CMD_CONFIG;
+		memset(&tx[4], 0x5a, 5);
+		return CONTROLLER_CONFIG_SIZE;
+	}
+
+	return 0;
+}
+
+static size_t multitap_cmd(u8 cmd, int slot, u8 *tx)
+{
+	memset(tx, 0, MULTITAP_CMD_SIZE);
+
+	tx[0] = 0x21;
+	tx[1] = cmd;
+	tx[2] = slot;
+
+	return MULTITAP_CMD_SIZE;
+}
+
+static void queue_xfer(enum sio2_xfer_type type, int port, int slot,
+	const u8 *tx, size_t size)
+{
+	SIO2_WS_CMD(queue.count, .port = sio2_pad_ports[port].port, .cfg = 4,
+		.tx_size = size, .rx_size = size);
+
+	memcpy(&queue.tx[queue.size], tx, size);
+	queue.size += size;
+
+	queue.xfer[queue.count++] = (struct sio2_xfer) {
+		.type = type,
+		.port = port,
+		.slot = slot,
+		.size = size,
+	};
+}
+
+static void queue_controller(int port, int slot)
+{
+	struct controller_port *cp = controller_port(port, slot);
+	u8 tx[CONTROLLER_MAX_SIZE];
+
+	cp->size = controller_cmd(cp, tx);
+
+	queue_xfer(XFER_CONTROLLER, port, slot, tx, cp->size);
+}
+
+static void queue_multitap(u8 cmd, int port, int slot)
+{
+	u8 tx[MULTITAP_CMD_SIZE];
+	const size_t size = multitap_cmd(cmd, slot, tx);
+
+	queue_xfer(cmd == MULTITAP_CMD_QUERY ?
+		XFER_MULTITAP_QUERY : XFER_MULTITAP_SELECT,
+		port, slot, tx, size);
 }
 
 static void controller_tx(void)
 {
-	SIO2_WS_CMD(0, .port = 1, .cfg = 4, .tx_size = 5, .rx_size = 5);
-	SIO2_WS_CMD(1, .port = 0, .cfg = 4, .tx_size = 5, .rx_size = 5);
-	SIO2_WS_CMD(2,);
-
-	sio2_wr_tx8(1);
-	sio2_wr_tx8('B');
-	sio2_wr_tx8(0);
-	sio2_wr_tx8(0);
-	sio2_wr_tx8(0);
-
-	sio2_wr_tx8(1);
-	sio2_wr_tx8('B');
-	sio2_wr_tx8(0);
-	sio2_wr_tx8(0);
-	sio2_wr_tx8(0);
+	poll.busy = true;
+	poll.completed = false;
+	poll.start = timer_jiffies();
+
+	queue.count = 0;
+	queue.size = 0;
+
+	for (int port = 0; port < ARRAY_SIZE(sio2_pad_ports); port++)
+		if (sio2_pad_ports[port].multitap) {
+			for (int slot = 0; slot < MULTITAP_SLOTS; slot++) {
+				queue_multitap(MULTITAP_CMD_SELECT, port, slot);
+				queue_controller(port, slot);
+			}
+		} else {
+			/* Attached controllers are not multitaps. */
+			if (multitap_enable && controller_port(port, 0)->state ==
+					CONTROLLER_DISCOVER)
+				queue_multitap(MULTITAP_CMD_QUERY, port, 0);
+			queue_controller(port, 0);
+		}
+
+	if (queue.count < SIO2_CMD_QUEUE_SIZE)
+		SIO2_WS_CMD(queue.count,);
+
+	sio2_wr_tx(queue.tx, queue.size);
 
 	SIO2_WS_CTRL(.start = true, SIO2_CTRL_SETTINGS);
 }
 
-static bool controller_rx_digital_pad(union controller *controller)
+static void controller_event(const struct controller_port *cp,
+	enum iop_gamepad_rops op)
 {
-	sio2_rd_rx8();
-	sio2_rd_rx8();
-	sio2_rd_rx8();
+	const int index = cp - controller_state;
+	const struct gamepad_sif_event event = {
+		.port = index / MULTITAP_SLOTS,
+		.slot = index % MULTITAP_SLOTS,
+		.mode = cp->mode,
+	};
+	int err;
 
-	const u8 d0 = sio2_rd_rx8();
-	const u8 d1 = sio2_rd_rx8();
-	const bool change =
-		d0 != controller->byte[0] ||
-		d1 != controller->byte[1];
+	err = sif_cmd_opt(SIF_CMD_GAMEPAD,
+		(union gamepad_sif_opt) { .op = op }.raw,
+		&event, sizeof(event));
+	if (err < 0)
+		pr_err("%s: sif_cmd_opt failed with %d\n", __func__, err);
+}
 
-	controller->byte[0] = d0;
-	controller->byte[1] = d1;
+static void controller_set_state(struct controller_port *cp,
+	enum controller_state state)
+{
+	if (cp->state != CONTROLLER_ATTACHED && state == CONTROLLER_ATTACHED)
+		controller_event(cp, rop_attach);
+	else if (cp->state == CONTROLLER_ATTACHED && state != CONTROLLER_ATTACHED)
+		controller_event(cp, rop_detach);
 
-	return change;
+	cp->state = state;
 }
 
-static void controller_rx(void)
+static void controller_detach(struct controller_port *cp)
 {
-	for (int i = 0; i < ARRAY_SIZE(controller_state); i++)
-		if (controller_rx_digital_pad(&controller_state[i].controller)) {
-			const struct {
-				u8 port, d0, d1;
-			} packet = {
-				i,
-				controller_state[i].controller.byte[0],
-				controller_state[i].controller.byte[1],
-			};
-			int err;
-
-			err = sif_cmd(SIF_CMD_GAMEPAD, &packet, sizeof(packet));
-			if (err < 0)
-				pr_err("%s: sif_cmd failed with %d\n", __func__, err);
+	controller_set_state(cp, CONTROLLER_DISCOVER);
+	cp->size = CONTROLLER_DISCOVER_SIZE;
+	cp->small = 0;
+	cp->large = 0;
+}
+
+static void multitap_detach(int port)
+{
+	pr_info("gamepad: multitap detached from port %d\n", port);
+	sio2_pad_ports[port].multitap = false;
+
+	for (int slot = 1; slot < MULTITAP_SLOTS; slot++)
+		controller_detach(controller_port(port, slot));
+}
+
+static bool controller_moved(const struct controller_port *cp,
+	const union controller *c, size_t i)
+{
+	const int threshold =
+		i < offsetof(union controller, analogue_pad) ? 0 :
+		i < offsetof(union controller, analogue_pad.right) ?
+			deadzone.stick : deadzone.pressure;
+	const int d = c->byte[i] - cp->controller.byte[i];
+
+	return cp->report_all || d > threshold || -d > threshold;
+}
+
+static void batch_flush(void)
+{
+	int err;
+
+	if (!batch.size)
+		return;
+
+	err = sif_cmd_opt(SIF_CMD_GAMEPAD,
+		(union gamepad_sif_opt) { .op = rop_reports }.raw,
+		batch.buffer, batch.size);
+	if (err < 0)
+		pr_err("%s: sif_cmd_opt failed with %d\n", __func__, err);
+
+	batch.size = 0;
+}
+
+static void batch_report(const struct gamepad_sif_report *report, size_t size)
+{
+	const size_t aligned_size = ALIGN(size, 4);
+
+	if (batch.size + aligned_size > sizeof(batch.buffer))
+		batch_flush();
+
+	memcpy(&batch.buffer[batch.size], report, size);
+	batch.size += aligned_size;
+}
+
+static void controller_report(struct controller_port *cp,
+	const union controller *c, size_t size)
+{
+	const int index = cp - controller_state;
+	struct gamepad_sif_report report = {
+		.timestamp = poll.timestamp,
+		.port = index / MULTITAP_SLOTS,
+		.slot = index % MULTITAP_SLOTS,
+		.mode = cp->mode,
+	};
+	size_t count = 0;
+	int err;
+
+	for (size_t i = 0; i < size; i++)
+		if (controller_moved(cp, c, i)) {
+			report.changed |= BIT(i);
+			report.byte[count++] = c->byte[i];
+			cp->controller.byte[i] = c->byte[i];
+		}
+
+	cp->report_all = false;
+
+	if (!report.changed)
+		return;
+
+	const size_t report_size = offsetof(struct gamepad_sif_report, byte[count]);
+
+	if (batch.enable) {
+		batch_report(&report, report_size);
+		return;
+	}
+
+	err = sif_cmd_opt(SIF_CMD_GAMEPAD,
+		(union gamepad_sif_opt) { .op = rop_report }.raw,
+		&report, report_size);
+	if (err < 0)
+		pr_err("%s: sif_cmd_opt failed with %d\n", __func__, err);
+}
+
+static void controller_rx_port(struct controller_port *cp,
+	const u8 *rx, size_t size)
+{
+	union controller c;
+
+	if (rx[2] != 0x5a) {
+		/* Configuration steps proceed regardless. */
+		if (CONTROLLER_CONFIG_MODE <= cp->state &&
+		    cp->state <= CONTROLLER_CONFIG_EXIT) {
+			controller_set_state(cp, cp->state + 1);
+			return;
 		}
+
+		controller_detach(cp);
+		return;
+	}
+
+	/* The mode tells the number of halfwords following the header. */
+	const size_t data_size = min_t(size_t, 2 * (rx[1] & 0xf), sizeof(c));
+	cp->mode = rx[1];
+	cp->size = CONTROLLER_HEADER_SIZE + data_size;
+
+	switch (cp->state) {
+	case CONTROLLER_DISCOVER:
+		controller_set_state(cp, CONTROLLER_CONFIG_ENTER);
+		cp->report_all = true;
+		return;
+
+	case CONTROLLER_CONFIG_ENTER:
+		controller_set_state(cp, CONTROLLER_CONFIG_MODE);
+		return;
+
+	case CONTROLLER_CONFIG_MODE:
+		/* Digital controllers do not enter configuration mode. */
+		controller_set_state(cp, cp->mode == CONTROLLER_MODE_CONFIG ?
+			CONTROLLER_CONFIG_RESPONSE : CONTROLLER_ATTACHED);
+		return;
+
+	case CONTROLLER_CONFIG_RESPONSE:
+		controller_set_state(cp, CONTROLLER_CONFIG_MOTOR);
+		return;
+
+	case CONTROLLER_CONFIG_MOTOR:
+		controller_set_state(cp, CONTROLLER_CONFIG_EXIT);
+		return;
+
+	case CONTROLLER_CONFIG_EXIT:
+		controller_set_state(cp, CONTROLLER_ATTACHED);
+		return;
+
+	case CONTROLLER_ATTACHED:
+		break;
+	}
+
+	/* Skip a poll that was shorter than the data of the current mode. */
+	if (size < cp->size)
+		return;
+
+	memcpy(c.byte, &rx[CONTROLLER_HEADER_SIZE], data_size);
+
+	controller_report(cp, &c, data_size);
 }
 
-static unsigned int event_alarm(void *arg)
+static bool multitap_rx(const struct sio2_xfer *xfer, const u8 *rx)
 {
-	thsemap_isignal_sema(event_sema_id);
+	struct sio2_pad_port *pp = &sio2_pad_ports[xfer->port];
+
+	switch (xfer->type) {
+	case XFER_MULTITAP_QUERY:
+		if (multitap_enable && rx[1] == 0x80 && rx[2] == 0x5a) {
+			pr_info("gamepad: multitap attached to port %d\n",
+				xfer->port);
+			pp->multitap = true;
+		}
+		return true;	/* Slot 0 is the port itself without multitap. */
 
-	return 0;
+	case XFER_MULTITAP_SELECT:
+		if (rx[1] == 0x80 && rx[2] == 0x5a && rx[4] == xfer->slot)
+			return true;
+
+		if (xfer->slot != 0)
+			return false;
+
+		multitap_detach(xfer->port);
+		return true;
+	}
+
+	return false;
+}
+
+static void controller_rx(void)
+{
+	bool selected = true;
+	size_t offset = 0;
+
+	sio2_rd_rx(queue.rx, queue.size);
+
+	for (int i = 0; i < queue.count; i++) {
+		const struct sio2_xfer *xfer = &queue.xfer[i];
+		const u8 *rx = &queue.rx[offset];
+
+		offset += xfer->size;
+
+		if (xfer->type != XFER_CONTROLLER) {
+			selected = multitap_rx(xfer, rx);
+			continue;
+		}
+
+		struct controller_port *cp =
+			controller_port(xfer->port, xfer->slot);
+
+		/* The poll went elsewhere if its slot was not selected. */
+		if (selected)
+			controller_rx_port(cp, rx, xfer->size);
+		else
+			controller_detach(cp);
+	}
+
+	batch_flush();
 }
 
-static void sio2_event(void *arg)
+/*
+ * The SIO2 normally completes with its own timeout for ports that do not
+ * respond, but a poll may still be stuck, for example by a multitap that
+ * never answers a slot selection. The SIO2 is then reset, and multitaps
+ * are detached to poll their ports directly until queried again.
+ */
+static void poll_timeout(void)
 {
-	bool schedule = true;
+	pr_warn("gamepad: poll timed out\n");
+
+	SIO2_WS_CTRL(.reset = true, .reset_fifo = true, SIO2_CTRL_SETTINGS);
 
-	for (;;) {
-		thsemap_wait_sema(event_sema_id);
+	for (int port = 0; port < ARRAY_SIZE(sio2_pad_ports); port++)
+		if (sio2_pad_ports[port].multitap)
+			multitap_detach(port);
 
-		if (schedule) {
+	poll.busy = false;
+	sio2_release();
+}
+
+static void poll_timer(struct timer_list *timer)
+{
+	/*
+	 * Only register writes, so the interrupt context is fine. A poll is
+	 * skipped if the previous one is still being received, or if the SIO2
+	 * is in use by another driver, such as memcard.
+	 */
+	if (!poll.busy) {
+		if (!sio2_try_request())
 			controller_tx();
+	} else if (!poll.completed && timer_jiffies() - poll.start >=
+			us_to_jiffies(GAMEPAD_TIMEOUT_US))
+		poll_timeout();
 
-			schedule = false;
-		} else {
-			struct iop_sys_clock next_event;
+	/* Rearm with the current period. */
+	mod_timer(timer, timer->expires + poll.period);
+}
+
+static enum irq_status sio2_thread(void *arg)
+{
+	controller_rx();
 
-			controller_rx();
+	for (int port = 0; port < ARRAY_SIZE(sio2_pad_ports); port++)
+		if (sio2_pad_ports[port].multitap && !multitap_enable)
+			multitap_detach(port);
 
-			thbase_us_to_sys_clock(5000, &next_event);
-			thbase_set_alarm(&next_event, event_alarm, NULL);
+	poll.busy = false;
+	sio2_release();
 
-			schedule = true;
+	return IRQ_HANDLED;
+}
+
+static void set_period(u32 us)
+{
+	poll.period = us_to_jiffies(max_t(u32, us, GAMEPAD_PERIOD_MIN_US));
+}
+
+static void gamepad_sif_cmd(const struct sif_cmd_header *header, void *arg)
+{
+	const union gamepad_sif_opt opt = { .raw = header->opt };
+	void *p = sif_cmd_payload(header);
+
+	switch (opt.op)
+	{
+	case rop_period: {
+		const struct gamepad_sif_period *period = p;
+
+		set_period(period->us);
+		break;
+	}
+	case rop_deadzone: {
+		const struct gamepad_sif_deadzone *dz = p;
+
+		deadzone = *dz;
+		break;
+	}
+	case rop_rumble: {
+		const struct gamepad_sif_rumble *rumble = p;
+
+		if (rumble->port >= SIO2_PAD_PORTS ||
+		    rumble->slot >= MULTITAP_SLOTS) {
+			pr_err("%s: Invalid port %u slot %u\n", __func__,
+				rumble->port, rumble->slot);
+			break;
 		}
+
+		struct controller_port *cp =
+			controller_port(rumble->port, rumble->slot);
+
+		cp->small = rumble->small;
+		cp->large = rumble->large;
+		break;
+	}
+	case rop_batch: {
+		const struct gamepad_sif_batch *b = p;
+
+		batch.enable = b->enable;
+		break;
+	}
+	case rop_multitap: {
+		const struct gamepad_sif_multitap *m = p;
+
+		/* Multitaps are detached by the thread once disabled. */
+		multitap_enable = m->enable;
+		break;
+	}
+	default:
+		pr_err("%s: Unknown op %d\n", __func__, opt.op);
 	}
 }
 
 static enum module_init_status gamepad_init(int argc, char *argv[])
 {
+	BUILD_BUG_ON(sizeof(union gamepad_sif_opt) != sizeof(u32));
+	BUILD_BUG_ON(sizeof(union controller) != 18);
+	BUILD_BUG_ON(MULTITAP_CMD_SIZE > CONTROLLER_MAX_SIZE);
+
+	for (int i = 0; i < ARRAY_SIZE(controller_state); i++)
+		controller_state[i].size = CONTROLLER_DISCOVER_SIZE;
+	BUILD_BUG_ON(sizeof(struct gamepad_sif_report) > CMD_PACKET_PAYLOAD_MAX);
+
 	pr_info("gamepad: initialised\n");
 
-	for (size_t i = 0; i < 256; i++) {
-		iowr8(0, SIO2_MEM_FIFO_TX + i);
-		iowr8(0, SIO2_MEM_FIFO_RX + i);
+	int err = request_threaded_irq(IRQ_IOP_SIO2, sio2_irq, sio2_thread, NULL);
+	if (err < 0) {
+		pr_err("%s: request_threaded_irq for IRQ_IOP_SIO2 failed with %d\n",
+			__func__, err);
+		return MODULE_EXIT;
 	}
-	for (size_t i = 0; i < 16; i++)
-		sio2_wr_cmd(i, 0);
 
-	int err = request_irq(IRQ_IOP_SIO2, sio2_irq, NULL);
+	pr_info("gamepad: register\n");
+
+	err = sio2_request();
 	if (err < 0) {
-		pr_err("%s: request_irq for IRQ_IOP_SIO2 failed with %d\n", __func__, err);
+		pr_err("%s: sio2_request failed with %d\n", __func__, err);
+		release_irq(IRQ_IOP_SIO2, sio2_thread, NULL);
 		return MODULE_EXIT;
 	}
 
-	pr_info("gamepad: register\n");
+	sio2_clear_fifo();
+	for (size_t i = 0; i < 16; i++)
+		sio2_wr_cmd(i, 0);
 
 	SIO2_WS_CTRL(.reset = true, .reset_fifo = true, SIO2_CTRL_SETTINGS);
 
-	int ioperr;
+	sio2_release();
 
-	static const struct iop_thread event_th = {
-		.attr = THREAD_ATTR_C,
-		.thread = sio2_event,
-		.stacksize = 1024,
-		.priority = 0x26,	/* FIXME: What are reasonable priorities? */
-	};
-
-	event_stid = thbase_create(&event_th);
-	if (event_stid < 0) {
-		pr_err("%s: thbase_create failed with %d: %s\n",
-			__func__, event_stid, iop_error_message(event_stid));
-		goto err_event_create;
-	}
+	set_period(GAMEPAD_PERIOD_US);
 
-	const struct iop_sema event_sema = { .initial = 1, .max = 1 };
-	event_sema_id = thsemap_create_sema(&event_sema);
-	if (event_sema_id < 0) {
-		pr_err("%s: thsemap_create_sema failed with %d: %s\n",
-			__func__, event_sema_id, iop_error_message(event_sema_id));
-		goto err_sema_create;
+	timer_setup(&poll.timer, poll_timer);
+	err = mod_timer(&poll.timer, timer_jiffies() + poll.period);
+	if (err < 0) {
+		pr_err("%s: mod_timer failed with %d\n", __func__, err);
+		release_irq(IRQ_IOP_SIO2, sio2_thread, NULL);
+		return MODULE_EXIT;
 	}
 
-	ioperr = thbase_start(event_stid, NULL);
-	if (ioperr < 0) {
-		pr_err("%s: thbase_start failed with %d: %s\n",
-			__func__, ioperr, iop_error_message(ioperr));
-		goto err_event_start;
-	}
+	sif_request_cmd(SIF_CMD_GAMEPAD, gamepad_sif_cmd, NULL);
 
 	pr_info("sio2: ready\n");
 
 	return MODULE_RESIDENT;
-
-err_event_start:
-	thsemap_delete_sema(event_sema_id);
-
-err_sema_create:
-	thbase_delete(event_stid);
-
-err_event_create:
-	return MODULE_EXIT;
 }
 module_init(gamepad_init);
@@ -7,13 +7,80 @@
  *
  * The available IRQs are defined in <include/iopmod/irqs.h>.
  *
+ * Interrupt lines can be shared by multiple handlers, for example by irqrelay
+ * and a driver handling some of the interrupts on the IOP. Handlers are kept
+ * in a chain per line, allocated from a small preallocated pool.
+ *
+ * Threaded handlers split interrupt handling into a fast handler running in
+ * the interrupt context, and a thread function doing the remaining work with
+ * the line masked until it completes, which keeps interrupt-off times short.
+ * A thread function can also poll with the line masked, by asking to be
+ * called again, which mitigates interrupts from busy devices such as the
+ * network interface. How such polls are done is selected per line with
+ * set_irq_poll().
+ *
  * Copyright (C) 2021 Fredrik Noring
  */
 
+#include "iopmod/barrier.h"
+#include "iopmod/compare.h"
+#include "iopmod/errno.h"
 #include "iopmod/interrupt.h"
+#include "iopmod/iop-error.h"
 #include "iopmod/irq.h"
 #include "iopmod/module.h"
+#include "iopmod/printk.h"
 #include "iopmod/spd-irq.h"
+#include "iopmod/thread.h"
+
+#include "iopmod/asm/macro.h"
+
+#define MAX_IRQS (IRQ_IOP_SW2 + 1)
+#define MAX_IRQ_ACTIONS 24
+#define MAX_IRQ_THREADS 8
+
+#define IRQ_THREAD_STACKSIZE 1024
+#define IRQ_THREAD_PRIORITY 0x24	/* Above ordinary module threads. */
+#define IRQ_THREAD_POLL_PRIORITY 0x30	/* Below workqueues and RPC threads. */
+
+/**
+ * struct irq_thread - thread of a threaded interrupt handler
+ * @irq: interrupt line masked while the thread function runs
+ * @thread_fn: function called in the thread, %NULL if unused
+ * @arg: argument passed back to the thread function
+ * @masked: %true if woken and the line is masked until @thread_fn completes
+ * @thid: thread id
+ * @sema_id: semaphore id signalled to wake the thread
+ */
+struct irq_thread {
+	unsigned int irq;
+	irq_handler_t thread_fn;
+	void *arg;
+	bool masked;
+	int thid;
+	int sema_id;
+};
+
+/**
+ * struct irq_action - interrupt handler in a chain of a shared line
+ * @cb: function to be called back when the IRQ occurs, %NULL if unused
+ * @arg: argument passed back to the callback function
+ * @thread: thread to wake if @cb returns %IRQ_WAKE_THREAD, or %NULL
+ * @next: next handler for the same line, or %NULL if last
+ */
+struct irq_action {
+	irq_handler_t cb;
+	void *arg;
+	struct irq_thread *thread;
+	struct irq_action *next;
+};
+
+static struct irq_action irq_actions[MAX_IRQ_ACTIONS];
+static struct irq_action *irq_chains[MAX_IRQS];
+static struct irq_thread irq_threads[MAX_IRQ_THREADS];
+static struct irq_stat irq_stats[MAX_IRQS];
+static enum irq_poll irq_polls[MAX_IRQS];
+static bool irq_time_accounting;
 
 struct intc {
 	void (*enable_irq)(unsigned int irq);
@@ -22,6 +89,69 @@ struct intc {
 	int (*release_irq)(unsigned int irq);
 };
 
+static struct irq_action *alloc_action(void)
+{
+	for (int i = 0; i < ARRAY_SIZE(irq_actions); i++)
+		if (!irq_actions[i].cb)
+			return &irq_actions[i];
+
+	return NULL;
+}
+
+/*
+ * The interrupt controllers mask whole lines, so all handlers of a shared
+ * line are masked until the thread function completes, and interrupts for
+ * other handlers are delayed until then.
+ */
+static void wake_irq_thread(struct irq_thread *t)
+{
+	disable_irq(t->irq);
+	t->masked = true;
+
+	thsemap_isignal_sema(t->sema_id);
+}
+
+/*
+ * Handlers are called in chain order until one of them reports that it has
+ * serviced the interrupt. Handlers that see an interrupt not meant for them
+ * must therefore return %IRQ_NONE, to pass it on to the next handler.
+ */
+static enum irq_status handle_irq(void *arg)
+{
+	struct irq_action * const *chain = arg;
+	struct irq_stat *stat = &irq_stats[chain - irq_chains];
+	const bool account = irq_time_accounting;
+	const u32 start = account ? sys_clock_cycles() : 0;
+	enum irq_status status = IRQ_NONE;
+
+	for (const struct irq_action *action = *chain;
+	     action; action = action->next) {
+		status = action->cb(action->arg);
+
+		if (status == IRQ_WAKE_THREAD && action->thread) {
+			wake_irq_thread(action->thread);
+			break;
+		}
+
+		if (status == IRQ_HANDLED)
+			break;
+	}
+
+	stat->count++;
+	if (status == IRQ_NONE)
+		stat->spurious++;
+
+	if (account) {
+		const u32 cycles = sys_clock_cycles() - start;
+
+		stat->max_cycles = max(stat->max_cycles, cycles);
+		stat->cycles += cycles;
+	}
+
+	/* The line remains enabled whether or not it was serviced. */
+	return IRQ_HANDLED;
+}
+
 static const struct intc *intc(unsigned int irq)
 {
 	static const struct intc intrman = {
@@ -72,28 +202,405 @@ void disable_irq(unsigned int irq)
 	intc(irq)->disable_irq(irq);
 }
 
+static int request_action(unsigned int irq, irq_handler_t cb, void *arg,
+	struct irq_thread *thread)
+{
+	struct irq_action *action;
+	unsigned int flags;
+	int err = 0;
+
+	if (irq >= ARRAY_SIZE(irq_chains) || !cb)
+		return -EINVAL;
+
+	irq_save(flags);
+
+	action = alloc_action();
+	if (!action) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	/*
+	 * Claim the action before requesting the line from its controller.
+	 * The SPD controller requests the DEV9 line in turn, which would
+	 * otherwise be given the same unclaimed action.
+	 */
+	*action = (struct irq_action) {
+		.cb = cb,
+		.arg = arg,
+		.thread = thread,
+	};
+
+	if (!irq_chains[irq]) {
+		err = intc(irq)->request_irq(irq, handle_irq, &irq_chains[irq]);
+		if (err < 0) {
+			*action = (struct irq_action) { };
+			goto out;
+		}
+	}
+
+	action->next = irq_chains[irq];
+	irq_chains[irq] = action;
+
+out:
+	irq_restore(flags);
+
+	return err;
+}
+
 /**
  * request_irq - allocate an interrupt line and enable it
  * @irq: interrupt line to allocate
  * @cb: function to be called back when the IRQ occurs
- * @arg: optional argument passed back to the callback function, can be %NULL
+ * @arg: argument passed back to the callback function, can be %NULL unless
+ * 	the line is shared
+ *
+ * The line may already have other handlers, in which case it is shared.
+ * The most recently requested handler is called first, and the remaining
+ * handlers are called only if it returns %IRQ_NONE. A driver servicing some
+ * interrupts on the IOP can thereby take precedence over irqrelay, for
+ * example, that relays the other interrupts to the main processor.
  *
  * Context: thread
  * Return: 0 on success, negative errno on error
  */
 int request_irq(unsigned int irq, irq_handler_t cb, void *arg)
 {
-	return intc(irq)->request_irq(irq, cb, arg);
+	return request_action(irq, cb, arg, NULL);
+}
+
+static enum irq_status default_hard_irq(void *arg)
+{
+	return IRQ_WAKE_THREAD;
+}
+
+/*
+ * Poll with the line masked for as long as there is more work, unless the
+ * line is polled unmasked. A busy device would otherwise starve the
+ * workqueues and RPC threads, so yielding polls run at a lower priority.
+ */
+static enum irq_status poll_irq_thread(struct irq_thread *t)
+{
+	switch (READ_ONCE(irq_polls[t->irq])) {
+	case IRQ_POLL_DRAIN:
+		while (t->thread_fn(t->arg) == IRQ_WAKE_THREAD)
+			;
+		break;
+
+	case IRQ_POLL_UNMASKED:
+		return IRQ_WAKE_THREAD;
+
+	default:
+		thbase_change_priority(t->thid, IRQ_THREAD_POLL_PRIORITY);
+
+		while (t->thread_fn(t->arg) == IRQ_WAKE_THREAD)
+			thbase_rotate_ready_queue(IRQ_THREAD_POLL_PRIORITY);
+
+		thbase_change_priority(t->thid, IRQ_THREAD_PRIORITY);
+	}
+
+	return IRQ_HANDLED;
+}
+
+static void irq_thread(void *arg)
+{
+	struct irq_thread *t = arg;
+	unsigned int flags;
+
+	for (;;) {
+		thsemap_wait_sema(t->sema_id);
+
+		enum irq_status status = t->thread_fn(t->arg);
+		if (status == IRQ_WAKE_THREAD)
+			status = poll_irq_thread(t);
+
+		irq_save(flags);
+
+		t->masked = false;
+		enable_irq(t->irq);
+
+		irq_restore(flags);
+
+		/* Unmasked polls wake the thread again, as an interrupt would. */
+		if (status == IRQ_WAKE_THREAD)
+			thsemap_signal_sema(t->sema_id);
+	}
+}
+
+static struct irq_thread *alloc_thread(void)
+{
+	for (int i = 0; i < ARRAY_SIZE(irq_threads); i++)
+		if (!irq_threads[i].thread_fn)
+			return &irq_threads[i];
+
+	return NULL;
+}
+
+static void free_thread(struct irq_thread *t)
+{
+	unsigned int flags;
+
+	thbase_terminate(t->thid);
+	thbase_delete(t->thid);
+	thsemap_delete_sema(t->sema_id);
+
+	irq_save(flags);
+
+	if (t->masked)
+		enable_irq(t->irq);	/* Shared lines remain in use. */
+	*t = (struct irq_thread) { };
+
+	irq_restore(flags);
+}
+
+/**
+ * request_threaded_irq - allocate an interrupt line with a threaded handler
+ * @irq: interrupt line to allocate
+ * @handler: function to be called back in the interrupt context when the
+ * 	IRQ occurs, or %NULL to always wake the thread
+ * @thread_fn: function to be called back in a thread context when @handler
+ * 	returns %IRQ_WAKE_THREAD
+ * @arg: argument passed back to both callback functions, can be %NULL unless
+ * 	the line is shared
+ *
+ * @handler is expected to do the minimum, typically to acknowledge the
+ * device interrupt, and then return %IRQ_WAKE_THREAD. The line is masked
+ * until @thread_fn has completed, so the device cannot interrupt again in
+ * between. Note that the whole line is masked, so interrupts for other
+ * handlers of a shared line are delayed as well. @handler must therefore
+ * return %IRQ_NONE for interrupts that are not for its device, to pass them
+ * on without waking the thread.
+ *
+ * @thread_fn can return %IRQ_WAKE_THREAD to be called again with the line
+ * still masked, for example when it has exhausted a budget of work but more
+ * remains. Such polls run below the workqueues and RPC threads, so that a
+ * busy device does not starve them, until the thread is done. The line
+ * is unmasked when @thread_fn returns anything else. A busy device is then
+ * polled rather than interrupting for every event. set_irq_poll() selects
+ * other ways to poll.
+ *
+ * Context: thread
+ * Return: 0 on success, negative errno on error
+ */
+int request_threaded_irq(unsigned int irq, irq_handler_t handler,
+	irq_handler_t thread_fn, void *arg)
+{
+	struct irq_thread *t;
+	unsigned int flags;
+	int err;
+
+	if (!thread_fn)
+		return -EINVAL;
+
+	irq_save(flags);
+
+	t = alloc_thread();
+	if (t)
+		*t = (struct irq_thread) {
+			.irq = irq,
+			.thread_fn = thread_fn,
+			.arg = arg,
+		};
+
+	irq_restore(flags);
+
+	if (!t)
+		return -ENOMEM;
+
+	const struct iop_thread th = {
+		.attr = THREAD_ATTR_C,
+		.thread = irq_thread,
+		.stacksize = IRQ_THREAD_STACKSIZE,
+		.priority = IRQ_THREAD_PRIORITY,
+	};
+
+	t->thid = thbase_create(&th);
+	if (t->thid < 0) {
+		pr_err("%s: thbase_create failed with %d: %s\n",
+			__func__, t->thid, iop_error_message(t->thid));
+		err = errno_for_iop_error(t->thid);
+		goto err_create;
+	}
+
+	const struct iop_sema sema = { .initial = 0, .max = 1 };
+	t->sema_id = thsemap_create_sema(&sema);
+	if (t->sema_id < 0) {
+		pr_err("%s: thsemap_create_sema failed with %d: %s\n",
+			__func__, t->sema_id, iop_error_message(t->sema_id));
+		err = errno_for_iop_error(t->sema_id);
+		goto err_sema_create;
+	}
+
+	const int ioperr = thbase_start(t->thid, t);
+	if (ioperr < 0) {
+		pr_err("%s: thbase_start failed with %d: %s\n",
+			__func__, ioperr, iop_error_message(ioperr));
+		err = errno_for_iop_error(ioperr);
+		goto err_start;
+	}
+
+	err = request_action(irq, handler ? handler : default_hard_irq, arg, t);
+	if (err < 0)
+		goto err_request;
+
+	return 0;
+
+err_request:
+	thbase_terminate(t->thid);
+err_start:
+	thsemap_delete_sema(t->sema_id);
+err_sema_create:
+	thbase_delete(t->thid);
+err_create:
+	*t = (struct irq_thread) { };
+
+	return err;
+}
+
+static bool match_action(const struct irq_action *action,
+	irq_handler_t handler, void *arg)
+{
+	return action->arg == arg && (action->thread ?
+		action->thread->thread_fn == handler : action->cb == handler);
 }
 
 /**
- * release_irq - disable and free an allocated interrupt
+ * release_irq - free an allocated interrupt, and disable it if unshared
  * @irq: interrupt line to release
+ * @handler: handler given to request_irq(), or thread function given to
+ * 	request_threaded_irq()
+ * @arg: argument given to request_irq() or request_threaded_irq()
+ *
+ * The handler is identified by both @handler and @arg, since neither alone
+ * need be unique for a shared line. The thread of a threaded handler is
+ * terminated and deleted.
  *
  * Context: thread
  * Return: 0 on success, negative errno on error
  */
-int release_irq(unsigned int irq)
+int release_irq(unsigned int irq, irq_handler_t handler, void *arg)
+{
+	struct irq_thread *thread = NULL;
+	struct irq_action *action;
+	struct irq_action **link;
+	unsigned int flags;
+	int err = 0;
+
+	if (irq >= ARRAY_SIZE(irq_chains))
+		return -EINVAL;
+
+	irq_save(flags);
+
+	for (link = &irq_chains[irq]; *link; link = &(*link)->next)
+		if (match_action(*link, handler, arg))
+			break;
+
+	action = *link;
+	if (!action) {
+		err = -ENOENT;
+		goto out;
+	}
+
+	if (!action->next && link == &irq_chains[irq]) {
+		err = intc(irq)->release_irq(irq);
+		if (err < 0)
+			goto out;
+	}
+
+	thread = action->thread;
+
+	*link = action->next;
+	*action = (struct irq_action) { };
+
+out:
+	irq_restore(flags);
+
+	if (thread)
+		free_thread(thread);
+
+	return err;
+}
+
+/**
+ * irq_stat - interrupt line statistics
+ * @irq: interrupt line to obtain statistics for
+ * @stat: statistics since the module was loaded
+ *
+ * Spurious DEV9 SPD interrupts without any handler are counted by the SPD
+ * controller and included here as well.
+ *
+ * Context: any
+ * Return: 0 on success, negative errno on error
+ */
+int irq_stat(unsigned int irq, struct irq_stat *stat)
 {
-	return intc(irq)->release_irq(irq);
+	unsigned int flags;
+
+	if (irq >= ARRAY_SIZE(irq_stats))
+		return -EINVAL;
+
+	irq_save(flags);
+
+	*stat = irq_stats[irq];
+
+	irq_restore(flags);
+
+	stat->spurious += spd_spurious_irq__(irq);
+
+	return 0;
+}
+
+/**
+ * set_irq_priority - set the dispatch order of interrupts pending together
+ * @irqs: interrupt lines to dispatch first, in order of priority
+ * @count: number of interrupt lines in @irqs
+ *
+ * Only the virtual DEV9 SPD interrupts currently have a configurable order,
+ * which by default is ATA first, then network and the others last. Lines
+ * not given keep their relative order after the given ones.
+ *
+ * Context: any
+ * Return: 0 on success, negative errno on error
+ */
+int set_irq_priority(const unsigned int *irqs, size_t count)
+{
+	return spd_set_irq_priority__(irqs, count);
+}
+
+/**
+ * set_irq_time_accounting - enable or disable handler time accounting
+ * @enable: %true to account time spent in handlers, %false to not
+ *
+ * Accounting reads the system clock twice per interrupt, so it is disabled
+ * by default. Dispatches and spurious interrupts are counted regardless.
+ * The accounted time is kept when accounting is disabled, and accumulates
+ * further when it is enabled again.
+ *
+ * Context: any
+ */
+void set_irq_time_accounting(bool enable)
+{
+	irq_time_accounting = enable;
+}
+
+/**
+ * set_irq_poll - select how threaded handlers of a line are polled
+ * @irq: interrupt line to select polling for
+ * @poll: %IRQ_POLL_YIELD, %IRQ_POLL_DRAIN or %IRQ_POLL_UNMASKED
+ *
+ * Thread functions returning %IRQ_WAKE_THREAD are polled as selected, see
+ * &enum irq_poll. The selection is kept when handlers are released, and
+ * takes effect with the next interrupt.
+ *
+ * Context: any
+ * Return: 0 on success, negative errno on error
+ */
+int set_irq_poll(unsigned int irq, enum irq_poll poll)
+{
+	if (irq >= ARRAY_SIZE(irq_polls) || poll > IRQ_POLL_UNMASKED)
+		return -EINVAL;
+
+	WRITE_ONCE(irq_polls[irq], poll);
+
+	return 0;
 }
@@ -5,6 +5,9 @@
  * Copyright (C) 2019 Fredrik Noring
  */
 
+#include "iopmod/bits.h"
+#include "iopmod/build-bug.h"
+#include "iopmod/compare.h"
 #include "iopmod/errno.h"
 #include "iopmod/interrupt.h"
 #include "iopmod/iop-error.h"
@@ -14,22 +17,32 @@
 #include "iopmod/sif.h"
 #include "iopmod/sifcmd.h"
 #include "iopmod/sifman.h"
+#include "iopmod/string.h"
 #include "iopmod/thread.h"
 
 #include "iopmod/asm/macro.h"
 
 #define MAX_IRQ_RELAYS 16
 
+#define LATENCY_BUCKETS 16
+#define LATENCY_BUCKET_SHIFT 4
+
 /**
  * enum iop_irq_relay_rpc_ops - IOP IRQ relay RPC operations
  * @rpo_request_irq: request IRQ mapping
  * @rpo_release_irq: release IRQ mapping
  * @rpo_remap_irq: remap existing IRQ mapping
+ * @rpo_latency_mode: enable or disable latency measurements
+ * @rpo_latency_stat: latency statistics for IRQ mapping
+ * @rpo_irq_stat: interrupt line and handler time statistics
  */
 enum iop_irq_relay_rpc_ops {
-	rpo_request_irq = 1,
-	rpo_release_irq = 2,
-	rpo_remap_irq   = 3,
+	rpo_request_irq  = 1,
+	rpo_release_irq  = 2,
+	rpo_remap_irq    = 3,
+	rpo_latency_mode = 4,
+	rpo_latency_stat = 5,
+	rpo_irq_stat     = 6,
 };
 
 /**
@@ -52,6 +65,104 @@ struct iop_rpc_relay_release {
 	u8 iop;
 };
 
+/**
+ * struct iop_rpc_relay_latency_mode - IOP IRQ relay latency measurements
+ * @enable: %true to enable and reset measurements, %false to disable
+ *
+ * Handler time accounting of the interrupt line statistics is enabled and
+ * disabled with the latency measurements.
+ */
+struct iop_rpc_relay_latency_mode {
+	u8 enable;
+};
+
+/**
+ * struct iop_rpc_relay_latency_query - IOP IRQ relay latency to query
+ * @iop: IOP IRQ to query latency statistics for
+ */
+struct iop_rpc_relay_latency_query {
+	u8 iop;
+};
+
+/**
+ * struct iop_rpc_relay_latency_stat - IOP IRQ relay latency statistics
+ * @status: 0 on success, otherwise a negative error number
+ * @count: number of measured relays
+ * @min: minimum latency in system clock cycles
+ * @avg: average latency in system clock cycles
+ * @max: maximum latency in system clock cycles
+ * @histogram: number of relays per latency bucket, where bucket 0 counts
+ * 	latencies below 1 << %LATENCY_BUCKET_SHIFT cycles, bucket @n counts
+ * 	latencies from 1 << (@n + %LATENCY_BUCKET_SHIFT - 1) cycles and the
+ * 	last bucket additionally counts all longer latencies
+ *
+ * Latency is measured from the entry of the IOP interrupt handler until the
+ * main processor has been notified, either by a completed SIF command DMA
+ * transfer for RPC relays, or by an asserted SMFLAG interrupt.
+ */
+struct iop_rpc_relay_latency_stat {
+	s32 status;
+	u32 count;
+	u32 min;
+	u32 avg;
+	u32 max;
+	u32 histogram[LATENCY_BUCKETS];
+};
+
+/**
+ * struct iop_rpc_relay_irq_query - IOP IRQ to query line statistics for
+ * @iop: any IOP IRQ, including IRQs that are not relayed
+ */
+struct iop_rpc_relay_irq_query {
+	u8 iop;
+};
+
+/**
+ * struct iop_rpc_relay_irq_stat - IOP IRQ line statistics
+ * @status: 0 on success, otherwise a negative error number
+ * @count: number of times the line has been dispatched
+ * @spurious: number of dispatches not serviced by any handler
+ * @max_cycles: longest time in system clock cycles spent in handlers
+ * @cycles: total time in system clock cycles spent in handlers
+ *
+ * Handler time is only accounted in latency measurement mode. See struct
+ * irq_stat.
+ */
+struct iop_rpc_relay_irq_stat {
+	s32 status;
+	u32 count;
+	u32 spurious;
+	u32 max_cycles;
+	u64 cycles;
+};
+
+/**
+ * struct iop_irq_relay - IOP IRQ relay RPC payload
+ * @irq: main IRQ
+ * @timestamp: system clock cycles at IOP interrupt handler entry, only
+ * 	included in latency measurement mode
+ */
+struct iop_irq_relay {
+	u32 irq;
+	u32 timestamp;
+};
+
+/**
+ * struct iop_irq_latency - IRQ relay latency measurements
+ * @count: number of measured relays
+ * @min: minimum latency in system clock cycles
+ * @max: maximum latency in system clock cycles
+ * @sum: sum of all latencies in system clock cycles
+ * @histogram: number of relays per latency bucket
+ */
+struct iop_irq_latency {
+	u32 count;
+	u32 min;
+	u32 max;
+	u64 sum;
+	u32 histogram[LATENCY_BUCKETS];
+};
+
 /**
  * struct iop_irq_map - IRQ relay map
  * @set: IRQ is active if %true, otherwise unused
@@ -68,20 +179,47 @@ struct iop_irq_map {
 
 static struct iop_irq_map irqs[MAX_IRQ_RELAYS];
 
+static bool latency_mode;
+static struct iop_irq_latency latencies[MAX_IRQ_RELAYS];
+
 static int rpc_stid;
 static struct sifcmd_rpc_data_queue rpc_qdata;
 static struct sifcmd_rpc_server_data rpc_sdata;
 static u8 rpc_buffer[16] __attribute__((aligned(4)));
 
+static unsigned int latency_bucket(u32 cycles)
+{
+	return min_t(unsigned int,
+		fls(cycles >> LATENCY_BUCKET_SHIFT), LATENCY_BUCKETS - 1);
+}
+
+static void latency_sample(struct iop_irq_latency *latency, u32 cycles)
+{
+	if (!latency->count || cycles < latency->min)
+		latency->min = cycles;
+	if (!latency->count || cycles > latency->max)
+		latency->max = cycles;
+
+	latency->count++;
+	latency->sum += cycles;
+	latency->histogram[latency_bucket(cycles)]++;
+}
+
 static enum irq_status service_irq(void *arg)
 {
+	const bool measure = latency_mode;
+	const u32 timestamp = measure ? sys_clock_cycles() : 0;
 	struct iop_irq_map *m = arg;
 
 	if (m->rpc) {
-		const u32 irq = m->map;
+		const struct iop_irq_relay relay = {
+			.irq = m->map,
+			.timestamp = timestamp,
+		};
 		int err;
 
-		err = sif_cmd(SIF_CMD_IRQ_RELAY, &irq, sizeof(irq));
+		err = sif_cmd(SIF_CMD_IRQ_RELAY, &relay,
+			measure ? sizeof(relay) : sizeof(relay.irq));
 		if (err < 0)
 			pr_err("%s: sif_cmd failed with %d\n", __func__, err);
 	} else {
@@ -89,6 +227,10 @@ static enum irq_status service_irq(void *arg)
 		sifman_intr_main();
 	}
 
+	if (measure)
+		latency_sample(&latencies[m - irqs],
+			sys_clock_cycles() - timestamp);
+
 	return IRQ_HANDLED;
 }
 
@@ -141,6 +283,7 @@ static int request_map(unsigned int iop_irq, unsigned map_irq, bool rpc)
 	}
 
 	*m = w;
+	latencies[m - irqs] = (struct iop_irq_latency) { };
 
 	err = request_irq(m->iop, service_irq, m);
 	if (err < 0)
@@ -199,7 +342,7 @@ static int release_map(unsigned int iop_irq)
 		goto out;
 	}
 
-	err = release_irq(iop_irq);
+	err = release_irq(iop_irq, service_irq, m);
 	if (!err)
 		*m = (struct iop_irq_map) { };
 
@@ -209,8 +352,74 @@ out:
 	return err;
 }
 
+static int set_latency_mode(bool enable)
+{
+	unsigned int flags;
+
+	pr_debug("%s: %s\n", __func__, enable ? "enable" : "disable");
+
+	irq_save(flags);
+
+	if (enable)
+		memset(latencies, 0, sizeof(latencies));
+	latency_mode = enable;
+	set_irq_time_accounting(enable);
+
+	irq_restore(flags);
+
+	return 0;
+}
+
+static void latency_stat(struct iop_rpc_relay_latency_stat *stat,
+	unsigned int iop_irq)
+{
+	struct iop_irq_latency latency;
+	struct iop_irq_map *m;
+	unsigned int flags;
+
+	irq_save(flags);
+
+	m = find_map(iop_irq);
+	if (m)
+		latency = latencies[m - irqs];
+
+	irq_restore(flags);
+
+	if (!m) {
+		*stat = (struct iop_rpc_relay_latency_stat) { .status = -ENXIO };
+		return;
+	}
+
+	*stat = (struct iop_rpc_relay_latency_stat) {
+		.count = latency.count,
+		.min = latency.min,
+		.avg = latency.count ? latency.sum / latency.count : 0,
+		.max = latency.max,
+	};
+
+	BUILD_BUG_ON(sizeof(stat->histogram) != sizeof(latency.histogram));
+	memcpy(stat->histogram, latency.histogram, sizeof(stat->histogram));
+}
+
+static void line_stat(struct iop_rpc_relay_irq_stat *stat,
+	unsigned int iop_irq)
+{
+	struct irq_stat line;
+	const int err = irq_stat(iop_irq, &line);
+
+	*stat = err ? (struct iop_rpc_relay_irq_stat) { .status = err } :
+		(struct iop_rpc_relay_irq_stat) {
+			.count = line.count,
+			.spurious = line.spurious,
+			.max_cycles = line.max_cycles,
+			.cycles = line.cycles,
+		};
+}
+
 static void *irqrelay_service_rpc(int rpo, void *buffer, size_t size)
 {
+	static struct iop_rpc_relay_latency_stat stat;
+	static struct iop_rpc_relay_irq_stat line;
 	static int status;
 
 	switch (rpo) {
@@ -250,6 +459,46 @@ static void *irqrelay_service_rpc(int rpo, void *buffer, size_t size)
 		break;
 	}
 
+	case rpo_latency_mode: {
+		const struct iop_rpc_relay_latency_mode *request = buffer;
+
+		if (size != sizeof(*request)) {
+			status = -EINVAL;
+			break;
+		}
+
+		status = set_latency_mode(request->enable);
+		break;
+	}
+
+	case rpo_latency_stat: {
+		const struct iop_rpc_relay_latency_query *request = buffer;
+
+		if (size != sizeof(*request)) {
+			stat = (struct iop_rpc_relay_latency_stat) {
+				.status = -EINVAL
+			};
+			return &stat;
+		}
+
+		latency_stat(&stat, request->iop);
+		return &stat;
+	}
+
+	case rpo_irq_stat: {
+		const struct iop_rpc_relay_irq_query *request = buffer;
+
+		if (size != sizeof(*request)) {
+			line = (struct iop_rpc_relay_irq_stat) {
+				.status = -EINVAL
+			};
+			return &line;
+		}
+
+		line_stat(&line, request->iop);
+		return &line;
+	}
+
 	default:
 		pr_err("%s: Invalid RPC %d size %zu\n", __func__, rpo, size);
 		status = -EINVAL;
@@ -0,0 +1,946 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Memory card block I/O on SIO2 ports 2 and 3
+ *
+ * Pages are read and written, and blocks erased, with several pages batched
+ * into a single SIO2 command queue. The transmit and receive streams of the
+ * queue are transferred with SIO2 DMA. The SIO2 is requested for each queue,
+ * so that gamepad polls continue in between, and a queue that does not
+ * complete in time fails with -EIO.
+ *
+ * Each 128 byte chunk of a page has a 3 byte Hamming code in the spare area
+ * of the page, which corrects single bit errors when pages are read.
+ *
+ * Cards fail all other commands until they are authenticated, which needs
+ * the MagicGate keys of the secrman ROM module. A card is authenticated by
+ * secrman before its first transfer, and again after a failed transfer,
+ * for example because the card has been replaced. secrman does the SIO2
+ * transfers of the authentication through this module.
+ *
+ * Copyright (C) 2021 Fredrik Noring
+ */
+
+#include <string.h>
+
+#include "iopmod/bits.h"
+#include "iopmod/build-bug.h"
+#include "iopmod/compare.h"
+#include "iopmod/errno.h"
+#include "iopmod/interrupt.h"
+#include "iopmod/iop-error.h"
+#include "iopmod/irq.h"
+#include "iopmod/module.h"
+#include "iopmod/printk.h"
+#include "iopmod/secrman.h"
+#include "iopmod/sif.h"
+#include "iopmod/sifcmd.h"
+#include "iopmod/sio2.h"
+#include "iopmod/thread.h"
+#include "iopmod/timer.h"
+#include "iopmod/workqueue.h"
+
+#include "iopmod/asm/macro.h"
+
+#define SIO2_CTRL_SETTINGS						\
+	.timeout_enable = true,						\
+	.error_proceed = true,						\
+	.unknown = true,						\
+	.error_irq_enable = true,					\
+	.tx_irq_enable = true
+
+#define MEMCARD_PAGE_SIZE	512
+#define MEMCARD_SPARE_SIZE	16
+#define MEMCARD_CHUNK_SIZE	128
+#define MEMCARD_PAGE_CHUNKS	(MEMCARD_PAGE_SIZE / MEMCARD_CHUNK_SIZE)
+#define MEMCARD_ECC_SIZE	3	/* Per chunk, in the spare area. */
+#define MEMCARD_BLOCK_PAGES	16
+
+#define MEMCARD_TIMEOUT_US	1000000
+
+#define MEMCARD_PREFIX		0x81
+#define MEMCARD_ACK		0x2b
+#define MEMCARD_TERMINATOR	0x55
+
+#define MEMCARD_CMD_ERASE_ADDR	0x21
+#define MEMCARD_CMD_WRITE_ADDR	0x22
+#define MEMCARD_CMD_READ_ADDR	0x23
+#define MEMCARD_CMD_WRITE	0x42
+#define MEMCARD_CMD_READ	0x43
+#define MEMCARD_CMD_END		0x81
+#define MEMCARD_CMD_ERASE	0x82
+
+/* Prefix, command, zero, address, checksum and terminator. */
+#define MEMCARD_ADDR_CMD_SIZE	9
+/* Prefix, command, size, acknowledge, data, checksum and terminator. */
+#define MEMCARD_DATA_CMD_SIZE(size) ((size) + 6)
+/* Prefix, command, acknowledge and terminator. */
+#define MEMCARD_SHORT_CMD_SIZE	4
+
+#define SIO2_CMD_QUEUE_SIZE	16
+
+/*
+ * Pages per SIO2 command queue. Reads take an address command, four data
+ * commands and a spare area command per page, and writes additionally an
+ * end command. Erases take an address, an erase and an end command per
+ * block.
+ */
+#define MEMCARD_READ_PAGE_CMDS		(2 + MEMCARD_PAGE_CHUNKS)
+#define MEMCARD_WRITE_PAGE_CMDS		(3 + MEMCARD_PAGE_CHUNKS)
+#define MEMCARD_QUEUE_READ_PAGES	2
+#define MEMCARD_QUEUE_WRITE_PAGES	2
+#define MEMCARD_QUEUE_ERASE_BLOCKS	5
+
+#define MEMCARD_QUEUE_BYTES	1792
+
+#define MEMCARD_WB_PAGES	8
+
+#define MAX_MEMCARD_SIF_SG \
+	(CMD_PACKET_PAYLOAD_MAX / sizeof(struct memcard_sif_sg_entry))
+
+/**
+ * enum iop_memcard_rops - IOP memory card remote operations
+ * @rop_wb: Request and announce the write buffer of the IOP
+ * @rop_sg: Request scatter-gather transfers, acknowledged with a status
+ * @rop_rd: Read pages to the main processor
+ */
+enum iop_memcard_rops {
+	rop_wb  = 0,
+	rop_sg  = 1,
+	rop_rd  = 2,
+};
+
+union memcard_sif_opt {
+	u32 raw;
+	struct {
+		u32 op : 3;
+		u32 count : 8;
+		u32 write : 1;
+		u32 erase : 1;
+		u32 port : 1;
+		u32 : 18;
+	};
+};
+
+/**
+ * struct memcard_sif_wb - write buffer of the IOP
+ * @addr: IOP address for the main processor to write pages to
+ * @size: size in bytes
+ */
+struct memcard_sif_wb {
+	u32 addr;
+	u32 size;
+};
+
+/**
+ * struct memcard_sif_sg - scatter-gather list of page transfers
+ * @entry: list of transfers
+ * @entry.page: first page
+ * @entry.count: number of pages, a multiple of 16 when erasing blocks
+ * @entry.addr: 16-byte aligned main address to read to, or offset into the
+ * 	write buffer to write from, or unused when erasing blocks
+ */
+struct memcard_sif_sg {
+	struct memcard_sif_sg_entry {
+		u32 page;
+		u32 count;
+		u32 addr;
+	} entry[MAX_MEMCARD_SIF_SG];
+};
+
+/**
+ * struct memcard_sif_rd - pages read to the main processor
+ * @page: first page
+ * @count: number of pages
+ * @addr: main address the pages were copied to
+ */
+struct memcard_sif_rd {
+	u32 page;
+	u32 count;
+	u32 addr;
+};
+
+/**
+ * struct memcard_sif_ack - scatter-gather completion
+ * @status: 0 on success, otherwise a negative error number
+ */
+struct memcard_sif_ack {
+	s32 status;
+};
+
+/**
+ * struct memcard_queue - SIO2 command queue with transmit and receive data
+ * @count: number of commands
+ * @size: number of bytes in @tx and @rx
+ * @cmd: commands
+ * @cmd.offset: offset of command in @tx and @rx
+ * @cmd.length: length of command
+ * @tx: transmit stream of all commands
+ * @rx: receive stream of all commands
+ *
+ * Commands follow each other without padding, so the card is sent exactly
+ * the bytes of its protocol. SIO2 DMA transfers whole words, so the
+ * transmit stream is rounded up to a multiple of 4 bytes, and the excess
+ * bytes are left unsent in the FIFO. The last bytes of the receive stream
+ * that do not fill a word are read from the FIFO once the queue completes.
+ */
+struct memcard_queue {
+	int count;
+	size_t size;
+	struct {
+		u16 offset;
+		u16 length;
+	} cmd[SIO2_CMD_QUEUE_SIZE];
+	u8 tx[MEMCARD_QUEUE_BYTES] __attribute__((aligned(4)));
+	u8 rx[MEMCARD_QUEUE_BYTES] __attribute__((aligned(4)));
+};
+
+struct memcard_dev {
+	u8 wb[MEMCARD_WB_PAGES * MEMCARD_PAGE_SIZE] __attribute((aligned(16)));
+	u8 rd[MEMCARD_QUEUE_READ_PAGES * MEMCARD_PAGE_SIZE]
+		__attribute((aligned(16)));
+
+	struct memcard_queue queue;
+	struct timer_list timeout;
+	bool busy;
+	bool timed_out;
+
+	union memcard_sif_opt opt;
+	struct memcard_sif_sg sg;
+	bool pending;
+
+	struct work_struct sg_work;
+	int done_sema_id;
+
+	u8 authenticated;
+};
+
+/* secrman handlers have no argument, so the device is found here. */
+static struct memcard_dev *memcard_secrman_dev;
+
+/*
+ * Column parity masks of bytes in bits 0-6, and byte parities in bit 7, for
+ * the Hamming codes of page chunks.
+ */
+static u8 memcard_ecc_table[256];
+
+static u8 memcard_checksum(const u8 *data, size_t size)
+{
+	u8 checksum = 0;
+
+	for (size_t i = 0; i < size; i++)
+		checksum ^= data[i];
+
+	return checksum;
+}
+
+static u8 parity8(u8 b)
+{
+	b ^= b >> 4;
+	b ^= b >> 2;
+	b ^= b >> 1;
+
+	return b & 1;
+}
+
+static u8 weight8(u8 b)
+{
+	u8 n = 0;
+
+	for (; b; b &= b - 1)
+		n++;
+
+	return n;
+}
+
+static void memcard_ecc_init(void)
+{
+	static const u8 masks[] = { 0x55, 0x33, 0x0f, 0x00, 0xaa, 0xcc, 0xf0 };
+
+	for (int b = 0; b < ARRAY_SIZE(memcard_ecc_table); b++) {
+		u8 t = parity8(b) << 7;
+
+		for (int i = 0; i < ARRAY_SIZE(masks); i++)
+			t |= parity8(b & masks[i]) << i;
+
+		memcard_ecc_table[b] = t;
+	}
+}
+
+/**
+ * memcard_ecc - calculate the Hamming code of a chunk
+ * @chunk: chunk of %MEMCARD_CHUNK_SIZE bytes
+ * @ecc: column parity and two line parities of @chunk
+ */
+static void memcard_ecc(const u8 *chunk, u8 ecc[MEMCARD_ECC_SIZE])
+{
+	u8 cp = 0x77, lp0 = 0x7f, lp1 = 0x7f;
+
+	for (int i = 0; i < MEMCARD_CHUNK_SIZE; i++) {
+		const u8 t = memcard_ecc_table[chunk[i]];
+
+		cp ^= t & 0x7f;
+		if (t & 0x80) {
+			lp0 ^= ~i;
+			lp1 ^= i;
+		}
+	}
+
+	ecc[0] = cp;
+	ecc[1] = lp0 & 0x7f;
+	ecc[2] = lp1;
+}
+
+/**
+ * memcard_ecc_correct - check and correct a chunk with its Hamming code
+ * @chunk: chunk of %MEMCARD_CHUNK_SIZE bytes
+ * @ecc: Hamming code read with @chunk
+ *
+ * A single bit error in the data of @chunk is corrected. A single bit error
+ * in @ecc leaves the data as it is.
+ *
+ * Return: number of corrected bits in @chunk, or -EIO if uncorrectable
+ */
+static int memcard_ecc_correct(u8 *chunk, const u8 ecc[MEMCARD_ECC_SIZE])
+{
+	u8 computed[MEMCARD_ECC_SIZE];
+
+	memcard_ecc(chunk, computed);
+
+	const u8 cp_diff = (computed[0] ^ ecc[0]) & 0x77;
+	const u8 lp0_diff = (computed[1] ^ ecc[1]) & 0x7f;
+	const u8 lp1_diff = (computed[2] ^ ecc[2]) & 0x7f;
+	const u8 lp_comp = lp0_diff ^ lp1_diff;
+	const u8 cp_comp = (cp_diff >> 4) ^ (cp_diff & 0x07);
+
+	if (lp_comp == 0x7f && cp_comp == 0x07) {
+		chunk[lp1_diff] ^= 1 << (cp_diff >> 4);
+		return 1;
+	}
+
+	if ((!cp_diff && !lp0_diff && !lp1_diff) ||
+	    weight8(lp_comp) + weight8(cp_comp) == 1)
+		return 0;
+
+	return -EIO;
+}
+
+static u8 *queue_cmd(struct memcard_queue *q, u8 cmd, size_t length)
+{
+	u8 *tx = &q->tx[q->size];
+
+	memset(tx, 0, length);
+	tx[0] = MEMCARD_PREFIX;
+	tx[1] = cmd;
+
+	q->cmd[q->count].offset = q->size;
+	q->cmd[q->count].length = length;
+	q->count++;
+	q->size += length;
+
+	return tx;
+}
+
+static void queue_addr(struct memcard_queue *q, u8 cmd, u32 page)
+{
+	u8 *tx = queue_cmd(q, cmd, MEMCARD_ADDR_CMD_SIZE);
+
+	tx[3] = page & 0xff;
+	tx[4] = (page >> 8) & 0xff;
+	tx[5] = (page >> 16) & 0xff;
+	tx[6] = (page >> 24) & 0xff;
+	tx[7] = memcard_checksum(&tx[3], 4);
+}
+
+static void queue_read_data(struct memcard_queue *q, size_t size)
+{
+	u8 *tx = queue_cmd(q, MEMCARD_CMD_READ, MEMCARD_DATA_CMD_SIZE(size));
+
+	tx[2] = size;
+}
+
+/* The page is followed by its spare area, with the Hamming codes. */
+static void queue_read(struct memcard_queue *q, u32 page)
+{
+	queue_addr(q, MEMCARD_CMD_READ_ADDR, page);
+
+	for (int i = 0; i < MEMCARD_PAGE_CHUNKS; i++)
+		queue_read_data(q, MEMCARD_CHUNK_SIZE);
+
+	queue_read_data(q, MEMCARD_SPARE_SIZE);
+}
+
+static void queue_write_data(struct memcard_queue *q,
+	const u8 *data, size_t size)
+{
+	u8 *tx = queue_cmd(q, MEMCARD_CMD_WRITE, MEMCARD_DATA_CMD_SIZE(size));
+
+	tx[2] = size;
+	memcpy(&tx[3], data, size);
+	tx[3 + size] = memcard_checksum(data, size);
+}
+
+static void queue_write(struct memcard_queue *q, u32 page, const u8 *data)
+{
+	u8 spare[MEMCARD_SPARE_SIZE] = { };
+
+	queue_addr(q, MEMCARD_CMD_WRITE_ADDR, page);
+
+	for (int i = 0; i < MEMCARD_PAGE_CHUNKS; i++) {
+		const u8 *chunk = &data[i * MEMCARD_CHUNK_SIZE];
+
+		queue_write_data(q, chunk, MEMCARD_CHUNK_SIZE);
+		memcard_ecc(chunk, &spare[i * MEMCARD_ECC_SIZE]);
+	}
+
+	queue_write_data(q, spare, sizeof(spare));
+	queue_cmd(q, MEMCARD_CMD_END, MEMCARD_SHORT_CMD_SIZE);
+}
+
+static void queue_erase(struct memcard_queue *q, u32 page)
+{
+	queue_addr(q, MEMCARD_CMD_ERASE_ADDR, page);
+	queue_cmd(q, MEMCARD_CMD_ERASE, MEMCARD_SHORT_CMD_SIZE);
+	queue_cmd(q, MEMCARD_CMD_END, MEMCARD_SHORT_CMD_SIZE);
+}
+
+static enum irq_status memcard_irq(void *arg)
+{
+	struct memcard_dev *dev = arg;
+
+	if (!dev->busy)
+		return IRQ_NONE;	/* Gamepad transfer */
+
+	sio2_cl_irq_stat();
+	dev->busy = false;
+
+	thsemap_isignal_sema(dev->done_sema_id);
+
+	return IRQ_HANDLED;
+}
+
+/*
+ * The timer and the interrupt handler both run in the interrupt context,
+ * so whichever comes first clears @busy and signals completion.
+ */
+static void memcard_timeout(struct timer_list *timer)
+{
+	struct memcard_dev *dev = container_of(timer, struct memcard_dev, timeout);
+
+	if (!dev->busy)
+		return;
+
+	dev->busy = false;
+	dev->timed_out = true;
+
+	thsemap_isignal_sema(dev->done_sema_id);
+}
+
+static int memcard_wait(struct memcard_dev *dev)
+{
+	dev->timed_out = false;
+
+	int err = mod_timer(&dev->timeout,
+		timer_jiffies() + us_to_jiffies(MEMCARD_TIMEOUT_US));
+	if (err < 0) {
+		pr_err("%s: mod_timer failed with %d\n", __func__, err);
+		return err;
+	}
+
+	SIO2_WS_CTRL(.start = true, SIO2_CTRL_SETTINGS);
+
+	const int ioperr = thsemap_wait_sema(dev->done_sema_id);
+
+	del_timer(&dev->timeout);
+
+	if (ioperr < 0)
+		return errno_for_iop_error(ioperr);
+
+	if (dev->timed_out) {
+		pr_err("%s: SIO2 timed out\n", __func__);
+
+		SIO2_WS_CTRL(.reset = true, .reset_fifo = true,
+			SIO2_CTRL_SETTINGS);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static void memcard_port_ctrl(void)
+{
+	/* Typical memory card port settings, see struct sio2_ctrl0. */
+	sio2_wr_port2_ctrl0(0xff020405);
+	sio2_wr_port2_ctrl1(0x0005ffff);
+	sio2_wr_port3_ctrl0(0xff020405);
+	sio2_wr_port3_ctrl1(0x0005ffff);
+}
+
+static int memcard_transfer_sio2(struct memcard_dev *dev, int port)
+{
+	struct memcard_queue *q = &dev->queue;
+	const size_t rx_dma_size = q->size & ~3;
+
+	for (int i = 0; i < q->count; i++)
+		SIO2_WS_CMD(i, .port = port, .cfg = 4,
+			.tx_size = q->cmd[i].length,
+			.rx_size = q->cmd[i].length);
+	if (q->count < SIO2_CMD_QUEUE_SIZE)
+		SIO2_WS_CMD(q->count,);
+
+	dev->busy = true;
+
+	int err = sio2_dma_tx(q->tx, ALIGN(q->size, 4));
+	if (!err && rx_dma_size)
+		err = sio2_dma_rx(q->rx, rx_dma_size);
+	if (err < 0) {
+		pr_err("%s: SIO2 DMA failed with %d\n", __func__, err);
+		dev->busy = false;
+		return err;
+	}
+
+	err = memcard_wait(dev);
+	if (err < 0) {
+		dev->busy = false;
+		return err;
+	}
+
+	sio2_rd_rx(&q->rx[rx_dma_size], q->size - rx_dma_size);
+
+	/* Discard the unsent bytes of the last transmitted word. */
+	SIO2_WS_CTRL(.reset_fifo = true, SIO2_CTRL_SETTINGS);
+
+	const struct sio2_cmd_stat stat = sio2_rs_cmd_stat();
+	if (stat.error || stat.missing_ack) {
+		pr_err("%s: SIO2 error with command status 0x%x\n",
+			__func__, sio2_rd_cmd_stat());
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static int memcard_auth(struct memcard_dev *dev, int port)
+{
+	if (dev->authenticated & BIT(port))
+		return 0;
+
+	/* secrman requests the SIO2 through memcard_secrman_cmd(). */
+	if (!secrman_auth_card(port, 0, (port & 1) << 3)) {
+		pr_err("%s: Card on port %d failed authentication\n",
+			__func__, port);
+		return -EACCES;
+	}
+
+	dev->authenticated |= BIT(port);
+
+	return 0;
+}
+
+static int memcard_transfer_queue(struct memcard_dev *dev, int port)
+{
+	struct memcard_queue *q = &dev->queue;
+
+	int err = sio2_request();
+	if (err < 0) {
+		pr_err("%s: sio2_request failed with %d\n", __func__, err);
+		return err;
+	}
+
+	err = memcard_transfer_sio2(dev, port);
+
+	sio2_release();
+
+	if (err < 0)
+		return err;
+
+	for (int i = 0; i < q->count; i++) {
+		const u8 *rx = &q->rx[q->cmd[i].offset];
+
+		if (rx[q->cmd[i].length - 1] != MEMCARD_TERMINATOR) {
+			pr_err("%s: Command %d failed\n", __func__, i);
+			return -EIO;
+		}
+	}
+
+	return 0;
+}
+
+static int memcard_transfer(struct memcard_dev *dev, int port)
+{
+	int err = memcard_auth(dev, port);
+	if (err < 0)
+		return err;
+
+	/* The card may have been replaced, so authenticate it again. */
+	err = memcard_transfer_queue(dev, port);
+	if (err < 0)
+		dev->authenticated &= ~BIT(port);
+
+	return err;
+}
+
+static int memcard_read(struct memcard_dev *dev, int port,
+	u32 page, size_t count, u32 addr)
+{
+	struct memcard_queue *q = &dev->queue;
+
+	*q = (struct memcard_queue) { };
+	for (size_t i = 0; i < count; i++)
+		queue_read(q, page + i);
+
+	const int err = memcard_transfer(dev, port);
+	if (err < 0)
+		return err;
+
+	for (int p = 0; p < count; p++) {
+		u8 *data = &dev->rd[p * MEMCARD_PAGE_SIZE];
+		u8 spare[MEMCARD_SPARE_SIZE];
+
+		/* Data commands follow the address command of the page. */
+		for (int c = 0; c <= MEMCARD_PAGE_CHUNKS; c++) {
+			const int i = p * MEMCARD_READ_PAGE_CMDS + 1 + c;
+			const size_t size = c < MEMCARD_PAGE_CHUNKS ?
+				MEMCARD_CHUNK_SIZE : MEMCARD_SPARE_SIZE;
+			const u8 *rx = &q->rx[q->cmd[i].offset];
+
+			if (rx[3] != MEMCARD_ACK ||
+			    rx[4 + size] != memcard_checksum(&rx[4], size)) {
+				pr_err("%s: Page %u command %d failed\n",
+					__func__, page + p, c);
+				return -EIO;
+			}
+
+			memcpy(c < MEMCARD_PAGE_CHUNKS ?
+				&data[c * MEMCARD_CHUNK_SIZE] : spare,
+				&rx[4], size);
+		}
+
+		for (int c = 0; c < MEMCARD_PAGE_CHUNKS; c++) {
+			const int n = memcard_ecc_correct(
+				&data[c * MEMCARD_CHUNK_SIZE],
+				&spare[c * MEMCARD_ECC_SIZE]);
+
+			if (n < 0) {
+				pr_err("%s: Page %u chunk %d is uncorrectable\n",
+					__func__, page + p, c);
+				return n;
+			}
+			if (n > 0)
+				pr_warn("%s: Page %u chunk %d corrected\n",
+					__func__, page + p, c);
+		}
+	}
+
+	const struct memcard_sif_rd rd = {
+		.page = page,
+		.count = count,
+		.addr = addr,
+	};
+
+	return sif_cmd_opt_data(SIF_CMD_MEMCARD,
+		(union memcard_sif_opt) { .op = rop_rd }.raw,
+		&rd, sizeof(rd), addr, dev->rd, count * MEMCARD_PAGE_SIZE);
+}
+
+static int memcard_write(struct memcard_dev *dev, int port,
+	u32 page, size_t count, const u8 *data)
+{
+	struct memcard_queue *q = &dev->queue;
+
+	*q = (struct memcard_queue) { };
+	for (size_t i = 0; i < count; i++)
+		queue_write(q, page + i, &data[i * MEMCARD_PAGE_SIZE]);
+
+	return memcard_transfer(dev, port);
+}
+
+static int memcard_erase(struct memcard_dev *dev, int port,
+	u32 page, size_t count)
+{
+	struct memcard_queue *q = &dev->queue;
+
+	*q = (struct memcard_queue) { };
+	for (size_t i = 0; i < count; i++)
+		queue_erase(q, page + i * MEMCARD_BLOCK_PAGES);
+
+	return memcard_transfer(dev, port);
+}
+
+static int memcard_secrman_transfer(struct memcard_dev *dev,
+	struct secrman_sio2_transfer *t)
+{
+	int err;
+
+	sio2_wr_port2_ctrl0(t->port_ctrl0[2]);
+	sio2_wr_port2_ctrl1(t->port_ctrl1[2]);
+	sio2_wr_port3_ctrl0(t->port_ctrl0[3]);
+	sio2_wr_port3_ctrl1(t->port_ctrl1[3]);
+
+	for (int i = 0; i < SIO2_CMD_QUEUE_SIZE; i++)
+		sio2_wr_cmd(i, t->cmd[i]);
+
+	sio2_wr_tx(t->tx, t->tx_size);
+
+	dev->busy = true;
+
+	err = t->tx_dma.size ? sio2_dma_tx(t->tx_dma.addr,
+		4 * t->tx_dma.size * t->tx_dma.count) : 0;
+	if (!err && t->rx_dma.size)
+		err = sio2_dma_rx(t->rx_dma.addr,
+			4 * t->rx_dma.size * t->rx_dma.count);
+	if (err < 0) {
+		pr_err("%s: SIO2 DMA failed with %d\n", __func__, err);
+		dev->busy = false;
+		goto out;
+	}
+
+	err = memcard_wait(dev);
+	if (err < 0) {
+		dev->busy = false;
+		goto out;
+	}
+
+	sio2_rd_rx(t->rx, t->rx_size);
+
+	t->cmd_stat = sio2_rd_cmd_stat();
+	t->port_stat = sio2_rd_port_stat();
+	t->fifo_stat = sio2_rd_fifo_stat();
+
+out:
+	SIO2_WS_CTRL(.reset_fifo = true, SIO2_CTRL_SETTINGS);
+	memcard_port_ctrl();
+
+	return err;
+}
+
+/*
+ * Authentication transfers are called back from secrman_auth_card(), in
+ * the worker, and the SIO2 is requested for each of them so that gamepad
+ * polls continue in between.
+ */
+static int memcard_secrman_cmd(int port, int slot,
+	struct secrman_sio2_transfer *transfer)
+{
+	struct memcard_dev *dev = memcard_secrman_dev;
+
+	int err = sio2_request();
+	if (err < 0) {
+		pr_err("%s: sio2_request failed with %d\n", __func__, err);
+		return 0;
+	}
+
+	err = memcard_secrman_transfer(dev, transfer);
+
+	sio2_release();
+
+	return err >= 0;
+}
+
+/* Only PS2 memory cards are supported. */
+static int memcard_secrman_dev_id(int port, int slot)
+{
+	return SECRMAN_CARD_TYPE_PS2;
+}
+
+static int memcard_sg_entry(struct memcard_dev *dev,
+	const struct memcard_sif_sg_entry *e)
+{
+	const int port = 2 + dev->opt.port;
+	size_t done = 0;
+	int err = 0;
+
+	if (dev->opt.erase) {
+		if (e->page % MEMCARD_BLOCK_PAGES ||
+		    e->count % MEMCARD_BLOCK_PAGES)
+			return -EINVAL;
+
+		const size_t blocks = e->count / MEMCARD_BLOCK_PAGES;
+
+		while (!err && done < blocks) {
+			const size_t n = min_t(size_t, blocks - done,
+				MEMCARD_QUEUE_ERASE_BLOCKS);
+
+			err = memcard_erase(dev, port,
+				e->page + done * MEMCARD_BLOCK_PAGES, n);
+			done += n;
+		}
+
+		return err;
+	}
+
+	if (dev->opt.write) {
+		if (e->addr > sizeof(dev->wb) ||
+		    e->count > (sizeof(dev->wb) - e->addr) / MEMCARD_PAGE_SIZE)
+			return -EINVAL;
+
+		while (!err && done < e->count) {
+			const size_t n = min_t(size_t, e->count - done,
+				MEMCARD_QUEUE_WRITE_PAGES);
+
+			err = memcard_write(dev, port, e->page + done, n,
+				&dev->wb[e->addr + done * MEMCARD_PAGE_SIZE]);
+			done += n;
+		}
+
+		return err;
+	}
+
+	if (!ALIGNED(e->addr, 16))
+		return -EINVAL;
+
+	while (!err && done < e->count) {
+		const size_t n = min_t(size_t, e->count - done,
+			MEMCARD_QUEUE_READ_PAGES);
+
+		err = memcard_read(dev, port, e->page + done, n,
+			e->addr + done * MEMCARD_PAGE_SIZE);
+		done += n;
+	}
+
+	return err;
+}
+
+static void memcard_sif_cmd_sg_ack(s32 status)
+{
+	const struct memcard_sif_ack ack = { .status = status };
+	int err = sif_cmd_opt(SIF_CMD_MEMCARD,
+		(union memcard_sif_opt) { .op = rop_sg }.raw,
+		&ack, sizeof(ack));
+
+	if (err < 0)
+		pr_err("%s: sif_cmd_opt failed with %d\n", __func__, err);
+}
+
+static void memcard_sif_cmd_sg_transfer(struct memcard_dev *dev)
+{
+	int err = 0;
+
+	for (int i = 0; !err && i < dev->opt.count; i++)
+		err = memcard_sg_entry(dev, &dev->sg.entry[i]);
+
+	if (err < 0)
+		pr_err("%s: Transfer failed with %d\n", __func__, err);
+
+	dev->pending = false;
+
+	/* Acknowledge that the list of transfers has been processed. */
+	memcard_sif_cmd_sg_ack(err);
+}
+
+static void memcard_sif_cmd_wb(struct memcard_dev *dev)
+{
+	const struct memcard_sif_wb wb = {
+		.addr = (u32)dev->wb,
+		.size = sizeof(dev->wb),
+	};
+	int err = sif_cmd_opt(SIF_CMD_MEMCARD,
+		(union memcard_sif_opt) { .op = rop_wb }.raw,
+		&wb, sizeof(wb));
+
+	if (err < 0)
+		pr_err("%s: sif_cmd_opt failed with %d\n", __func__, err);
+}
+
+static void memcard_sif_cmd_sg(struct memcard_dev *dev,
+	const union memcard_sif_opt opt, const struct memcard_sif_sg *sg)
+{
+	if (dev->pending || opt.count > MAX_MEMCARD_SIF_SG) {
+		memcard_sif_cmd_sg_ack(dev->pending ? -EBUSY : -EINVAL);
+		return;
+	}
+
+	dev->pending = true;
+	dev->opt = opt;
+	memcpy(&dev->sg.entry[0], &sg->entry[0],
+		opt.count * sizeof(sg->entry[0]));
+
+	/* Transfers wait for interrupts, so they are done in a worker. */
+	queue_work(WQ_NORMAL, &dev->sg_work);
+}
+
+static void memcard_sif_cmd(const struct sif_cmd_header *header, void *arg)
+{
+	const union memcard_sif_opt opt = { .raw = header->opt };
+	void *p = sif_cmd_payload(header);
+	struct memcard_dev *dev = arg;
+
+	switch (opt.op)
+	{
+	case rop_wb:
+		/* Announce the write buffer. */
+		memcard_sif_cmd_wb(dev);
+		break;
+	case rop_sg:
+		/* Process requested list of transfers. */
+		memcard_sif_cmd_sg(dev, opt, p);
+		break;
+	default:
+		pr_err("%s: Unknown op %d\n", __func__, opt.op);
+	}
+}
+
+static void sg_work(struct work_struct *work)
+{
+	memcard_sif_cmd_sg_transfer(
+		container_of(work, struct memcard_dev, sg_work));
+}
+
+static enum module_init_status memcard_init(int argc, char *argv[])
+{
+	static struct memcard_dev dev;
+
+	BUILD_BUG_ON(sizeof(union memcard_sif_opt) != sizeof(u32));
+	BUILD_BUG_ON(sizeof(struct memcard_sif_sg) > CMD_PACKET_PAYLOAD_MAX);
+	BUILD_BUG_ON(MEMCARD_QUEUE_READ_PAGES * MEMCARD_READ_PAGE_CMDS >
+		SIO2_CMD_QUEUE_SIZE);
+	BUILD_BUG_ON(MEMCARD_QUEUE_WRITE_PAGES * MEMCARD_WRITE_PAGE_CMDS >
+		SIO2_CMD_QUEUE_SIZE);
+	BUILD_BUG_ON(MEMCARD_QUEUE_ERASE_BLOCKS * 3 > SIO2_CMD_QUEUE_SIZE);
+	BUILD_BUG_ON(MEMCARD_PAGE_CHUNKS * MEMCARD_ECC_SIZE > MEMCARD_SPARE_SIZE);
+	BUILD_BUG_ON(ALIGN(MEMCARD_QUEUE_READ_PAGES * (MEMCARD_ADDR_CMD_SIZE +
+		MEMCARD_PAGE_CHUNKS * MEMCARD_DATA_CMD_SIZE(MEMCARD_CHUNK_SIZE) +
+		MEMCARD_DATA_CMD_SIZE(MEMCARD_SPARE_SIZE)), 4) >
+		MEMCARD_QUEUE_BYTES);
+	BUILD_BUG_ON(ALIGN(MEMCARD_QUEUE_WRITE_PAGES * (MEMCARD_ADDR_CMD_SIZE +
+		MEMCARD_PAGE_CHUNKS * MEMCARD_DATA_CMD_SIZE(MEMCARD_CHUNK_SIZE) +
+		MEMCARD_DATA_CMD_SIZE(MEMCARD_SPARE_SIZE) +
+		MEMCARD_SHORT_CMD_SIZE), 4) > MEMCARD_QUEUE_BYTES);
+
+	memcard_port_ctrl();
+
+	memcard_ecc_init();
+
+	INIT_WORK(&dev.sg_work, sg_work);
+	timer_setup(&dev.timeout, memcard_timeout);
+
+	const struct iop_sema done_sema = { .initial = 0, .max = 1 };
+	dev.done_sema_id = thsemap_create_sema(&done_sema);
+	if (dev.done_sema_id < 0) {
+		pr_err("%s: thsemap_create_sema failed with %d: %s\n",
+			__func__, dev.done_sema_id,
+			iop_error_message(dev.done_sema_id));
+		goto err_done_sema_create;
+	}
+
+	int err = request_irq(IRQ_IOP_SIO2, memcard_irq, &dev);
+	if (err < 0) {
+		pr_err("%s: request_irq for IRQ_IOP_SIO2 failed with %d\n",
+			__func__, err);
+		goto err_request_irq;
+	}
+
+	memcard_secrman_dev = &dev;
+	secrman_set_mc_cmd_handler(memcard_secrman_cmd);
+	secrman_set_mc_dev_id_handler(memcard_secrman_dev_id);
+
+	sif_request_cmd(SIF_CMD_MEMCARD, memcard_sif_cmd, &dev);
+
+	return MODULE_RESIDENT;
+
+err_request_irq:
+	thsemap_delete_sema(dev.done_sema_id);
+
+err_done_sema_create:
+	return MODULE_EXIT;
+}
+module_init(memcard_init);
@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * SIO2 arbitration
+ *
+ * The SIO2 has a single command queue for the controller and memory card
+ * ports, and a single interrupt line. The gamepad polls from a timer and
+ * cannot wait, whereas memory card transfers are done in a worker thread.
+ * Both request the SIO2 before they start a command queue, and release it
+ * once it has completed.
+ *
+ * Copyright (C) 2021 Fredrik Noring
+ */
+
+#include "iopmod/errno.h"
+#include "iopmod/interrupt.h"
+#include "iopmod/iop-error.h"
+#include "iopmod/module.h"
+#include "iopmod/printk.h"
+#include "iopmod/sio2.h"
+#include "iopmod/thread.h"
+
+#define SIO2_MAX_WAITERS	8
+
+/**
+ * struct sio2_owner - SIO2 ownership
+ * @sema_id: semaphore signalled to hand the SIO2 over to a waiting thread
+ * @waiters: number of threads waiting for the SIO2
+ * @owned: %true if the SIO2 is in use
+ */
+static struct sio2_owner {
+	int sema_id;
+	int waiters;
+	bool owned;
+} sio2;
+
+int sio2_request()
+{
+	unsigned int flags;
+
+	irq_save(flags);
+
+	if (!sio2.owned) {
+		sio2.owned = true;
+		irq_restore(flags);
+		return 0;
+	}
+
+	sio2.waiters++;
+
+	irq_restore(flags);
+
+	/* The SIO2 remains owned when it is handed over. */
+	const int ioperr = thsemap_wait_sema(sio2.sema_id);
+	if (ioperr < 0) {
+		irq_save(flags);
+		sio2.waiters--;
+		irq_restore(flags);
+
+		return errno_for_iop_error(ioperr);
+	}
+
+	return 0;
+}
+
+int sio2_try_request()
+{
+	unsigned int flags;
+	bool owned;
+
+	irq_save(flags);
+
+	owned = sio2.owned;
+	sio2.owned = true;
+
+	irq_restore(flags);
+
+	return owned ? -EBUSY : 0;
+}
+
+void sio2_release()
+{
+	unsigned int flags;
+	bool handover;
+
+	irq_save(flags);
+
+	handover = sio2.waiters > 0;
+	if (handover)
+		sio2.waiters--;
+	else
+		sio2.owned = false;
+
+	irq_restore(flags);
+
+	if (!handover)
+		return;
+
+	if (in_irq())
+		thsemap_isignal_sema(sio2.sema_id);
+	else
+		thsemap_signal_sema(sio2.sema_id);
+}
+
+static enum module_init_status sio2_init(int argc, char *argv[])
+{
+	const struct iop_sema sema = { .initial = 0, .max = SIO2_MAX_WAITERS };
+
+	sio2.sema_id = thsemap_create_sema(&sema);
+	if (sio2.sema_id < 0) {
+		pr_err("%s: thsemap_create_sema failed with %d: %s\n",
+			__func__, sio2.sema_id, iop_error_message(sio2.sema_id));
+		return MODULE_EXIT;
+	}
+
+	return MODULE_RESIDENT;
+}
+module_init(sio2_init);
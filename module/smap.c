@@ -0,0 +1,1254 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * SMAP Ethernet
+ *
+ * Received frames are read from the SMAP receive FIFO into a batch buffer,
+ * and several frames at a time are copied with a single SIF DMA transfer
+ * into a receive ring in main memory, announced by the main processor. The
+ * main processor returns ring space as it consumes the frames.
+ *
+ * Receive interrupts are mitigated by polling. The first receive interrupt
+ * masks the line and wakes the receive thread, which drains a budget of
+ * frames at a time for as long as more are pending. The line is unmasked
+ * only once the receive descriptors are empty, so at line rate there is
+ * about one interrupt per burst rather than one per frame. The main
+ * processor can select other polling modes of the IRQ module, for example
+ * to disable mitigation, and the statistics report the number of frames per
+ * interrupt to compare them.
+ *
+ * Frames to transmit are written by the main processor to a transmit buffer
+ * of the IOP, and then given in batches of descriptors, following the
+ * scatter-gather conventions of the ATA and memory card modules. Each batch
+ * is acknowledged with a status once all of its frames are in the transmit
+ * FIFO, after which the main processor can reuse the transmit buffer.
+ *
+ * Transmissions time out if the transmit FIFO does not drain, for example
+ * when the link is lost, so that the transmit worker is never stuck.
+ *
+ * Transmissions, enabling and disabling the interface, and link polls all
+ * wait or sleep, so they are done by a single work item on the normal
+ * workqueue. The work item never runs concurrently with itself, which
+ * serialises them, and they do not delay the latency sensitive work of
+ * other modules on the high priority workqueue.
+ *
+ * DEV9 is requested, and the SMAP reset, when the main processor enables
+ * the interface, and released when it disables it, so that DEV9 can power
+ * off while the interface is down. The SPEED interrupt mask needs power, so
+ * the interrupts are requested and released along with DEV9.
+ *
+ * Enabling the interface also resets the PHY and restarts autonegotiation
+ * over the STA interface of the EMAC3. The link is then polled, and the
+ * MACs are enabled with the negotiated speed and duplex while it is up. The
+ * MAC address is read from the EEPROM unless the main processor gives one.
+ *
+ * Copyright (C) 2021 Fredrik Noring
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "iopmod/bits.h"
+#include "iopmod/build-bug.h"
+#include "iopmod/compare.h"
+#include "iopmod/dev9.h"
+#include "iopmod/errno.h"
+#include "iopmod/interrupt.h"
+#include "iopmod/io.h"
+#include "iopmod/iop-error.h"
+#include "iopmod/irq.h"
+#include "iopmod/module.h"
+#include "iopmod/printk.h"
+#include "iopmod/processor.h"
+#include "iopmod/sif.h"
+#include "iopmod/sifcmd.h"
+#include "iopmod/smap.h"
+#include "iopmod/thread.h"
+#include "iopmod/timer.h"
+#include "iopmod/workqueue.h"
+
+#include "iopmod/asm/macro.h"
+
+#define SMAP_RX_BATCH_SIZE	8192
+#define SMAP_RX_ALIGN		16
+#define SMAP_WB_SIZE		16384
+#define SMAP_RX_BUDGET		16	/* Frames per poll of the receive thread. */
+
+#define SMAP_RESET_TRIES	10000
+#define SMAP_PHY_RESET_TRIES	100
+#define SMAP_PHY_RESET_US	1000
+#define SMAP_EEPROM_DELAY_US	1
+
+#define SMAP_TX_TIMEOUT_US	1000000
+#define SMAP_LINK_POLL_US	1000000
+
+#define SMAP_INTR_BIT(irq)	BIT((irq) - IRQ_IOP_SPD_BASE)
+
+#define SMAP_WORK_UP		BIT(0)
+#define SMAP_WORK_DOWN		BIT(1)
+#define SMAP_WORK_LINK		BIT(2)
+#define SMAP_WORK_TX		BIT(3)
+
+#define MAX_SMAP_SIF_RX							\
+	((CMD_PACKET_PAYLOAD_MAX - 2 * sizeof(u32)) / sizeof(u16))
+#define MAX_SMAP_SIF_TX							\
+	(CMD_PACKET_PAYLOAD_MAX / sizeof(struct smap_sif_tx_entry))
+
+/**
+ * enum iop_smap_rops - IOP SMAP remote operations
+ * @rop_ring: Announce the receive ring of the main processor
+ * @rop_rx: Frames copied into the receive ring
+ * @rop_rx_done: Receive ring space returned by the main processor
+ * @rop_wb: Request and announce the transmit buffer of the IOP
+ * @rop_tx: Request frames to be transmitted, acknowledged with a status
+ * @rop_mac: Enable the interface with a MAC address, acknowledged with the
+ * 	MAC address in use
+ * @rop_stat: Request and report frame and interrupt statistics
+ * @rop_down: Disable the interface
+ * @rop_poll: Select how the receive thread is polled
+ */
+enum iop_smap_rops {
+	rop_ring    = 0,
+	rop_rx      = 1,
+	rop_rx_done = 2,
+	rop_wb      = 3,
+	rop_tx      = 4,
+	rop_mac     = 5,
+	rop_stat    = 6,
+	rop_down    = 7,
+	rop_poll    = 8,
+};
+
+union smap_sif_opt {
+	u32 raw;
+	struct {
+		u32 op : 4;
+		u32 count : 8;
+		u32 : 20;
+	};
+};
+
+/**
+ * struct smap_sif_ring - receive ring of the main processor
+ * @addr: 16-byte aligned main address
+ * @size: size in bytes, a multiple of 16
+ */
+struct smap_sif_ring {
+	u32 addr;
+	u32 size;
+};
+
+/**
+ * struct smap_sif_rx - frames copied into the receive ring
+ * @head: total number of bytes produced into the ring, including this batch
+ * @offset: ring offset of the first frame
+ * @length: length of each frame, where each frame begins at the next
+ * 	16-byte aligned offset after the previous one
+ *
+ * The number of frames is given by the count of &union smap_sif_opt. Ring
+ * space between the end of the previous batch and @offset is skipped.
+ */
+struct smap_sif_rx {
+	u32 head;
+	u32 offset;
+	u16 length[MAX_SMAP_SIF_RX];
+};
+
+/**
+ * struct smap_sif_rx_done - receive ring space returned
+ * @tail: the @head of the last consumed &struct smap_sif_rx
+ */
+struct smap_sif_rx_done {
+	u32 tail;
+};
+
+/**
+ * struct smap_sif_wb - transmit buffer of the IOP
+ * @addr: IOP address for the main processor to write frames to
+ * @size: size in bytes
+ */
+struct smap_sif_wb {
+	u32 addr;
+	u32 size;
+};
+
+/**
+ * struct smap_sif_tx - frames to transmit
+ * @entry: list of frames
+ * @entry.offset: 4-byte aligned offset into the transmit buffer
+ * @entry.length: frame length in bytes, excluding the FCS
+ */
+struct smap_sif_tx {
+	struct smap_sif_tx_entry {
+		u32 offset;
+		u32 length;
+	} entry[MAX_SMAP_SIF_TX];
+};
+
+/**
+ * struct smap_sif_ack - transmit completion
+ * @status: 0 on success, otherwise a negative error number
+ */
+struct smap_sif_ack {
+	s32 status;
+};
+
+/**
+ * struct smap_sif_mac - MAC address
+ * @addr: MAC address, or zero for the address in the EEPROM
+ */
+struct smap_sif_mac {
+	u8 addr[6];
+};
+
+/**
+ * struct smap_sif_poll - polling of the receive thread
+ * @poll: %IRQ_POLL_YIELD, %IRQ_POLL_DRAIN or %IRQ_POLL_UNMASKED, see
+ * 	&enum irq_poll
+ */
+struct smap_sif_poll {
+	u32 poll;
+};
+
+/**
+ * struct smap_sif_mac_ack - interface enabled
+ * @status: 0 on success, otherwise a negative error number
+ * @mac: MAC address in use
+ * @reserved: unused
+ */
+struct smap_sif_mac_ack {
+	s32 status;
+	struct smap_sif_mac mac;
+	u16 reserved;
+};
+
+/**
+ * struct smap_sif_stat - frame and interrupt statistics
+ * @rx_frames: number of frames received
+ * @rx_errors: number of frames received with errors
+ * @rx_dropped: number of frames dropped for lack of receive ring space
+ * @rx_irqs: number of receive interrupts
+ * @rx_polls: number of receive polls, at most %SMAP_RX_BUDGET frames each
+ * @rx_max_per_irq: largest number of frames drained for one interrupt
+ * @rx_per_irq: number of receive interrupts by the number of frames drained
+ * 	for them, in powers of two: none, 1, 2-3, 4-7, 8-15, 16-31, 32-63,
+ * 	and 64 or more
+ * @tx_frames: number of frames sent
+ * @tx_errors: number of frames sent with errors
+ *
+ * The average number of frames per receive interrupt is the number of
+ * frames received, with errors and dropped, divided by @rx_irqs. Frames
+ * are drained for an interrupt until the receive descriptors are empty.
+ */
+struct smap_sif_stat {
+	u32 rx_frames;
+	u32 rx_errors;
+	u32 rx_dropped;
+	u32 rx_irqs;
+	u32 rx_polls;
+	u32 rx_max_per_irq;
+	u32 rx_per_irq[8];
+	u32 tx_frames;
+	u32 tx_errors;
+};
+
+/**
+ * struct smap_dev - SMAP Ethernet device
+ * @wb: transmit buffer written by the main processor
+ * @batch: received frames to copy into the receive ring
+ * @ring: receive ring of the main processor
+ * @ring.addr: main address, or zero if not yet announced
+ * @ring.size: size in bytes
+ * @ring.head: total number of bytes produced, including skipped space
+ * @ring.tail: total number of bytes returned by the main processor
+ * @ring.next: ring announced by the main processor, not yet in use
+ * @ring.announced: %true if @ring.next is to be taken into use
+ * @rx: batch of received frames
+ * @rx.bd: next receive buffer descriptor
+ * @rx.count: number of frames in @batch
+ * @rx.size: number of bytes in @batch, including padding
+ * @rx.sif: frame lengths of @batch
+ * @rx.irq_frames: number of frames drained since the descriptors were empty
+ * @tx: frames to transmit
+ * @tx.opt: options of the requested batch
+ * @tx.sg: requested batch
+ * @tx.pending: %true while a batch is being transmitted
+ * @tx.sema_id: semaphore signalled when frames have been sent
+ * @tx.timeout: timer for frames that are never sent
+ * @tx.timed_out: %true if @tx.timeout expired while waiting
+ * @tx.bd: next transmit buffer descriptor
+ * @tx.done: oldest transmit buffer descriptor in flight
+ * @tx.inflight: number of frames in flight
+ * @tx.ptr: next transmit FIFO write offset
+ * @tx.free: number of free transmit FIFO bytes
+ * @up: interface state
+ * @up.enabled: %true if enabled, with DEV9 requested
+ * @up.link: %true if the link is up, with the MACs enabled
+ * @up.mac: MAC address in use
+ * @up.link_timer: timer polling the link while enabled
+ * @work: work transmitting, enabling, disabling and polling the link
+ * @events: work to do, as %SMAP_WORK_UP, %SMAP_WORK_DOWN, etc.
+ * @stat: frame and interrupt statistics
+ */
+struct smap_dev {
+	u8 wb[SMAP_WB_SIZE] __attribute__((aligned(16)));
+	u8 batch[SMAP_RX_BATCH_SIZE] __attribute__((aligned(16)));
+
+	struct {
+		u32 addr;
+		u32 size;
+		u32 head;
+		u32 tail;
+		struct smap_sif_ring next;
+		bool announced;
+	} ring;
+
+	struct {
+		int bd;
+		int count;
+		size_t size;
+		struct smap_sif_rx sif;
+		u32 irq_frames;
+	} rx;
+
+	struct {
+		union smap_sif_opt opt;
+		struct smap_sif_tx sg;
+		bool pending;
+		int sema_id;
+		struct timer_list timeout;
+		bool timed_out;
+		int bd;
+		int done;
+		int inflight;
+		u16 ptr;
+		u16 free;
+	} tx;
+
+	struct {
+		bool enabled;
+		bool link;
+		struct smap_sif_mac mac;
+		struct timer_list link_timer;
+	} up;
+
+	struct work_struct work;
+	u32 events;
+
+	struct smap_sif_stat stat;
+};
+
+static void smap_queue_work(struct smap_dev *dev, u32 events)
+{
+	unsigned int flags;
+
+	irq_save(flags);
+
+	/* Enabling disables first, so a pending disable is superseded. */
+	if (events & SMAP_WORK_UP)
+		dev->events &= ~SMAP_WORK_DOWN;
+	dev->events |= events;
+
+	irq_restore(flags);
+
+	queue_work(WQ_NORMAL, &dev->work);
+}
+
+static void smap_rx_flush(struct smap_dev *dev)
+{
+	const u32 offset = dev->ring.head % dev->ring.size;
+	int err;
+
+	if (!dev->rx.count)
+		return;
+
+	dev->ring.head += dev->rx.size;
+	dev->rx.sif.head = dev->ring.head;
+	dev->rx.sif.offset = offset;
+
+	err = sif_cmd_opt_data(SIF_CMD_SMAP,
+		(union smap_sif_opt) {
+			.op = rop_rx,
+			.count = dev->rx.count
+		}.raw,
+		&dev->rx.sif, ALIGN(offsetof(struct smap_sif_rx, length) +
+			dev->rx.count * sizeof(u16), 4),
+		dev->ring.addr + offset, dev->batch, dev->rx.size);
+	if (err < 0) {
+		pr_err("%s: sif_cmd_opt_data failed with %d\n", __func__, err);
+		dev->stat.rx_dropped += dev->rx.count;
+	}
+
+	dev->rx.count = 0;
+	dev->rx.size = 0;
+}
+
+/*
+ * Reserve contiguous receive ring space for a frame, flushing the batch or
+ * skipping to the beginning of the ring as necessary.
+ */
+static bool smap_rx_reserve(struct smap_dev *dev, size_t size)
+{
+	for (;;) {
+		/* The batch is contiguous, so its end does not wrap around. */
+		const u32 head = dev->ring.head + dev->rx.size;
+		const u32 used = head - READ_ONCE(dev->ring.tail);
+		const u32 offset = dev->ring.head % dev->ring.size +
+				   dev->rx.size;
+
+		if (offset + size <= dev->ring.size) {
+			if (used + size > dev->ring.size)
+				return false;
+
+			if (dev->rx.size + size <= sizeof(dev->batch) &&
+			    dev->rx.count < MAX_SMAP_SIF_RX)
+				return true;
+
+			smap_rx_flush(dev);
+			continue;
+		}
+
+		if (dev->rx.count) {
+			smap_rx_flush(dev);
+			continue;
+		}
+
+		if (used + (dev->ring.size - offset) + size > dev->ring.size)
+			return false;
+
+		dev->ring.head += dev->ring.size - offset;
+	}
+}
+
+static void smap_rx_frame(struct smap_dev *dev, u32 bd, u16 stat)
+{
+	const u16 length = smap_rd_bd(bd, length);
+	const size_t size = ALIGN(length, SMAP_RX_ALIGN);
+
+	if ((stat & SMAP_BD_RX_ERROR) || !length || length > SMAP_FRAME_MAX) {
+		dev->stat.rx_errors++;
+		return;
+	}
+
+	if (!dev->ring.addr || !smap_rx_reserve(dev, size)) {
+		dev->stat.rx_dropped++;
+		return;
+	}
+
+	u32 *data = (u32 *)&dev->batch[dev->rx.size];
+
+	iowr16(smap_rd_bd(bd, pointer), SMAP_REG(SMAP_REG_RXFIFO_RD_PTR));
+	for (size_t i = 0; i < ALIGN(length, 4) / 4; i++)
+		data[i] = iord32(SMAP_REG(SMAP_REG_RXFIFO_DATA));
+
+	dev->rx.sif.length[dev->rx.count++] = length;
+	dev->rx.size += size;
+	dev->stat.rx_frames++;
+}
+
+static enum irq_status smap_rxend_irq(void *arg)
+{
+	struct smap_dev *dev = arg;
+
+	/* The line remains masked until the receive thread is done polling. */
+	dev->stat.rx_irqs++;
+
+	iowr16(SMAP_INTR_BIT(IRQ_IOP_SPD_RXEND), SMAP_REG(SMAP_REG_INTR_CLR));
+
+	return IRQ_WAKE_THREAD;
+}
+
+/*
+ * A newly announced ring is taken into use by the receive thread, between
+ * batches, since the thread is the only user of the ring head.
+ */
+static void smap_rx_ring(struct smap_dev *dev)
+{
+	unsigned int flags;
+
+	irq_save(flags);
+
+	if (dev->ring.announced) {
+		dev->ring.addr = dev->ring.next.addr;
+		dev->ring.size = dev->ring.next.size;
+		dev->ring.head = 0;
+		dev->ring.tail = 0;
+		dev->ring.announced = false;
+	}
+
+	irq_restore(flags);
+}
+
+static enum irq_status smap_rx_thread(void *arg)
+{
+	struct smap_dev *dev = arg;
+	bool empty = false;
+
+	dev->stat.rx_polls++;
+
+	smap_rx_ring(dev);
+
+	for (int budget = SMAP_RX_BUDGET; budget; budget--) {
+		const u32 bd = smap_rx_bd(dev->rx.bd);
+		const u16 stat = smap_rd_bd(bd, ctrl_stat);
+
+		empty = stat & SMAP_BD_RX_EMPTY;
+		if (empty)
+			break;
+
+		smap_rx_frame(dev, bd, stat);
+
+		iowr8(1, SMAP_REG(SMAP_REG_RXFIFO_FRAME_DEC));
+		smap_wr_bd(SMAP_BD_RX_EMPTY, bd, ctrl_stat);
+
+		dev->rx.bd = (dev->rx.bd + 1) % SMAP_BD_COUNT;
+		dev->rx.irq_frames++;
+	}
+
+	smap_rx_flush(dev);
+
+	if (!empty)
+		return IRQ_WAKE_THREAD;	/* Poll again with the line masked. */
+
+	dev->stat.rx_max_per_irq =
+		max(dev->stat.rx_max_per_irq, dev->rx.irq_frames);
+	dev->stat.rx_per_irq[min_t(int, fls(dev->rx.irq_frames),
+		ARRAY_SIZE(dev->stat.rx_per_irq) - 1)]++;
+	dev->rx.irq_frames = 0;
+
+	/*
+	 * Frames received after the descriptors were found empty have their
+	 * interrupt pending, since it was acknowledged before polling began.
+	 */
+	return IRQ_HANDLED;
+}
+
+static enum irq_status smap_txend_irq(void *arg)
+{
+	struct smap_dev *dev = arg;
+
+	iowr16(SMAP_INTR_BIT(IRQ_IOP_SPD_TXEND), SMAP_REG(SMAP_REG_INTR_CLR));
+
+	while (dev->tx.inflight) {
+		const u32 bd = smap_tx_bd(dev->tx.done);
+		const u16 stat = smap_rd_bd(bd, ctrl_stat);
+
+		if (stat & SMAP_BD_TX_READY)
+			break;
+
+		if (stat & SMAP_BD_TX_ERROR)
+			dev->stat.tx_errors++;
+		else
+			dev->stat.tx_frames++;
+
+		dev->tx.free += ALIGN(smap_rd_bd(bd, length), 4);
+		dev->tx.inflight--;
+		dev->tx.done = (dev->tx.done + 1) % SMAP_BD_COUNT;
+	}
+
+	thsemap_isignal_sema(dev->tx.sema_id);
+
+	return IRQ_HANDLED;
+}
+
+static void smap_tx_timeout(struct timer_list *timer)
+{
+	struct smap_dev *dev = container_of(timer, struct smap_dev, tx.timeout);
+
+	dev->tx.timed_out = true;
+
+	thsemap_isignal_sema(dev->tx.sema_id);
+}
+
+static int smap_tx_wait(struct smap_dev *dev, size_t size)
+{
+	bool timer = false;
+	unsigned int flags;
+	int err = 0;
+
+	dev->tx.timed_out = false;
+
+	for (;;) {
+		irq_save(flags);
+
+		const bool room = dev->tx.inflight < SMAP_BD_COUNT &&
+				  dev->tx.free >= size;
+
+		irq_restore(flags);
+
+		if (room)
+			break;
+
+		if (READ_ONCE(dev->tx.timed_out)) {
+			pr_err("%s: Transmit timed out\n", __func__);
+			err = -EIO;
+			break;
+		}
+
+		if (!timer) {
+			err = mod_timer(&dev->tx.timeout, timer_jiffies() +
+				us_to_jiffies(SMAP_TX_TIMEOUT_US));
+			if (err < 0) {
+				pr_err("%s: mod_timer failed with %d\n",
+					__func__, err);
+				break;
+			}
+			timer = true;
+		}
+
+		thsemap_wait_sema(dev->tx.sema_id);
+	}
+
+	if (timer)
+		del_timer(&dev->tx.timeout);
+
+	return err;
+}
+
+static int smap_tx_frame(struct smap_dev *dev,
+	const struct smap_sif_tx_entry *e)
+{
+	const size_t size = ALIGN(e->length, 4);
+	unsigned int flags;
+
+	if (!e->length || e->length > SMAP_FRAME_MAX ||
+	    !ALIGNED(e->offset, 4) || e->offset > sizeof(dev->wb) ||
+	    size > sizeof(dev->wb) - e->offset)
+		return -EINVAL;
+
+	const int err = smap_tx_wait(dev, size);
+	if (err < 0)
+		return err;
+
+	const u32 *data = (const u32 *)&dev->wb[e->offset];
+	const u32 bd = smap_tx_bd(dev->tx.bd);
+
+	iowr16(dev->tx.ptr, SMAP_REG(SMAP_REG_TXFIFO_WR_PTR));
+	for (size_t i = 0; i < size / 4; i++)
+		iowr32(data[i], SMAP_REG(SMAP_REG_TXFIFO_DATA));
+
+	smap_wr_bd(e->length, bd, length);
+	smap_wr_bd(SMAP_TX_BASE + dev->tx.ptr, bd, pointer);
+	smap_wr_bd(SMAP_BD_TX_READY | SMAP_BD_TX_GENFCS | SMAP_BD_TX_GENPAD,
+		bd, ctrl_stat);
+
+	irq_save(flags);
+
+	dev->tx.ptr = (dev->tx.ptr + size) % SMAP_TX_BUFSIZE;
+	dev->tx.free -= size;
+	dev->tx.inflight++;
+	dev->tx.bd = (dev->tx.bd + 1) % SMAP_BD_COUNT;
+
+	irq_restore(flags);
+
+	iowr8(1, SMAP_REG(SMAP_REG_TXFIFO_FRAME_INC));
+	smap_wr_emac3(SMAP_E3_TX_GNP_0, SMAP_REG_EMAC3_TX_MODE0);
+
+	return 0;
+}
+
+static void smap_sif_cmd_tx_ack(s32 status)
+{
+	const struct smap_sif_ack ack = { .status = status };
+	int err = sif_cmd_opt(SIF_CMD_SMAP,
+		(union smap_sif_opt) { .op = rop_tx }.raw,
+		&ack, sizeof(ack));
+
+	if (err < 0)
+		pr_err("%s: sif_cmd_opt failed with %d\n", __func__, err);
+}
+
+static void smap_tx_work(struct smap_dev *dev)
+{
+	int err = 0;
+
+	if (!dev->up.enabled)
+		err = -ENODEV;
+	else if (!dev->up.link)
+		err = -EIO;
+
+	for (int i = 0; !err && i < dev->tx.opt.count; i++)
+		err = smap_tx_frame(dev, &dev->tx.sg.entry[i]);
+
+	if (err < 0)
+		pr_err("%s: Transmit failed with %d\n", __func__, err);
+
+	dev->tx.pending = false;
+
+	/* Acknowledge that the transmit buffer can be reused. */
+	smap_sif_cmd_tx_ack(err);
+}
+
+static void smap_sif_cmd_tx(struct smap_dev *dev,
+	const union smap_sif_opt opt, const struct smap_sif_tx *sg)
+{
+	if (dev->tx.pending || opt.count > MAX_SMAP_SIF_TX) {
+		smap_sif_cmd_tx_ack(dev->tx.pending ? -EBUSY : -EINVAL);
+		return;
+	}
+
+	dev->tx.pending = true;
+	dev->tx.opt = opt;
+	memcpy(&dev->tx.sg.entry[0], &sg->entry[0],
+		opt.count * sizeof(sg->entry[0]));
+
+	/* Transmissions wait for FIFO space, so they are done in a worker. */
+	smap_queue_work(dev, SMAP_WORK_TX);
+}
+
+static void smap_sif_cmd_wb(struct smap_dev *dev)
+{
+	const struct smap_sif_wb wb = {
+		.addr = (u32)dev->wb,
+		.size = sizeof(dev->wb),
+	};
+	int err = sif_cmd_opt(SIF_CMD_SMAP,
+		(union smap_sif_opt) { .op = rop_wb }.raw,
+		&wb, sizeof(wb));
+
+	if (err < 0)
+		pr_err("%s: sif_cmd_opt failed with %d\n", __func__, err);
+}
+
+static void smap_sif_cmd_ring(struct smap_dev *dev,
+	const struct smap_sif_ring *ring)
+{
+	if (!ALIGNED(ring->addr, 16) || !ring->size ||
+	    !ALIGNED(ring->size, 16)) {
+		pr_err("%s: Invalid ring addr 0x%x size %u\n", __func__,
+			ring->addr, ring->size);
+		return;
+	}
+
+	/* SIF commands are handled with interrupts disabled. */
+	dev->ring.next = *ring;
+	dev->ring.announced = true;
+}
+
+static void smap_sif_cmd_mac_ack(struct smap_dev *dev, s32 status)
+{
+	const struct smap_sif_mac_ack ack = {
+		.status = status,
+		.mac = dev->up.mac,
+	};
+	int err = sif_cmd_opt(SIF_CMD_SMAP,
+		(union smap_sif_opt) { .op = rop_mac }.raw,
+		&ack, sizeof(ack));
+
+	if (err < 0)
+		pr_err("%s: sif_cmd_opt failed with %d\n", __func__, err);
+}
+
+static void smap_sif_cmd_mac(struct smap_dev *dev,
+	const struct smap_sif_mac *mac)
+{
+	dev->up.mac = *mac;
+
+	/* Powering on DEV9 and resetting the PHY sleep. */
+	smap_queue_work(dev, SMAP_WORK_UP);
+}
+
+static void smap_sif_cmd_stat(struct smap_dev *dev)
+{
+	int err = sif_cmd_opt(SIF_CMD_SMAP,
+		(union smap_sif_opt) { .op = rop_stat }.raw,
+		&dev->stat, sizeof(dev->stat));
+
+	if (err < 0)
+		pr_err("%s: sif_cmd_opt failed with %d\n", __func__, err);
+}
+
+static void smap_sif_cmd_poll(const struct smap_sif_poll *poll)
+{
+	const int err = set_irq_poll(IRQ_IOP_SPD_RXEND, poll->poll);
+
+	if (err < 0)
+		pr_err("%s: set_irq_poll failed with %d\n", __func__, err);
+}
+
+static void smap_sif_cmd(const struct sif_cmd_header *header, void *arg)
+{
+	const union smap_sif_opt opt = { .raw = header->opt };
+	void *p = sif_cmd_payload(header);
+	struct smap_dev *dev = arg;
+
+	switch (opt.op)
+	{
+	case rop_ring:
+		/* Announce the receive ring. */
+		smap_sif_cmd_ring(dev, p);
+		break;
+	case rop_rx_done: {
+		const struct smap_sif_rx_done *done = p;
+
+		WRITE_ONCE(dev->ring.tail, done->tail);
+		break;
+	}
+	case rop_wb:
+		/* Announce the transmit buffer. */
+		smap_sif_cmd_wb(dev);
+		break;
+	case rop_tx:
+		/* Transmit requested list of frames. */
+		smap_sif_cmd_tx(dev, opt, p);
+		break;
+	case rop_mac:
+		smap_sif_cmd_mac(dev, p);
+		break;
+	case rop_stat:
+		smap_sif_cmd_stat(dev);
+		break;
+	case rop_down:
+		smap_queue_work(dev, SMAP_WORK_DOWN);
+		break;
+	case rop_poll:
+		smap_sif_cmd_poll(p);
+		break;
+	default:
+		pr_err("%s: Unknown op %d\n", __func__, opt.op);
+	}
+}
+
+static int smap_wait_clear(u32 reg, u16 mask)
+{
+	for (int i = 0; i < SMAP_RESET_TRIES; i++) {
+		if (!(iord16(SMAP_REG(reg)) & mask))
+			return 0;
+
+		cpu_relax();
+	}
+
+	return -EIO;
+}
+
+static int smap_reset(void)
+{
+	int err;
+
+	iowr16(SMAP_TXFIFO_RESET, SMAP_REG(SMAP_REG_TXFIFO_CTRL));
+	err = smap_wait_clear(SMAP_REG_TXFIFO_CTRL, SMAP_TXFIFO_RESET);
+	if (err < 0)
+		return err;
+
+	iowr16(SMAP_RXFIFO_RESET, SMAP_REG(SMAP_REG_RXFIFO_CTRL));
+	err = smap_wait_clear(SMAP_REG_RXFIFO_CTRL, SMAP_RXFIFO_RESET);
+	if (err < 0)
+		return err;
+
+	/* The soft reset bit is in the high half of EMAC3 mode 0. */
+	smap_wr_emac3(SMAP_E3_SOFT_RESET, SMAP_REG_EMAC3_MODE0);
+	err = smap_wait_clear(SMAP_REG_EMAC3_MODE0, SMAP_E3_SOFT_RESET >> 16);
+	if (err < 0)
+		return err;
+
+	iowr16(0, SMAP_REG(SMAP_REG_BD_MODE));
+
+	for (int i = 0; i < SMAP_BD_COUNT; i++) {
+		const u32 tx = smap_tx_bd(i);
+		const u32 rx = smap_rx_bd(i);
+
+		smap_wr_bd(0, tx, ctrl_stat);
+		smap_wr_bd(0, tx, length);
+		smap_wr_bd(0, tx, pointer);
+
+		smap_wr_bd(SMAP_BD_RX_EMPTY, rx, ctrl_stat);
+		smap_wr_bd(0, rx, length);
+		smap_wr_bd(0, rx, pointer);
+	}
+
+	iowr16(SMAP_INTR_BIT(IRQ_IOP_SPD_TXDNV) |
+	       SMAP_INTR_BIT(IRQ_IOP_SPD_RXDNV) |
+	       SMAP_INTR_BIT(IRQ_IOP_SPD_TXEND) |
+	       SMAP_INTR_BIT(IRQ_IOP_SPD_RXEND) |
+	       SMAP_INTR_BIT(IRQ_IOP_SPD_EMAC3), SMAP_REG(SMAP_REG_INTR_CLR));
+
+	smap_wr_emac3(SMAP_E3_RX_STRIP_PAD | SMAP_E3_RX_STRIP_FCS |
+		SMAP_E3_RX_INDIVID_ADDR | SMAP_E3_RX_BCAST,
+		SMAP_REG_EMAC3_RX_MODE);
+	smap_wr_emac3(0, SMAP_REG_EMAC3_INTR_ENABLE);
+
+	return 0;
+}
+
+static int smap_sta_wait(void)
+{
+	for (int i = 0; i < SMAP_RESET_TRIES; i++) {
+		if (smap_rd_emac3(SMAP_REG_EMAC3_STA_CTRL) &
+				SMAP_E3_PHY_OP_COMPLETE)
+			return 0;
+
+		cpu_relax();
+	}
+
+	return -EIO;
+}
+
+static int smap_phy_read(u32 reg)
+{
+	int err = smap_sta_wait();
+	if (err < 0)
+		return err;
+
+	smap_wr_emac3(SMAP_E3_PHY_READ |
+		(SMAP_PHY_ADDR << SMAP_E3_PHY_ADDR_SHIFT) | reg,
+		SMAP_REG_EMAC3_STA_CTRL);
+
+	err = smap_sta_wait();
+	if (err < 0)
+		return err;
+
+	const u32 sta = smap_rd_emac3(SMAP_REG_EMAC3_STA_CTRL);
+	if (sta & SMAP_E3_PHY_READ_ERROR)
+		return -EIO;
+
+	return sta >> SMAP_E3_PHY_DATA_SHIFT;
+}
+
+static int smap_phy_write(u32 reg, u16 value)
+{
+	const int err = smap_sta_wait();
+	if (err < 0)
+		return err;
+
+	smap_wr_emac3((value << SMAP_E3_PHY_DATA_SHIFT) | SMAP_E3_PHY_WRITE |
+		(SMAP_PHY_ADDR << SMAP_E3_PHY_ADDR_SHIFT) | reg,
+		SMAP_REG_EMAC3_STA_CTRL);
+
+	return smap_sta_wait();
+}
+
+/* Reset the PHY and restart autonegotiation, advertising all modes. */
+static int smap_phy_reset(void)
+{
+	int err = smap_phy_write(SMAP_MII_BMCR, SMAP_BMCR_RESET);
+	if (err < 0)
+		return err;
+
+	int bmcr = SMAP_BMCR_RESET;
+	for (int i = 0; i < SMAP_PHY_RESET_TRIES &&
+			(bmcr & SMAP_BMCR_RESET); i++) {
+		thbase_delay(SMAP_PHY_RESET_US);
+
+		bmcr = smap_phy_read(SMAP_MII_BMCR);
+		if (bmcr < 0)
+			return bmcr;
+	}
+	if (bmcr & SMAP_BMCR_RESET)
+		return -EIO;
+
+	err = smap_phy_write(SMAP_MII_ADVERTISE,
+		SMAP_LPA_100FULL | SMAP_LPA_100HALF |
+		SMAP_LPA_10FULL | SMAP_LPA_10HALF | SMAP_ADVERTISE_CSMA);
+	if (err < 0)
+		return err;
+
+	return smap_phy_write(SMAP_MII_BMCR,
+		SMAP_BMCR_ANENABLE | SMAP_BMCR_ANRESTART);
+}
+
+static void smap_link_up(struct smap_dev *dev)
+{
+	const int lpa = smap_phy_read(SMAP_MII_LPA);
+	if (lpa < 0)
+		return;		/* Retried at the next poll. */
+
+	/* All modes are advertised, so the best of the partner's is used. */
+	const bool speed100 = lpa & (SMAP_LPA_100FULL | SMAP_LPA_100HALF);
+	const bool fdx = lpa & (speed100 ? SMAP_LPA_100FULL : SMAP_LPA_10FULL);
+	const u32 mode1 = smap_rd_emac3(SMAP_REG_EMAC3_MODE1) &
+		~(SMAP_E3_FDX_ENABLE | SMAP_E3_MEDIA_100M);
+
+	smap_wr_emac3(mode1 | (fdx ? SMAP_E3_FDX_ENABLE : 0) |
+		(speed100 ? SMAP_E3_MEDIA_100M : 0), SMAP_REG_EMAC3_MODE1);
+	smap_wr_emac3(SMAP_E3_TXMAC_ENABLE | SMAP_E3_RXMAC_ENABLE,
+		SMAP_REG_EMAC3_MODE0);
+
+	dev->up.link = true;
+
+	pr_info("smap: link up %u Mbit/s %s duplex\n",
+		speed100 ? 100 : 10, fdx ? "full" : "half");
+}
+
+static void smap_link_down(struct smap_dev *dev)
+{
+	smap_wr_emac3(0, SMAP_REG_EMAC3_MODE0);
+
+	dev->up.link = false;
+
+	pr_info("smap: link down\n");
+}
+
+static void smap_link_poll(struct smap_dev *dev)
+{
+	const int err = mod_timer(&dev->up.link_timer,
+		timer_jiffies() + us_to_jiffies(SMAP_LINK_POLL_US));
+
+	if (err < 0)
+		pr_err("%s: mod_timer failed with %d\n", __func__, err);
+}
+
+static void smap_link_timer(struct timer_list *timer)
+{
+	struct smap_dev *dev =
+		container_of(timer, struct smap_dev, up.link_timer);
+
+	smap_queue_work(dev, SMAP_WORK_LINK);
+}
+
+static void smap_link_work(struct smap_dev *dev)
+{
+	if (!dev->up.enabled)
+		return;
+
+	const int bmsr = smap_phy_read(SMAP_MII_BMSR);
+	const bool link = bmsr >= 0 && (bmsr & SMAP_BMSR_LSTATUS) &&
+			  (bmsr & SMAP_BMSR_ANEGCOMPLETE);
+
+	if (link && !dev->up.link)
+		smap_link_up(dev);
+	else if (!link && dev->up.link)
+		smap_link_down(dev);
+
+	smap_link_poll(dev);
+}
+
+static void smap_eeprom_wr(u8 pins)
+{
+	iowr8(pins, SPD_REG(SPD_REG_PIO_DATA));
+	thbase_delay(SMAP_EEPROM_DELAY_US);
+}
+
+static bool smap_eeprom_bit(bool din)
+{
+	const u8 pins = SPD_PIO_CSEL | (din ? SPD_PIO_DIN : 0);
+
+	smap_eeprom_wr(pins);
+	smap_eeprom_wr(pins | SPD_PIO_SCLK);
+	const bool dout = iord8(SPD_REG(SPD_REG_PIO_DATA)) & SPD_PIO_DOUT;
+	smap_eeprom_wr(pins);
+
+	return dout;
+}
+
+static u16 smap_eeprom_read_word(u32 addr)
+{
+	u16 word = 0;
+
+	smap_eeprom_wr(SPD_PIO_CSEL);
+
+	smap_eeprom_bit(true);		/* Start bit */
+	for (int i = 1; i >= 0; i--)
+		smap_eeprom_bit((SMAP_EEPROM_OP_READ >> i) & 1);
+	for (int i = SMAP_EEPROM_ADDR_BITS - 1; i >= 0; i--)
+		smap_eeprom_bit((addr >> i) & 1);
+
+	/* The dummy zero bit is given with the last address bit. */
+	for (int i = 0; i < 16; i++)
+		word = (word << 1) | smap_eeprom_bit(false);
+
+	smap_eeprom_wr(0);
+
+	return word;
+}
+
+/* The MAC address words are followed by their 16-bit sum. */
+static int smap_eeprom_read_mac(struct smap_sif_mac *mac)
+{
+	u16 word[SMAP_EEPROM_MAC_WORDS + 1];
+	u16 sum = 0;
+
+	iowr8(SPD_PIO_CSEL | SPD_PIO_SCLK | SPD_PIO_DIN,
+		SPD_REG(SPD_REG_PIO_DIR));
+	smap_eeprom_wr(0);
+
+	for (int i = 0; i < ARRAY_SIZE(word); i++)
+		word[i] = smap_eeprom_read_word(i);
+
+	for (int i = 0; i < SMAP_EEPROM_MAC_WORDS; i++) {
+		mac->addr[2 * i] = word[i] & 0xff;
+		mac->addr[2 * i + 1] = word[i] >> 8;
+		sum += word[i];
+	}
+
+	if (sum != word[SMAP_EEPROM_MAC_WORDS] ||
+	    !(word[0] | word[1] | word[2])) {
+		pr_err("%s: Invalid EEPROM MAC address\n", __func__);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static bool smap_zero_mac(const struct smap_sif_mac *mac)
+{
+	for (int i = 0; i < ARRAY_SIZE(mac->addr); i++)
+		if (mac->addr[i])
+			return false;
+
+	return true;
+}
+
+static void smap_down(struct smap_dev *dev)
+{
+	del_timer(&dev->up.link_timer);
+
+	smap_wr_emac3(0, SMAP_REG_EMAC3_MODE0);
+
+	release_irq(IRQ_IOP_SPD_RXEND, smap_rx_thread, dev);
+	release_irq(IRQ_IOP_SPD_TXEND, smap_txend_irq, dev);
+
+	dev9_release();
+
+	dev->up.enabled = false;
+	dev->up.link = false;
+
+	pr_info("smap: down\n");
+}
+
+static int smap_up(struct smap_dev *dev)
+{
+	const u8 *a = dev->up.mac.addr;
+
+	int err = dev9_request();
+	if (err < 0) {
+		pr_err("%s: dev9_request failed with %d\n", __func__, err);
+		return err;
+	}
+
+	if (smap_zero_mac(&dev->up.mac)) {
+		err = smap_eeprom_read_mac(&dev->up.mac);
+		if (err < 0)
+			goto err_eeprom;
+	}
+
+	err = smap_reset();
+	if (err < 0) {
+		pr_err("%s: smap_reset failed with %d\n", __func__, err);
+		goto err_reset;
+	}
+
+	err = smap_phy_reset();
+	if (err < 0) {
+		pr_err("%s: smap_phy_reset failed with %d\n", __func__, err);
+		goto err_phy_reset;
+	}
+
+	dev->rx.bd = 0;
+	dev->rx.irq_frames = 0;
+	dev->tx.bd = 0;
+	dev->tx.done = 0;
+	dev->tx.inflight = 0;
+	dev->tx.ptr = 0;
+	dev->tx.free = SMAP_TX_BUFSIZE;
+
+	err = request_irq(IRQ_IOP_SPD_TXEND, smap_txend_irq, dev);
+	if (err < 0) {
+		pr_err("%s: request_irq for IRQ_IOP_SPD_TXEND failed with %d\n",
+			__func__, err);
+		goto err_request_txend;
+	}
+
+	err = request_threaded_irq(IRQ_IOP_SPD_RXEND,
+		smap_rxend_irq, smap_rx_thread, dev);
+	if (err < 0) {
+		pr_err("%s: request_threaded_irq for IRQ_IOP_SPD_RXEND failed with %d\n",
+			__func__, err);
+		goto err_request_rxend;
+	}
+
+	smap_wr_emac3((a[0] << 8) | a[1], SMAP_REG_EMAC3_ADDR_HI);
+	smap_wr_emac3((a[2] << 24) | (a[3] << 16) | (a[4] << 8) | a[5],
+		SMAP_REG_EMAC3_ADDR_LO);
+
+	dev->up.enabled = true;
+
+	pr_info("smap: up with MAC %02x:%02x:%02x:%02x:%02x:%02x\n",
+		a[0], a[1], a[2], a[3], a[4], a[5]);
+
+	/* The MACs are enabled once autonegotiation has completed. */
+	smap_link_poll(dev);
+
+	return 0;
+
+err_request_rxend:
+	release_irq(IRQ_IOP_SPD_TXEND, smap_txend_irq, dev);
+
+err_request_txend:
+err_phy_reset:
+err_reset:
+err_eeprom:
+	dev9_release();
+
+	return err;
+}
+
+static void smap_up_work(struct smap_dev *dev)
+{
+	/* A new MAC address takes a reset, as if the interface was down. */
+	if (dev->up.enabled)
+		smap_down(dev);
+
+	smap_sif_cmd_mac_ack(dev, smap_up(dev));
+}
+
+static void smap_down_work(struct smap_dev *dev)
+{
+	if (dev->up.enabled)
+		smap_down(dev);
+}
+
+/* Requests are done in the order they were given, as far as it matters. */
+static void smap_work(struct work_struct *work)
+{
+	struct smap_dev *dev = container_of(work, struct smap_dev, work);
+	unsigned int flags;
+
+	irq_save(flags);
+
+	const u32 events = dev->events;
+	dev->events = 0;
+
+	irq_restore(flags);
+
+	if (events & SMAP_WORK_UP)
+		smap_up_work(dev);
+	if (events & SMAP_WORK_DOWN)
+		smap_down_work(dev);
+	if (events & SMAP_WORK_LINK)
+		smap_link_work(dev);
+	if (events & SMAP_WORK_TX)
+		smap_tx_work(dev);
+}
+
+static enum module_init_status smap_init(int argc, char *argv[])
+{
+	static struct smap_dev dev = {
+		.tx.free = SMAP_TX_BUFSIZE,
+	};
+
+	BUILD_BUG_ON(sizeof(union smap_sif_opt) != sizeof(u32));
+	BUILD_BUG_ON(sizeof(struct smap_sif_rx) > CMD_PACKET_PAYLOAD_MAX);
+	BUILD_BUG_ON(sizeof(struct smap_sif_tx) > CMD_PACKET_PAYLOAD_MAX);
+	BUILD_BUG_ON(sizeof(struct smap_sif_stat) > CMD_PACKET_PAYLOAD_MAX);
+	BUILD_BUG_ON(sizeof(struct smap_sif_mac_ack) != 12);
+	BUILD_BUG_ON(sizeof(struct smap_bd) != 8);
+
+	const struct iop_sema tx_sema = { .initial = 0, .max = 1 };
+	dev.tx.sema_id = thsemap_create_sema(&tx_sema);
+	if (dev.tx.sema_id < 0) {
+		pr_err("%s: thsemap_create_sema failed with %d: %s\n",
+			__func__, dev.tx.sema_id,
+			iop_error_message(dev.tx.sema_id));
+		return MODULE_EXIT;
+	}
+
+	INIT_WORK(&dev.work, smap_work);
+	timer_setup(&dev.tx.timeout, smap_tx_timeout);
+	timer_setup(&dev.up.link_timer, smap_link_timer);
+
+	sif_request_cmd(SIF_CMD_SMAP, smap_sif_cmd, &dev);
+
+	pr_info("smap: ready\n");
+
+	return MODULE_RESIDENT;
+}
+module_init(smap_init);
@@ -0,0 +1,424 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Timer wheel driven by a single system alarm
+ *
+ * Timers are kept on a hierarchical timer wheel, as in older Linux kernels,
+ * with O(1) insert and cancel. The first level has a slot for each of the
+ * next 64 jiffies. Each of the following levels has slots for 64 times
+ * longer periods, whose timers are cascaded down one level when the level
+ * below wraps around. Timers further into the future than the last level
+ * covers, about 4.6 hours, expire when it ends.
+ *
+ * Jiffies follow the system clock. A single system alarm is programmed for
+ * the next jiffy when a timer expires, or a slot of a higher level is
+ * cascaded, as found from the lowest occupied slot of each level. The alarm
+ * then advances the wheel to the current jiffy, skipping empty jiffies, so
+ * the IOP is not interrupted every jiffy while timers are pending. Timer
+ * functions are called back in the interrupt context of the alarm, and can
+ * rearm their timers for periodic operation.
+ *
+ * Copyright (C) 2021 Fredrik Noring
+ */
+
+#include "iopmod/compare.h"
+#include "iopmod/errno.h"
+#include "iopmod/interrupt.h"
+#include "iopmod/iop-error.h"
+#include "iopmod/module.h"
+#include "iopmod/printk.h"
+#include "iopmod/thread.h"
+#include "iopmod/timer.h"
+
+#include "iopmod/asm/macro.h"
+
+#define TIMER_LEVELS	4
+#define TIMER_BITS	6
+#define TIMER_SLOTS	(1 << TIMER_BITS)
+#define TIMER_MASK	(TIMER_SLOTS - 1)
+#define TIMER_MAX	((1 << (TIMER_LEVELS * TIMER_BITS)) - 1)
+
+/* Alarms are at most this many jiffies apart, to fit 32-bit cycle counts. */
+#define ALARM_MAX_JIFFIES	(1 << (2 * TIMER_BITS))
+/* Shorter alarms are lengthened, so that they are not due before being set. */
+#define ALARM_MIN_CYCLES	200
+
+/**
+ * struct timer_base - the timer wheel
+ * @wheel: lists of timers by level and slot
+ * @jiffies: jiffy of the next slot to expire on the first level
+ * @period: jiffy period in system clock cycles
+ * @epoch: system clock at jiffy zero
+ * @alarm: system clock when the alarm is due, if it is running
+ * @count: number of pending timers
+ * @running: %true if the alarm is running
+ * @in_alarm: %true while the alarm advances the wheel
+ */
+static struct timer_base {
+	struct timer_list *wheel[TIMER_LEVELS][TIMER_SLOTS];
+	u32 jiffies;
+	u32 period;
+	u64 epoch;
+	u64 alarm;
+	u32 count;
+	bool running;
+	bool in_alarm;
+} base;
+
+static bool time_after(u32 a, u32 b)
+{
+	return (s32)(b - a) < 0;
+}
+
+static u64 system_time(void)
+{
+	struct iop_sys_clock clock;
+
+	thbase_get_system_time(&clock);
+
+	return (u64)clock.hi << 32 | clock.lo;
+}
+
+static u32 clock_jiffies(u64 clock)
+{
+	return (clock - base.epoch) / base.period;
+}
+
+static void enqueue_timer(struct timer_list **slot, struct timer_list *timer)
+{
+	timer->next = *slot;
+	if (timer->next)
+		timer->next->pprev = &timer->next;
+	timer->pprev = slot;
+	*slot = timer;
+}
+
+static void dequeue_timer(struct timer_list *timer)
+{
+	*timer->pprev = timer->next;
+	if (timer->next)
+		timer->next->pprev = timer->pprev;
+	timer->next = NULL;
+	timer->pprev = NULL;
+}
+
+static void internal_add_timer(struct timer_list *timer)
+{
+	u32 delta = timer->expires - base.jiffies;
+	int level;
+
+	if ((s32)delta < 0) {
+		/* Already expired, so expire on the next tick. */
+		timer->expires = base.jiffies;
+		delta = 0;
+	} else if (delta > TIMER_MAX) {
+		timer->expires = base.jiffies + TIMER_MAX;
+		delta = TIMER_MAX;
+	}
+
+	for (level = 0; level < TIMER_LEVELS - 1; level++)
+		if (delta < 1 << ((level + 1) * TIMER_BITS))
+			break;
+
+	enqueue_timer(&base.wheel[level][
+		(timer->expires >> (level * TIMER_BITS)) & TIMER_MASK], timer);
+}
+
+/* Move the timers of a slot down one level. Return the slot index. */
+static int cascade(int level)
+{
+	const int index = (base.jiffies >> (level * TIMER_BITS)) & TIMER_MASK;
+	struct timer_list *timer = base.wheel[level][index];
+
+	base.wheel[level][index] = NULL;
+
+	while (timer) {
+		struct timer_list *next = timer->next;
+
+		internal_add_timer(timer);
+		timer = next;
+	}
+
+	return index;
+}
+
+static void run_timers(void)
+{
+	const int index = base.jiffies & TIMER_MASK;
+	struct timer_list *head;
+
+	if (!index)
+		for (int level = 1; level < TIMER_LEVELS; level++)
+			if (cascade(level))
+				break;
+
+	head = base.wheel[0][index];
+	base.wheel[0][index] = NULL;
+	if (head)
+		head->pprev = &head;
+
+	base.jiffies++;
+
+	/* Timer functions may modify or delete any timer, including these. */
+	while (head) {
+		struct timer_list *timer = head;
+
+		dequeue_timer(timer);
+		base.count--;
+
+		timer->function(timer);
+	}
+}
+
+/*
+ * Find the next jiffy when a timer expires, or a slot of a higher level is
+ * cascaded, scanning each level from its current slot to the first occupied
+ * one. The current slot of a higher level is cascaded when the level wraps
+ * around, so scanning continues past it. Return %false if the wheel is empty.
+ */
+static bool next_event(u32 *next)
+{
+	bool found = false;
+
+	for (int level = 0; level < TIMER_LEVELS; level++) {
+		const int shift = level * TIMER_BITS;
+		const u32 span = TIMER_SLOTS << shift;
+		const int index = (base.jiffies >> shift) & TIMER_MASK;
+
+		for (int i = 0; i < TIMER_SLOTS; i++) {
+			const int slot = (index + i) & TIMER_MASK;
+			u32 j = (base.jiffies & ~(span - 1)) | (slot << shift);
+
+			if (!base.wheel[level][slot])
+				continue;
+
+			const bool wrapped = time_after(base.jiffies, j);
+			if (wrapped)
+				j += span;
+
+			if (!found || time_after(*next, j))
+				*next = j;
+			found = true;
+
+			if (!wrapped)
+				break;
+		}
+	}
+
+	return found;
+}
+
+/* Run the timers of all jiffies up to and including @now. */
+static void advance_wheel(u32 now)
+{
+	while (!time_after(base.jiffies, now)) {
+		u32 next;
+
+		if (!next_event(&next) || time_after(next, now)) {
+			base.jiffies = now + 1;
+			break;
+		}
+
+		/* Jiffies in between have empty slots only. */
+		base.jiffies = next;
+		run_timers();
+	}
+}
+
+/*
+ * Move the wheel to @now without running timers, if there are none due, to
+ * keep expiries relative to the wheel within %TIMER_MAX.
+ */
+static void forward_wheel(u32 now)
+{
+	u32 next;
+
+	if (time_after(now, base.jiffies) &&
+	    (!next_event(&next) || time_after(next, now)))
+		base.jiffies = now;
+}
+
+/* System clock when the alarm is to be due, given the clock now. */
+static u64 alarm_clock(u64 clock)
+{
+	const u64 elapsed = clock - base.epoch;
+	const u32 now = elapsed / base.period;
+	u32 next;
+
+	if (!next_event(&next) || !time_after(next, now))
+		return clock + ALARM_MIN_CYCLES;
+
+	const u32 delta = min_t(u32, next - now, ALARM_MAX_JIFFIES);
+	const u64 due = base.epoch +
+		(elapsed - elapsed % base.period) + (u64)delta * base.period;
+
+	return max_t(u64, due, clock + ALARM_MIN_CYCLES);
+}
+
+/*
+ * The alarm is rearmed with the number of cycles returned, counted from
+ * when it was due.
+ */
+static unsigned int timer_alarm(void *arg)
+{
+	const u64 clock = system_time();
+
+	base.in_alarm = true;
+	advance_wheel(clock_jiffies(clock));
+	base.in_alarm = false;
+
+	if (!base.count) {
+		base.running = false;
+		return 0;	/* Stop the alarm until a timer is added. */
+	}
+
+	const u64 due = alarm_clock(clock);
+	const u32 cycles = due - base.alarm;
+
+	base.alarm = due;
+
+	return cycles;
+}
+
+/*
+ * Program the alarm for the next event, unless it is due earlier already.
+ * Interrupts are to be disabled. Timer functions rearming timers need not
+ * program the alarm, since it is programmed once they have returned.
+ */
+static int program_alarm(u64 clock)
+{
+	if (base.in_alarm)
+		return 0;
+
+	const u64 due = alarm_clock(clock);
+
+	if (base.running) {
+		if (base.alarm <= due)
+			return 0;
+
+		const int ioperr = in_irq() ?
+			thbase_icancel_alarm(timer_alarm, NULL) :
+			thbase_cancel_alarm(timer_alarm, NULL);
+		if (ioperr < 0) {
+			pr_err("%s: thbase_cancel_alarm failed with %d: %s\n",
+				__func__, ioperr, iop_error_message(ioperr));
+			return errno_for_iop_error(ioperr);
+		}
+
+		base.running = false;
+	}
+
+	struct iop_sys_clock delay = { .lo = due - clock };
+
+	const int ioperr = in_irq() ?
+		thbase_iset_alarm(&delay, timer_alarm, NULL) :
+		thbase_set_alarm(&delay, timer_alarm, NULL);
+	if (ioperr < 0) {
+		pr_err("%s: thbase_set_alarm failed with %d: %s\n",
+			__func__, ioperr, iop_error_message(ioperr));
+		return errno_for_iop_error(ioperr);
+	}
+
+	base.alarm = due;
+	base.running = true;
+
+	return 0;
+}
+
+/**
+ * mod_timer - modify a timer's expiry
+ * @timer: timer to modify, initialised with timer_setup()
+ * @expires: jiffy when the timer expires
+ *
+ * The timer is added if it is not pending. An expiry that has already
+ * passed expires on the next tick. A periodic timer can be rearmed by its
+ * function with @expires incremented by the period, to avoid drift.
+ *
+ * Context: any
+ * Return: 1 if @timer was pending, 0 if not, or negative errno on error
+ */
+int mod_timer(struct timer_list *timer, u32 expires)
+{
+	unsigned int flags;
+	int pending;
+
+	irq_save(flags);
+
+	const u64 clock = system_time();
+
+	pending = timer_pending(timer);
+	if (pending)
+		dequeue_timer(timer);
+	else
+		base.count++;
+
+	if (!base.in_alarm)
+		forward_wheel(clock_jiffies(clock));
+
+	timer->expires = expires;
+	internal_add_timer(timer);
+
+	const int err = program_alarm(clock);
+	if (err < 0) {
+		dequeue_timer(timer);
+		base.count--;
+	}
+
+	irq_restore(flags);
+
+	return err < 0 ? err : pending;
+}
+
+/**
+ * del_timer - deactivate a timer
+ * @timer: timer to deactivate
+ *
+ * A timer function that is running is not waited for.
+ *
+ * Context: any
+ * Return: 1 if @timer was pending, 0 otherwise
+ */
+int del_timer(struct timer_list *timer)
+{
+	unsigned int flags;
+	int pending;
+
+	irq_save(flags);
+
+	pending = timer_pending(timer);
+	if (pending) {
+		dequeue_timer(timer);
+		base.count--;
+	}
+
+	irq_restore(flags);
+
+	/* The alarm stops by itself once it finds no timers. */
+	return pending;
+}
+
+/**
+ * timer_jiffies - current jiffy
+ *
+ * Jiffies count ticks of %TIMER_TICK_US microseconds of the system clock,
+ * since the timer module was initialised. Expiries are to be given relative
+ * to this function, for example timer_jiffies() + us_to_jiffies(5000).
+ *
+ * Context: any
+ * Return: current jiffy
+ */
+u32 timer_jiffies(void)
+{
+	return clock_jiffies(system_time());
+}
+
+static enum module_init_status timer_init(int argc, char *argv[])
+{
+	struct iop_sys_clock period;
+
+	thbase_us_to_sys_clock(TIMER_TICK_US, &period);
+	base.period = period.lo;
+	base.epoch = system_time();
+
+	return MODULE_RESIDENT;
+}
+module_init(timer_init);
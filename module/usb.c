@@ -0,0 +1,318 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * USB OHCI done queue offload
+ *
+ * The main processor drives the OHCI host controller, but its interrupts
+ * are raised on the IOP. Relaying every completion costs a main interrupt
+ * followed by SIF round trips to read the done queue from IOP memory.
+ *
+ * Instead, this module services the writeback of the done head on the IOP.
+ * The interrupt handler takes the done head, and a threaded handler walks
+ * the done queue and reports the completed transfer descriptors to the
+ * main processor in order of completion, in batches of up to
+ * %MAX_USB_SIF_DONE with one SIF command each. Other interrupt causes,
+ * such as root hub status changes, are left pending for the next handler
+ * of the line, normally irqrelay.
+ *
+ * The main processor enables the offload once it has set up the host
+ * controller communications area and requested the relay of %IRQ_IOP_USB,
+ * since the most recently requested handler of a line is called first.
+ *
+ * Copyright (C) 2021 Fredrik Noring
+ */
+
+#include "iopmod/build-bug.h"
+#include "iopmod/compare.h"
+#include "iopmod/errno.h"
+#include "iopmod/interrupt.h"
+#include "iopmod/io.h"
+#include "iopmod/irq.h"
+#include "iopmod/module.h"
+#include "iopmod/ohci.h"
+#include "iopmod/printk.h"
+#include "iopmod/sif.h"
+#include "iopmod/sifcmd.h"
+#include "iopmod/workqueue.h"
+
+#include "iopmod/asm/macro.h"
+
+#define USB_DONE_MAX	1024	/* Guard against a corrupt done queue. */
+
+#define MAX_USB_SIF_DONE (CMD_PACKET_PAYLOAD_MAX / sizeof(u32))
+
+/**
+ * enum iop_usb_rops - IOP USB remote operations
+ * @rop_enable: Enable the offload, acknowledged with a status
+ * @rop_disable: Disable the offload, acknowledged with a status
+ * @rop_done: Completed transfer descriptors
+ * @rop_stat: Request and report done queue statistics
+ */
+enum iop_usb_rops {
+	rop_enable  = 0,
+	rop_disable = 1,
+	rop_done    = 2,
+	rop_stat    = 3,
+};
+
+union usb_sif_opt {
+	u32 raw;
+	struct {
+		u32 op : 3;
+		u32 count : 8;
+		u32 truncated : 1;
+		u32 : 20;
+	};
+};
+
+/**
+ * struct usb_sif_ack - enable or disable completion
+ * @status: 0 on success, otherwise a negative error number
+ */
+struct usb_sif_ack {
+	s32 status;
+};
+
+/**
+ * struct usb_sif_done - completed transfer descriptors
+ * @td: IOP addresses of the transfer descriptors, in order of completion
+ *
+ * The number of transfer descriptors is given by the count of
+ * &union usb_sif_opt. Descriptors of one done queue writeback may be split
+ * into several consecutive commands.
+ *
+ * A done queue longer than %USB_DONE_MAX, which is most likely corrupt, is
+ * truncated to its %USB_DONE_MAX most recent descriptors. The last command
+ * of the writeback then has the truncated bit of &union usb_sif_opt set,
+ * and the main processor must recover the older descriptors itself, for
+ * example by resetting the host controller.
+ */
+struct usb_sif_done {
+	u32 td[MAX_USB_SIF_DONE];
+};
+
+/**
+ * struct usb_sif_stat - done queue statistics
+ * @writebacks: number of done queue writebacks, one per interrupt
+ * @tds: number of completed transfer descriptors
+ * @cmds: number of SIF commands sent with completed transfer descriptors
+ * @max_tds: largest number of transfer descriptors in a writeback
+ * @truncated: number of writebacks truncated to %USB_DONE_MAX descriptors
+ */
+struct usb_sif_stat {
+	u32 writebacks;
+	u32 tds;
+	u32 cmds;
+	u32 max_tds;
+	u32 truncated;
+};
+
+/**
+ * struct usb_dev - USB OHCI done queue offload
+ * @op: requested operation, either @rop_enable or @rop_disable
+ * @work: work requesting or releasing the interrupt handler
+ * @enabled: %true if the interrupt handler is requested
+ * @head: done head taken by the interrupt handler for the thread
+ * @td: done queue, from the most recently completed transfer descriptor
+ * @stat: done queue statistics
+ */
+struct usb_dev {
+	unsigned int op;
+	struct work_struct work;
+	bool enabled;
+
+	u32 head;
+	u32 td[USB_DONE_MAX];
+
+	struct usb_sif_stat stat;
+};
+
+static const struct ohci_td *usb_td(u32 addr)
+{
+	return (const struct ohci_td *)(addr & OHCI_DONE_HEAD_MASK);
+}
+
+/*
+ * The done queue is linked from the most recently completed transfer
+ * descriptor, so it is walked once and then sent from the oldest end.
+ */
+static void usb_report_done(struct usb_dev *dev, u32 head)
+{
+	bool truncated = false;
+	size_t count = 0;
+
+	for (u32 td = head; td; td = usb_td(td)->next & OHCI_DONE_HEAD_MASK) {
+		if (count == ARRAY_SIZE(dev->td)) {
+			truncated = true;
+			break;
+		}
+
+		dev->td[count++] = td;
+	}
+
+	if (truncated) {
+		pr_err("%s: Done queue truncated to %d descriptors\n",
+			__func__, USB_DONE_MAX);
+		dev->stat.truncated++;
+	}
+
+	dev->stat.writebacks++;
+	dev->stat.tds += count;
+	dev->stat.max_tds = max_t(u32, dev->stat.max_tds, count);
+
+	while (count) {
+		const size_t n = min_t(size_t, count, MAX_USB_SIF_DONE);
+		struct usb_sif_done done;
+
+		for (size_t i = 0; i < n; i++)
+			done.td[i] = dev->td[--count];
+
+		const int err = sif_cmd_opt(SIF_CMD_USB,
+			(union usb_sif_opt) {
+				.op = rop_done,
+				.count = n,
+				.truncated = truncated && !count,
+			}.raw,
+			&done, n * sizeof(done.td[0]));
+		if (err < 0)
+			pr_err("%s: sif_cmd_opt failed with %d\n",
+				__func__, err);
+
+		dev->stat.cmds++;
+	}
+}
+
+static enum irq_status usb_irq(void *arg)
+{
+	const u32 status = iord32(OHCI_REG(OHCI_REG_INTR_STATUS)) &
+			   iord32(OHCI_REG(OHCI_REG_INTR_ENABLE));
+	struct usb_dev *dev = arg;
+
+	if (!(status & OHCI_INTR_WDH))
+		return IRQ_NONE;
+
+	struct ohci_hcca *hcca = (struct ohci_hcca *)
+		iord32(OHCI_REG(OHCI_REG_HCCA));
+
+	dev->head = hcca->done_head & OHCI_DONE_HEAD_MASK;
+
+	/* The host controller may write the done head once it is cleared. */
+	hcca->done_head = 0;
+	iowr32(OHCI_INTR_WDH, OHCI_REG(OHCI_REG_INTR_STATUS));
+
+	/* The line is masked until the thread has reported the done queue. */
+	return IRQ_WAKE_THREAD;
+}
+
+static enum irq_status usb_thread(void *arg)
+{
+	struct usb_dev *dev = arg;
+
+	usb_report_done(dev, dev->head);
+
+	/*
+	 * The interrupt controller latches edges, so causes pending since
+	 * the interrupt, such as a root hub status change for the next
+	 * handler of the line or another writeback, would not interrupt again
+	 * once the line is unmasked. Toggling the master interrupt enable
+	 * raises the line again for them.
+	 */
+	const u32 enable = iord32(OHCI_REG(OHCI_REG_INTR_ENABLE));
+	const u32 status = iord32(OHCI_REG(OHCI_REG_INTR_STATUS)) & enable;
+
+	if ((enable & OHCI_INTR_MIE) && (status & ~OHCI_INTR_MIE)) {
+		iowr32(OHCI_INTR_MIE, OHCI_REG(OHCI_REG_INTR_DISABLE));
+		iowr32(OHCI_INTR_MIE, OHCI_REG(OHCI_REG_INTR_ENABLE));
+	}
+
+	return IRQ_HANDLED;
+}
+
+static void usb_sif_cmd_ack(unsigned int op, s32 status)
+{
+	const struct usb_sif_ack ack = { .status = status };
+	int err = sif_cmd_opt(SIF_CMD_USB,
+		(union usb_sif_opt) { .op = op }.raw,
+		&ack, sizeof(ack));
+
+	if (err < 0)
+		pr_err("%s: sif_cmd_opt failed with %d\n", __func__, err);
+}
+
+static void usb_work(struct work_struct *work)
+{
+	struct usb_dev *dev = container_of(work, struct usb_dev, work);
+	int err = 0;
+
+	if (dev->op == rop_enable && !dev->enabled) {
+		err = request_threaded_irq(IRQ_IOP_USB,
+			usb_irq, usb_thread, dev);
+		if (err < 0)
+			pr_err("%s: request_threaded_irq failed with %d\n",
+				__func__, err);
+		else
+			dev->enabled = true;
+	} else if (dev->op == rop_disable && dev->enabled) {
+		err = release_irq(IRQ_IOP_USB, usb_thread, dev);
+		if (err < 0)
+			pr_err("%s: release_irq failed with %d\n",
+				__func__, err);
+		else
+			dev->enabled = false;
+	}
+
+	usb_sif_cmd_ack(dev->op, err);
+}
+
+static void usb_sif_cmd_stat(struct usb_dev *dev)
+{
+	int err = sif_cmd_opt(SIF_CMD_USB,
+		(union usb_sif_opt) { .op = rop_stat }.raw,
+		&dev->stat, sizeof(dev->stat));
+
+	if (err < 0)
+		pr_err("%s: sif_cmd_opt failed with %d\n", __func__, err);
+}
+
+static void usb_sif_cmd(const struct sif_cmd_header *header, void *arg)
+{
+	const union usb_sif_opt opt = { .raw = header->opt };
+	struct usb_dev *dev = arg;
+
+	switch (opt.op)
+	{
+	case rop_enable:
+	case rop_disable:
+		/* Interrupt handlers are requested and released in a thread. */
+		if (dev->work.pending) {
+			usb_sif_cmd_ack(opt.op, -EBUSY);
+			break;
+		}
+
+		dev->op = opt.op;
+		queue_work(WQ_NORMAL, &dev->work);
+		break;
+	case rop_stat:
+		usb_sif_cmd_stat(dev);
+		break;
+	default:
+		pr_err("%s: Unknown op %d\n", __func__, opt.op);
+	}
+}
+
+static enum module_init_status usb_init(int argc, char *argv[])
+{
+	static struct usb_dev dev;
+
+	BUILD_BUG_ON(sizeof(union usb_sif_opt) != sizeof(u32));
+	BUILD_BUG_ON(sizeof(struct usb_sif_done) > CMD_PACKET_PAYLOAD_MAX);
+	BUILD_BUG_ON(sizeof(struct ohci_hcca) != 256);
+
+	INIT_WORK(&dev.work, usb_work);
+
+	sif_request_cmd(SIF_CMD_USB, usb_sif_cmd, &dev);
+
+	pr_info("usb: OHCI done queue offload ready\n");
+
+	return MODULE_RESIDENT;
+}
+module_init(usb_init);
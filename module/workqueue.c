@@ -0,0 +1,365 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Shared workqueues for deferred work
+ *
+ * Modules commonly need to do work outside of the interrupt context, for
+ * example transfers that wait for interrupts. Rather than each module having
+ * its own thread and semaphore, work items are queued on one of a few shared
+ * workqueues, whose worker threads have defined priorities. Work can be
+ * queued from any context, optionally after a delay on the timer wheel.
+ *
+ * Each workqueue has two workers, so one work item that sleeps does not
+ * delay later work on the same workqueue. Workers skip queued work items
+ * whose functions are running in the other worker, so that work items are
+ * never reentered. Such work is deferred until the function returns.
+ *
+ * Copyright (C) 2021 Fredrik Noring
+ */
+
+#include "iopmod/errno.h"
+#include "iopmod/interrupt.h"
+#include "iopmod/iop-error.h"
+#include "iopmod/module.h"
+#include "iopmod/printk.h"
+#include "iopmod/thread.h"
+#include "iopmod/timer.h"
+#include "iopmod/workqueue.h"
+
+#include "iopmod/asm/macro.h"
+
+#define WQ_WORKER_STACKSIZE 1024
+#define WQ_SEMA_MAX 0x7fffffff
+
+/**
+ * struct workqueue - queue of work items and its worker threads
+ * @head: first work item to run, or %NULL if empty
+ * @tail: link to the last work item, or to @head if empty
+ * @deferred: number of signals taken for work items that were running
+ * @priority: priority of the worker threads
+ * @thid: worker thread ids
+ * @sema_id: semaphore signalled once for each queued work item
+ */
+struct workqueue {
+	struct work_struct *head;
+	struct work_struct **tail;
+	u32 deferred;
+	u32 priority;
+	int thid[WQ_WORKERS];
+	int sema_id;
+};
+
+static struct workqueue workqueues[WQ_COUNT] = {
+	[WQ_HIGHPRI] = { .priority = 0x25 },	/* Below IRQ threads. */
+	[WQ_NORMAL]  = { .priority = 0x28 },
+};
+
+static void signal_worker(struct workqueue *wq)
+{
+	if (in_irq())
+		thsemap_isignal_sema(wq->sema_id);
+	else
+		thsemap_signal_sema(wq->sema_id);
+}
+
+/* The first queued work item that is not running, removed from the queue. */
+static struct work_struct *dequeue_work(struct workqueue *wq)
+{
+	struct work_struct **link;
+
+	for (link = &wq->head; *link; link = &(*link)->next) {
+		struct work_struct *work = *link;
+
+		if (work->running)
+			continue;
+
+		*link = work->next;
+		if (wq->tail == &work->next)
+			wq->tail = link;
+		work->next = NULL;
+		work->pending = false;
+		work->running = true;
+
+		return work;
+	}
+
+	/* Work items left are running, and are signalled again on return. */
+	if (wq->head)
+		wq->deferred++;
+
+	return NULL;
+}
+
+static void worker(void *arg)
+{
+	struct workqueue *wq = arg;
+	unsigned int flags;
+
+	for (;;) {
+		thsemap_wait_sema(wq->sema_id);
+
+		irq_save(flags);
+
+		struct work_struct *work = dequeue_work(wq);
+
+		irq_restore(flags);
+
+		/* Cancelled work leaves the semaphore signalled. */
+		if (!work)
+			continue;
+
+		work->func(work);
+
+		irq_save(flags);
+
+		work->running = false;
+
+		const bool deferred = wq->deferred;
+		if (deferred)
+			wq->deferred--;
+
+		irq_restore(flags);
+
+		if (deferred)
+			thsemap_signal_sema(wq->sema_id);
+	}
+}
+
+/**
+ * queue_work - queue work on a workqueue
+ * @wq: workqueue to queue on, see &enum workqueue_id
+ * @work: work to queue, initialised with INIT_WORK()
+ *
+ * The work is not queued again if it is already pending. It can however be
+ * queued again once its function has started, for example by the function
+ * itself, in which case it runs again once the function has returned.
+ *
+ * Context: any
+ * Return: %true if queued, %false if already pending or @wq is invalid
+ */
+bool queue_work(unsigned int wq, struct work_struct *work)
+{
+	unsigned int flags;
+	bool queued = false;
+
+	if (wq >= ARRAY_SIZE(workqueues))
+		return false;
+
+	irq_save(flags);
+
+	if (!work->pending) {
+		struct workqueue *q = &workqueues[wq];
+
+		work->next = NULL;
+		work->wq = wq;
+		work->pending = true;
+
+		*q->tail = work;
+		q->tail = &work->next;
+
+		queued = true;
+	}
+
+	irq_restore(flags);
+
+	if (queued)
+		signal_worker(&workqueues[wq]);
+
+	return queued;
+}
+
+static void delayed_work_timer(struct timer_list *timer)
+{
+	struct delayed_work *dwork =
+		container_of(timer, struct delayed_work, timer);
+
+	queue_work(dwork->wq, &dwork->work);
+}
+
+/**
+ * queue_delayed_work - queue work on a workqueue after a delay
+ * @wq: workqueue to queue on, see &enum workqueue_id
+ * @dwork: delayed work to queue, initialised with INIT_DELAYED_WORK()
+ * @delay_us: delay in microseconds, or zero to queue immediately
+ *
+ * The delay is rounded up to whole jiffies of the timer wheel, so many
+ * delayed work items share its single system alarm.
+ *
+ * Context: any
+ * Return: %true if queued, %false if already pending or on error
+ */
+bool queue_delayed_work(unsigned int wq,
+	struct delayed_work *dwork, u32 delay_us)
+{
+	unsigned int flags;
+	bool pending;
+	int err = 0;
+
+	if (wq >= ARRAY_SIZE(workqueues))
+		return false;
+
+	if (!delay_us)
+		return queue_work(wq, &dwork->work);
+
+	irq_save(flags);
+
+	pending = timer_pending(&dwork->timer) || dwork->work.pending;
+	if (!pending) {
+		dwork->wq = wq;
+		timer_setup(&dwork->timer, delayed_work_timer);
+		err = mod_timer(&dwork->timer,
+			timer_jiffies() + us_to_jiffies(delay_us));
+	}
+
+	irq_restore(flags);
+
+	if (err < 0)
+		pr_err("%s: mod_timer failed with %d\n", __func__, err);
+
+	return !pending && err >= 0;
+}
+
+/**
+ * cancel_work - cancel pending work
+ * @work: work to cancel
+ *
+ * Work whose function has already started is not waited for.
+ *
+ * Context: any
+ * Return: %true if @work was pending, %false otherwise
+ */
+bool cancel_work(struct work_struct *work)
+{
+	unsigned int flags;
+	bool pending;
+
+	irq_save(flags);
+
+	pending = work->pending;
+	if (pending) {
+		struct workqueue *q = &workqueues[work->wq];
+		struct work_struct **link;
+
+		for (link = &q->head; *link != work; link = &(*link)->next)
+			;
+
+		*link = work->next;
+		if (q->tail == &work->next)
+			q->tail = link;
+
+		work->next = NULL;
+		work->pending = false;
+	}
+
+	irq_restore(flags);
+
+	return pending;
+}
+
+/**
+ * cancel_delayed_work - cancel pending delayed work
+ * @dwork: delayed work to cancel
+ *
+ * The delay is cancelled if it has not yet expired, and the work is
+ * cancelled if it is queued. Work whose function has already started is
+ * not waited for.
+ *
+ * Context: any
+ * Return: %true if @dwork was pending, %false otherwise
+ */
+bool cancel_delayed_work(struct delayed_work *dwork)
+{
+	const bool timer = del_timer(&dwork->timer) > 0;
+
+	/* The delay may have expired and queued the work meanwhile. */
+	return cancel_work(&dwork->work) || timer;
+}
+
+static void delete_workers(struct workqueue *wq, int count)
+{
+	for (int i = 0; i < count; i++) {
+		thbase_terminate(wq->thid[i]);
+		thbase_delete(wq->thid[i]);
+	}
+}
+
+static void delete_workqueue(struct workqueue *wq)
+{
+	delete_workers(wq, ARRAY_SIZE(wq->thid));
+	thsemap_delete_sema(wq->sema_id);
+}
+
+static int create_worker(struct workqueue *wq, int i)
+{
+	const struct iop_thread th = {
+		.attr = THREAD_ATTR_C,
+		.thread = worker,
+		.stacksize = WQ_WORKER_STACKSIZE,
+		.priority = wq->priority,
+	};
+
+	wq->thid[i] = thbase_create(&th);
+	if (wq->thid[i] < 0) {
+		pr_err("%s: thbase_create failed with %d: %s\n",
+			__func__, wq->thid[i], iop_error_message(wq->thid[i]));
+		return errno_for_iop_error(wq->thid[i]);
+	}
+
+	const int ioperr = thbase_start(wq->thid[i], wq);
+	if (ioperr < 0) {
+		pr_err("%s: thbase_start failed with %d: %s\n",
+			__func__, ioperr, iop_error_message(ioperr));
+		thbase_delete(wq->thid[i]);
+		return errno_for_iop_error(ioperr);
+	}
+
+	return 0;
+}
+
+static int create_workqueue(struct workqueue *wq)
+{
+	int err;
+	int i;
+
+	wq->tail = &wq->head;
+
+	const struct iop_sema sema = { .initial = 0, .max = WQ_SEMA_MAX };
+	wq->sema_id = thsemap_create_sema(&sema);
+	if (wq->sema_id < 0) {
+		pr_err("%s: thsemap_create_sema failed with %d: %s\n",
+			__func__, wq->sema_id, iop_error_message(wq->sema_id));
+		err = errno_for_iop_error(wq->sema_id);
+		goto err_sema_create;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(wq->thid); i++) {
+		err = create_worker(wq, i);
+		if (err < 0)
+			goto err_create;
+	}
+
+	return 0;
+
+err_create:
+	delete_workers(wq, i);
+	thsemap_delete_sema(wq->sema_id);
+err_sema_create:
+	return err;
+}
+
+static enum module_init_status workqueue_init(int argc, char *argv[])
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(workqueues); i++)
+		if (create_workqueue(&workqueues[i]) < 0)
+			goto err_create;
+
+	return MODULE_RESIDENT;
+
+err_create:
+	while (i--)
+		delete_workqueue(&workqueues[i]);
+
+	return MODULE_EXIT;
+}
+module_init(workqueue_init);
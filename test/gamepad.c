@@ -0,0 +1,543 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Poll simulated controllers on a simulated SIO2, directly and through
+ * multitaps, and check that all of them are polled with a single command
+ * queue and interrupt per cycle, that they are configured and reported, and
+ * that attach and detach events follow controllers and multitaps as they
+ * are plugged in and out.
+ */
+
+#include "../module/gamepad.c"
+
+#include "iop.h"
+
+#define SIO2_PORTS	4
+#define CYCLES		2000
+
+static struct sim_pad {
+	bool present;
+	bool dualshock;		/* Configurable into pressure mode if set. */
+	bool config;
+	u8 mode;
+	u8 small;
+	u8 large;
+	union controller c;
+} empty_pad;
+
+static struct sim_port {
+	bool multitap;
+	u8 slot;
+	struct sim_pad pad[MULTITAP_SLOTS];
+} sim_ports[SIO2_PORTS];
+
+static struct {
+	u32 cmd[SIO2_CMD_QUEUE_SIZE];
+	u8 tx[SIO2_FIFO_SIZE];
+	u8 rx[SIO2_FIFO_SIZE];
+	size_t tx_size;
+	size_t rx_head;
+	size_t rx_size;
+	u32 irq_stat;
+	int starts;
+	int port_accesses;
+} sio2_sim;
+
+static struct {
+	irq_handler_t handler;
+	irq_handler_t thread_fn;
+} irq;
+
+static sifcmd_handler gamepad_cmd;
+static int sio2_owned;
+static u32 jiffies;
+
+/* Controllers as seen by the main processor. */
+static struct {
+	bool attached;
+	u8 mode;
+	union controller c;
+} seen[SIO2_PAD_PORTS][MULTITAP_SLOTS];
+
+static int attach_events;
+static int detach_events;
+
+static struct sim_port *sim_port(int port)
+{
+	return &sim_ports[sio2_pad_ports[port].port];
+}
+
+static void pad_cmd(struct sim_pad *pad, const u8 *tx, u8 *rx, size_t size)
+{
+	if (!pad->present)
+		return;
+
+	/* Digital controllers answer every command with a poll. */
+	const u8 mode = pad->config ? CONTROLLER_MODE_CONFIG :
+		pad->dualshock ? pad->mode : CONTROLLER_MODE_DIGITAL;
+
+	rx[1] = mode;
+	rx[2] = 0x5a;
+	if (mode != CONTROLLER_MODE_CONFIG)
+		for (size_t i = 0; i < 2 * (mode & 0xf) &&
+				CONTROLLER_HEADER_SIZE + i < size; i++)
+			rx[CONTROLLER_HEADER_SIZE + i] = pad->c.byte[i];
+	else
+		memset(&rx[CONTROLLER_HEADER_SIZE], 0,
+			size - CONTROLLER_HEADER_SIZE);
+
+	switch (tx[1]) {
+	case CONTROLLER_CMD_POLL:
+		pad->small = tx[3];
+		pad->large = tx[4];
+		break;
+	case CONTROLLER_CMD_CONFIG:
+		if (pad->dualshock)
+			pad->config = tx[3] == 0x01;
+		break;
+	case CONTROLLER_CMD_MODE:
+		expect(!pad->dualshock || pad->config);
+		pad->mode = CONTROLLER_MODE_ANALOGUE;
+		break;
+	case CONTROLLER_CMD_RESPONSE:
+		expect(!pad->dualshock || pad->config);
+		pad->mode = CONTROLLER_MODE_PRESSURE;
+		break;
+	case CONTROLLER_CMD_MOTOR:
+		expect(!pad->dualshock || pad->config);
+		break;
+	default:
+		test_fail(__FILE__, __LINE__, "known controller command");
+	}
+}
+
+static void multitap_cmd_sim(struct sim_port *sp, const u8 *tx, u8 *rx)
+{
+	if (!sp->multitap)
+		return;
+
+	rx[1] = 0x80;
+	rx[2] = 0x5a;
+
+	switch (tx[1]) {
+	case MULTITAP_CMD_QUERY:
+		break;
+	case MULTITAP_CMD_SELECT:
+		expect(tx[2] < MULTITAP_SLOTS);
+		sp->slot = tx[2];
+		rx[4] = sp->slot;
+		break;
+	default:
+		test_fail(__FILE__, __LINE__, "known multitap command");
+	}
+}
+
+static void sio2_start(void)
+{
+	size_t offset = 0;
+	int i;
+
+	expect(sio2_owned == 1);
+
+	sio2_sim.starts++;
+	sio2_sim.rx_head = 0;
+	sio2_sim.rx_size = 0;
+
+	for (i = 0; i < SIO2_CMD_QUEUE_SIZE; i++) {
+		struct sio2_cmd cmd;
+
+		memcpy(&cmd, &sio2_sim.cmd[i], sizeof(cmd));
+		if (!cmd.tx_size)
+			break;
+
+		struct sim_port *sp = &sim_ports[cmd.port];
+		const u8 *tx = &sio2_sim.tx[offset];
+		u8 *rx = &sio2_sim.rx[offset];
+
+		expect(cmd.tx_size == cmd.rx_size);
+		expect(offset + cmd.tx_size <= sio2_sim.tx_size);
+
+		memset(rx, 0xff, cmd.rx_size);
+
+		if (tx[0] == 0x21)
+			multitap_cmd_sim(sp, tx, rx);
+		else if (tx[0] == 0x01)
+			pad_cmd(sp->multitap ? &sp->pad[sp->slot] : &sp->pad[0],
+				tx, rx, cmd.rx_size);
+		else
+			test_fail(__FILE__, __LINE__, "known address");
+
+		offset += cmd.tx_size;
+	}
+
+	expect(offset == sio2_sim.tx_size);
+	sio2_sim.rx_size = offset;
+	sio2_sim.tx_size = 0;
+
+	/* The queue completes with a single interrupt. */
+	sio2_sim.irq_stat = 1;
+	expect(irq.handler(NULL) == IRQ_WAKE_THREAD);
+	expect(!sio2_sim.irq_stat);
+	expect(irq.thread_fn(NULL) == IRQ_HANDLED);
+}
+
+static void tx_byte(u8 value)
+{
+	expect(sio2_sim.tx_size < sizeof(sio2_sim.tx));
+
+	sio2_sim.tx[sio2_sim.tx_size++] = value;
+}
+
+static u8 rx_byte(void)
+{
+	expect(sio2_sim.rx_head < sio2_sim.rx_size);
+
+	return sio2_sim.rx[sio2_sim.rx_head++];
+}
+
+static bool fifo_mem(u32 addr)
+{
+	return SIO2_MEM_FIFO_TX <= addr &&
+		addr < SIO2_MEM_FIFO_RX + SIO2_FIFO_SIZE;
+}
+
+void iowr8(u8 value, u32 addr)
+{
+	if (addr == SIO2_REG_TX) {
+		sio2_sim.port_accesses++;
+		tx_byte(value);
+	} else
+		expect(fifo_mem(addr));
+}
+
+void iowr32(u32 value, u32 addr)
+{
+	if (addr >= SIO2_REG_CMD_QUEUE &&
+	    addr < SIO2_REG_CMD_QUEUE + 4 * SIO2_CMD_QUEUE_SIZE) {
+		sio2_sim.cmd[(addr - SIO2_REG_CMD_QUEUE) / 4] = value;
+	} else if (addr == SIO2_REG_TX) {
+		sio2_sim.port_accesses++;
+		for (int i = 0; i < 4; i++)
+			tx_byte(value >> (8 * i));
+	} else if (addr == SIO2_REG_CTRL) {
+		struct sio2_ctrl ctrl;
+
+		memcpy(&ctrl, &value, sizeof(ctrl));
+		if (ctrl.reset_fifo)
+			sio2_sim.tx_size = 0;
+		if (ctrl.start)
+			sio2_start();
+	} else if (addr == SIO2_REG_IRQ_STAT) {
+		sio2_sim.irq_stat &= ~value;
+	} else
+		expect(fifo_mem(addr));
+}
+
+u8 iord8(const u32 addr)
+{
+	expect(addr == SIO2_REG_RX);
+	sio2_sim.port_accesses++;
+
+	return rx_byte();
+}
+
+u32 iord32(const u32 addr)
+{
+	u32 value = 0;
+
+	switch (addr) {
+	case SIO2_REG_IRQ_STAT:
+		return sio2_sim.irq_stat;
+	case SIO2_REG_RX:
+		sio2_sim.port_accesses++;
+		for (int i = 0; i < 4; i++)
+			value |= rx_byte() << (8 * i);
+		return value;
+	default:
+		test_fail(__FILE__, __LINE__, "known SIO2 register");
+	}
+}
+
+int sio2_request(void)
+{
+	expect(!sio2_owned++);
+
+	return 0;
+}
+
+int sio2_try_request(void)
+{
+	return sio2_owned++ ? -EBUSY : 0;
+}
+
+void sio2_release(void)
+{
+	expect(sio2_owned-- == 1);
+}
+
+int request_threaded_irq(unsigned int i, irq_handler_t handler,
+	irq_handler_t thread_fn, void *arg)
+{
+	expect(i == IRQ_IOP_SIO2 && !irq.thread_fn);
+
+	irq.handler = handler;
+	irq.thread_fn = thread_fn;
+
+	return 0;
+}
+
+u32 timer_jiffies(void)
+{
+	return jiffies;
+}
+
+int mod_timer(struct timer_list *timer, u32 expires)
+{
+	expect(timer == &poll.timer);
+
+	timer->expires = expires;
+
+	return 0;
+}
+
+void sif_request_cmd(int cid, sifcmd_handler handler, void *arg)
+{
+	expect(cid == SIF_CMD_GAMEPAD);
+
+	gamepad_cmd = handler;
+}
+
+static void sif_event(const struct gamepad_sif_event *event, bool attach)
+{
+	expect(event->port < SIO2_PAD_PORTS && event->slot < MULTITAP_SLOTS);
+
+	typeof(seen[0][0]) *s = &seen[event->port][event->slot];
+
+	expect(s->attached != attach);
+	s->attached = attach;
+	s->mode = event->mode;
+
+	if (attach)
+		attach_events++;
+	else
+		detach_events++;
+}
+
+static void sif_report(const struct gamepad_sif_report *report)
+{
+	expect(report->port < SIO2_PAD_PORTS && report->slot < MULTITAP_SLOTS);
+
+	typeof(seen[0][0]) *s = &seen[report->port][report->slot];
+	int count = 0;
+
+	expect(s->attached);
+	s->mode = report->mode;
+
+	for (int i = 0; i < sizeof(s->c); i++)
+		if (report->changed & BIT(i))
+			s->c.byte[i] = report->byte[count++];
+}
+
+int sif_cmd_opt_data(u32 cmd, u32 opt,
+	const void *payload, size_t payload_size,
+	main_addr_t dst, const void *src, size_t nbytes)
+{
+	const union gamepad_sif_opt o = { .raw = opt };
+
+	expect(cmd == SIF_CMD_GAMEPAD);
+	expect(payload_size <= CMD_PACKET_PAYLOAD_MAX);
+
+	switch (o.op) {
+	case rop_attach:
+	case rop_detach:
+		expect(payload_size == sizeof(struct gamepad_sif_event));
+		sif_event(payload, o.op == rop_attach);
+		break;
+	case rop_report:
+		sif_report(payload);
+		break;
+	default:
+		test_fail(__FILE__, __LINE__, "known op");
+	}
+
+	return 0;
+}
+
+static void command(int op, const void *payload, size_t size)
+{
+	struct {
+		struct sif_cmd_header header;
+		u8 payload[CMD_PACKET_PAYLOAD_MAX];
+	} packet = {
+		.header = {
+			.cmd = SIF_CMD_GAMEPAD,
+			.opt = (union gamepad_sif_opt) { .op = op }.raw,
+		},
+	};
+
+	memcpy(packet.payload, payload, size);
+
+	gamepad_cmd(&packet.header, NULL);
+}
+
+static void cycle(void)
+{
+	const int starts = sio2_sim.starts;
+
+	jiffies = poll.timer.expires;
+	poll_timer(&poll.timer);
+
+	expect(sio2_sim.starts == starts + 1);
+	expect(!sio2_owned && !poll.busy);
+}
+
+static void press_buttons(void)
+{
+	for (int port = 0; port < SIO2_PORTS; port++)
+		for (int slot = 0; slot < MULTITAP_SLOTS; slot++) {
+			struct sim_pad *pad = &sim_ports[port].pad[slot];
+
+			for (int i = 0; i < sizeof(pad->c); i++)
+				pad->c.byte[i] = test_random();
+		}
+}
+
+/* Attached controllers are reported as they are once polled. */
+static void expect_seen(int port, int slot)
+{
+	const struct sim_port *sp = sim_port(port);
+	const struct sim_pad *pad = &sp->pad[slot];
+	const size_t size = pad->dualshock ? sizeof(union controller) : 2;
+
+	expect(seen[port][slot].attached);
+	expect(seen[port][slot].mode == (pad->dualshock ?
+		CONTROLLER_MODE_PRESSURE : CONTROLLER_MODE_DIGITAL));
+	expect(!memcmp(seen[port][slot].c.byte, pad->c.byte, size));
+}
+
+static void settle(void)
+{
+	for (int i = 0; i < 10; i++)
+		cycle();
+}
+
+static void test_direct(void)
+{
+	sim_port(0)->pad[0] = (struct sim_pad) { .present = true };
+	sim_port(1)->pad[0] = (struct sim_pad) {
+		.present = true,
+		.dualshock = true,
+		.mode = CONTROLLER_MODE_DIGITAL,
+	};
+
+	settle();
+	expect(attach_events == 2);
+
+	for (int i = 0; i < CYCLES; i++) {
+		press_buttons();
+		cycle();
+		expect_seen(0, 0);
+		expect_seen(1, 0);
+	}
+
+	/* Attached controllers take no multitap queries. */
+	expect(queue.count == 2);
+
+	/* Vibration motors are set with the next poll. */
+	const struct gamepad_sif_rumble rumble = {
+		.port = 1, .small = 1, .large = 0xc0,
+	};
+
+	command(rop_rumble, &rumble, sizeof(rumble));
+	cycle();
+	expect(sim_port(1)->pad[0].small == 1);
+	expect(sim_port(1)->pad[0].large == 0xc0);
+
+	sim_port(0)->pad[0] = empty_pad;
+	sim_port(1)->pad[0] = empty_pad;
+	settle();
+	expect(detach_events == 2);
+	expect(!seen[0][0].attached && !seen[1][0].attached);
+}
+
+static void test_multitaps(void)
+{
+	const int attached = attach_events;
+
+	for (int port = 0; port < SIO2_PAD_PORTS; port++) {
+		struct sim_port *sp = sim_port(port);
+
+		sp->multitap = true;
+		for (int slot = 0; slot < MULTITAP_SLOTS; slot++)
+			sp->pad[slot] = (struct sim_pad) {
+				.present = true,
+				.dualshock = (port + slot) % 2,
+				.mode = CONTROLLER_MODE_DIGITAL,
+			};
+	}
+
+	settle();
+	expect(sio2_pad_ports[0].multitap && sio2_pad_ports[1].multitap);
+	expect(attach_events == attached + 8);
+
+	/* Eight controllers take a full queue of 16 commands. */
+	for (int i = 0; i < CYCLES; i++) {
+		press_buttons();
+		sio2_sim.port_accesses = 0;
+		cycle();
+
+		expect(queue.count == SIO2_CMD_QUEUE_SIZE);
+		expect(queue.size <= SIO2_FIFO_SIZE);
+
+		/* The FIFO ports are accessed a word at a time. */
+		expect(sio2_sim.port_accesses ==
+			2 * (queue.size / 4 + queue.size % 4));
+
+		for (int port = 0; port < SIO2_PAD_PORTS; port++)
+			for (int slot = 0; slot < MULTITAP_SLOTS; slot++)
+				expect_seen(port, slot);
+	}
+
+	/* Controllers are detached from their own slots. */
+	const int detached = detach_events;
+
+	sim_port(1)->pad[2] = empty_pad;
+	settle();
+	expect(detach_events == detached + 1);
+	expect(!seen[1][2].attached && seen[1][3].attached);
+
+	/* Multitaps are detached with all their controllers. */
+	sim_port(0)->multitap = false;
+	sim_port(0)->pad[0] = empty_pad;
+	settle();
+	expect(!sio2_pad_ports[0].multitap);
+	expect(detach_events == detached + 1 + MULTITAP_SLOTS);
+	for (int slot = 0; slot < MULTITAP_SLOTS; slot++)
+		expect(!seen[0][slot].attached);
+
+	/* Disabled multitaps are polled through their selected slot. */
+	const struct gamepad_sif_multitap disable = { .enable = false };
+
+	command(rop_multitap, &disable, sizeof(disable));
+	cycle();
+	expect(!sio2_pad_ports[1].multitap);
+	for (int slot = 1; slot < MULTITAP_SLOTS; slot++)
+		expect(!seen[1][slot].attached);
+	settle();
+	expect(queue.count == 2);
+}
+
+int main(int argc, char *argv[])
+{
+	const struct gamepad_sif_deadzone deadzone = { };
+
+	expect(gamepad_init(argc, argv) == MODULE_RESIDENT);
+	expect(irq.handler && irq.thread_fn && gamepad_cmd);
+
+	/* Report every change, to compare with the controllers. */
+	command(rop_deadzone, &deadzone, sizeof(deadzone));
+
+	test_direct();
+	test_multitaps();
+
+	return 0;
+}
@@ -0,0 +1,26 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Host stand-in for IOP register access. Tests of modules that access
+ * registers simulate the hardware by defining these functions, which
+ * otherwise fail the test.
+ */
+
+#ifndef IOPMOD_IO_H
+#define IOPMOD_IO_H
+
+#include "iopmod/types.h"
+
+#define wbflush()	do { } while (0)
+
+#define mb()		wbflush()
+#define iobarrier_rw()	mb()
+
+u8 iord8(const u32 addr);
+u16 iord16(const u32 addr);
+u32 iord32(const u32 addr);
+
+void iowr8(u8 value, u32 addr);
+void iowr16(u16 value, u32 addr);
+void iowr32(u32 value, u32 addr);
+
+#endif /* IOPMOD_IO_H */
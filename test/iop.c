@@ -0,0 +1,224 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Host stand-ins for the IOP kernel services used by module tests
+ *
+ * All stand-ins are weak, so that tests can override them. Services that
+ * a test is not expected to use fail the test.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "iopmod/errno.h"
+#include "iopmod/interrupt.h"
+#include "iopmod/io.h"
+#include "iopmod/iop-error.h"
+#include "iopmod/printk.h"
+#include "iopmod/sif.h"
+#include "iopmod/sifcmd.h"
+#include "iopmod/sifman.h"
+#include "iopmod/thread.h"
+
+#include "iop.h"
+
+#define __weak __attribute__((weak))
+
+u64 test_clock;
+
+void test_fail(const char *file, int line, const char *cond)
+{
+	fprintf(stderr, "%s:%d: expected %s\n", file, line, cond);
+	exit(EXIT_FAILURE);
+}
+
+u32 test_random(void)
+{
+	static u64 state = 0x853c49e6748fea9bULL;
+
+	/* xorshift64* */
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+
+	return (state * 0x2545f4914f6cdd1dULL) >> 32;
+}
+
+u64 test_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void __attribute__((noreturn)) unexpected(const char *name)
+{
+	fprintf(stderr, "%s: unexpected call\n", name);
+	exit(EXIT_FAILURE);
+}
+
+__weak u8 iord8(const u32 addr) { unexpected(__func__); }
+__weak u16 iord16(const u32 addr) { unexpected(__func__); }
+__weak u32 iord32(const u32 addr) { unexpected(__func__); }
+
+__weak void iowr8(u8 value, u32 addr) { unexpected(__func__); }
+__weak void iowr16(u16 value, u32 addr) { unexpected(__func__); }
+__weak void iowr32(u32 value, u32 addr) { unexpected(__func__); }
+
+/* Messages are printed on standard error for the test log. */
+__weak int printk(const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (fmt[0] == KERN_SOH[0] && fmt[1])
+		fmt += 2;
+
+	va_start(ap, fmt);
+	n = vfprintf(stderr, fmt, ap);
+	va_end(ap);
+
+	return n;
+}
+
+/* Tests run in a single host thread, so there is nothing to suspend. */
+__weak int intrman_cpu_suspend_irq(unsigned int *flags)
+{
+	*flags = 0;
+
+	return 0;
+}
+
+__weak int intrman_cpu_resume_irq(unsigned int flags)
+{
+	return 0;
+}
+
+__weak int intrman_in_irq(void)
+{
+	return 0;
+}
+
+__weak int thbase_get_system_time(struct iop_sys_clock *sys_clock)
+{
+	sys_clock->lo = test_clock;
+	sys_clock->hi = test_clock >> 32;
+
+	return 0;
+}
+
+__weak int thbase_create(const struct iop_thread *thread)
+{
+	unexpected(__func__);
+}
+
+__weak int thbase_start(int thid, void *arg)
+{
+	unexpected(__func__);
+}
+
+__weak int thbase_delete(int thid)
+{
+	unexpected(__func__);
+}
+
+__weak int thsemap_create_sema(const struct iop_sema *sema)
+{
+	unexpected(__func__);
+}
+
+__weak int thsemap_signal_sema(int semid)
+{
+	unexpected(__func__);
+}
+
+__weak int thsemap_isignal_sema(int semid)
+{
+	unexpected(__func__);
+}
+
+__weak int thsemap_wait_sema(int semid)
+{
+	unexpected(__func__);
+}
+
+__weak int sif_cmd_opt_data(u32 cmd, u32 opt,
+	const void *payload, size_t payload_size,
+	main_addr_t dst, const void *src, size_t nbytes)
+{
+	return 0;
+}
+
+__weak u32 sifman_set_sm_flag(u32 val)
+{
+	return 0;
+}
+
+__weak void sifman_intr_main(void)
+{
+}
+
+__weak void sif_request_cmd(int cid, sifcmd_handler handler, void *arg)
+{
+}
+
+__weak struct sifcmd_rpc_data_queue *sifcmd_set_rpc_queue(
+	struct sifcmd_rpc_data_queue *q, int thread_id)
+{
+	return q;
+}
+
+__weak void sifcmd_register_rpc(struct sifcmd_rpc_server_data *sd, int sid,
+	sifcmd_rpc_func func, void *buf, sifcmd_rpc_func cfunc, void *cbuf,
+	struct sifcmd_rpc_data_queue *qd)
+{
+}
+
+__weak void sifcmd_rpc_loop(struct sifcmd_rpc_data_queue *qd)
+{
+	unexpected(__func__);
+}
+
+__weak struct sifcmd_rpc_server_data *sifcmd_remove_rpc(
+	struct sifcmd_rpc_server_data *sd, struct sifcmd_rpc_data_queue *qd)
+{
+	return sd;
+}
+
+__weak struct sifcmd_rpc_data_queue *sifcmd_remove_rpc_queue(
+	struct sifcmd_rpc_data_queue *qd)
+{
+	return qd;
+}
+
+__weak int request_irq(unsigned int irq, irq_handler_t cb, void *arg)
+{
+	unexpected(__func__);
+}
+
+__weak int release_irq(unsigned int irq, irq_handler_t handler, void *arg)
+{
+	unexpected(__func__);
+}
+
+__weak void set_irq_time_accounting(bool enable)
+{
+}
+
+__weak int irq_stat(unsigned int irq, struct irq_stat *stat)
+{
+	unexpected(__func__);
+}
+
+__weak const char *iop_error_message(int ioperr)
+{
+	return "IOP error";
+}
+
+__weak int errno_for_iop_error(int ioperr)
+{
+	return -EIO;
+}
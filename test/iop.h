@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Host stand-ins for the IOP kernel services used by module tests
+ *
+ * A test includes the module source under test, so that its static
+ * functions and data can be exercised directly, and links with weak
+ * stand-ins for the IOP kernel services. Tests simulating hardware or
+ * services in more detail override the stand-ins with their own
+ * definitions.
+ *
+ * IOP addresses are 32 bits. Tests are linked as position dependent
+ * executables with simulated memory in static storage, so that pointers
+ * to it fit in 32 bits as well.
+ */
+
+#ifndef IOPMOD_TEST_IOP_H
+#define IOPMOD_TEST_IOP_H
+
+#include "iopmod/types.h"
+
+/**
+ * expect - fail the test unless a condition holds
+ * @cond: condition to check
+ */
+#define expect(cond)							\
+	do {								\
+		if (!(cond))						\
+			test_fail(__FILE__, __LINE__, #cond);		\
+	} while (0)
+
+void test_fail(const char *file, int line, const char *cond)
+	__attribute__((noreturn));
+
+/**
+ * test_random - pseudorandom number generator for tests
+ *
+ * Tests are repeatable, since the generator always starts from the same
+ * state.
+ *
+ * Return: 32-bit pseudorandom number
+ */
+u32 test_random(void);
+
+/*
+ * Simulated system clock in cycles, returned by thbase_get_system_time().
+ * Tests advance it as they see fit.
+ */
+extern u64 test_clock;
+
+/**
+ * test_ns - host monotonic time for benchmarks
+ *
+ * Benchmarks print their results without checking them, since host timing
+ * depends on the machine running the tests.
+ *
+ * Return: nanoseconds since an arbitrary point in time
+ */
+u64 test_ns(void);
+
+#endif /* IOPMOD_TEST_IOP_H */
@@ -0,0 +1,525 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Request, dispatch and release interrupt handlers of the main IRQ module
+ * on simulated intrman and DEV9 SPD interrupt controllers, and check shared
+ * line chaining, SPD cascading through the DEV9 line, and threaded handlers
+ * polling with their line masked, draining, or unmasked between calls.
+ */
+
+#include <setjmp.h>
+
+#include "../module/irq.c"
+#include "../builtin/interrupt.c"
+#include "../builtin/spd-irq.c"
+
+#include "iop.h"
+
+#define TEST_THREADS 16
+#define TEST_SEMAS 16
+
+#define IRQ_SHARED IRQ_IOP_USB
+#define IRQ_FAILING IRQ_IOP_ILINK	/* intrman refuses to allocate it. */
+
+static struct {
+	irq_handler_t cb;
+	void *arg;
+	bool enabled;
+} intrman[MAX_IRQS];
+
+static struct {
+	u16 stat;
+	u16 mask;
+} spd;
+
+static struct {
+	void (*func)(void *arg);
+	void *arg;
+	int priority;
+	int rotations;
+	bool created;
+	bool started;
+} threads[TEST_THREADS];
+
+static struct {
+	int count;
+	bool created;
+} semas[TEST_SEMAS];
+
+static jmp_buf thread_wait;
+
+/* Handlers under test record their calls and return a chosen status. */
+struct test_handler {
+	enum irq_status status;
+	int calls;
+	int polls;		/* Thread calls asking to be called again. */
+	int thread_calls;
+};
+
+static struct test_handler handlers[4];
+
+static enum irq_status test_handler(void *arg)
+{
+	struct test_handler *h = arg;
+
+	h->calls++;
+
+	return h->status;
+}
+
+static enum irq_status test_thread_fn(void *arg)
+{
+	struct test_handler *h = arg;
+
+	h->thread_calls++;
+
+	/* The line remains masked while the thread function runs. */
+	expect(!intrman[IRQ_SHARED].enabled ||
+		irq_polls[IRQ_SHARED] == IRQ_POLL_UNMASKED);
+
+	if (!h->polls)
+		return IRQ_HANDLED;
+
+	h->polls--;
+
+	return IRQ_WAKE_THREAD;
+}
+
+enum irq_status intrman_request_irq(unsigned int irq,
+	enum irq_mode mode, irq_handler_t handler, void *arg)
+{
+	expect(irq < ARRAY_SIZE(intrman) && !intrman[irq].cb);
+
+	if (irq == IRQ_FAILING)
+		return -100;	/* Arbitrary IOP error */
+
+	intrman[irq].cb = handler;
+	intrman[irq].arg = arg;
+
+	return 0;
+}
+
+int intrman_release_irq(unsigned int irq)
+{
+	expect(irq < ARRAY_SIZE(intrman) && intrman[irq].cb);
+	expect(!intrman[irq].enabled);
+
+	intrman[irq].cb = NULL;
+	intrman[irq].arg = NULL;
+
+	return 0;
+}
+
+int intrman_enable_irq(unsigned int irq)
+{
+	expect(irq < ARRAY_SIZE(intrman) && intrman[irq].cb);
+
+	intrman[irq].enabled = true;
+
+	return 0;
+}
+
+int intrman_disable_irq(unsigned int irq, int *res)
+{
+	expect(irq < ARRAY_SIZE(intrman));
+
+	intrman[irq].enabled = false;
+
+	return 0;
+}
+
+u16 iord16(const u32 addr)
+{
+	switch (addr) {
+	case SPD_REG(SPD_REG_INTR_STAT):
+		return spd.stat;
+	case SPD_REG(SPD_REG_INTR_MASK):
+		return spd.mask;
+	default:
+		test_fail(__FILE__, __LINE__, "known SPD register");
+	}
+}
+
+void iowr16(u16 value, u32 addr)
+{
+	switch (addr) {
+	case SPD_REG(SPD_REG_INTR_STAT):
+		spd.stat &= ~value;
+		break;
+	case SPD_REG(SPD_REG_INTR_MASK):
+		spd.mask = value;
+		break;
+	default:
+		test_fail(__FILE__, __LINE__, "known SPD register");
+	}
+}
+
+int thbase_create(const struct iop_thread *thread)
+{
+	for (int i = 0; i < ARRAY_SIZE(threads); i++)
+		if (!threads[i].created) {
+			threads[i] = (typeof(threads[i])) {
+				.func = thread->thread,
+				.priority = thread->priority,
+				.created = true,
+			};
+
+			return i;
+		}
+
+	test_fail(__FILE__, __LINE__, "free thread");
+}
+
+int thbase_start(int thid, void *arg)
+{
+	expect(threads[thid].created && !threads[thid].started);
+
+	threads[thid].arg = arg;
+	threads[thid].started = true;
+
+	return 0;
+}
+
+int thbase_terminate(int thid)
+{
+	expect(threads[thid].started);
+
+	threads[thid].started = false;
+
+	return 0;
+}
+
+int thbase_delete(int thid)
+{
+	expect(threads[thid].created && !threads[thid].started);
+
+	threads[thid].created = false;
+
+	return 0;
+}
+
+int thbase_change_priority(int thid, int priority)
+{
+	expect(threads[thid].started);
+
+	threads[thid].priority = priority;
+
+	return 0;
+}
+
+/* The running thread is the only one of its priority. */
+int thbase_rotate_ready_queue(int priority)
+{
+	for (int i = 0; i < ARRAY_SIZE(threads); i++)
+		if (threads[i].started && threads[i].priority == priority)
+			threads[i].rotations++;
+
+	return 0;
+}
+
+int thsemap_create_sema(const struct iop_sema *sema)
+{
+	for (int i = 0; i < ARRAY_SIZE(semas); i++)
+		if (!semas[i].created) {
+			semas[i].count = sema->initial;
+			semas[i].created = true;
+
+			return i;
+		}
+
+	test_fail(__FILE__, __LINE__, "free semaphore");
+}
+
+int thsemap_delete_sema(int semid)
+{
+	expect(semas[semid].created);
+
+	semas[semid].created = false;
+
+	return 0;
+}
+
+int thsemap_signal_sema(int semid)
+{
+	expect(semas[semid].created);
+
+	semas[semid].count = 1;
+
+	return 0;
+}
+
+int thsemap_isignal_sema(int semid)
+{
+	expect(semas[semid].created);
+
+	semas[semid].count = 1;
+
+	return 0;
+}
+
+/* Threads run until they would block, and then return to the test. */
+int thsemap_wait_sema(int semid)
+{
+	expect(semas[semid].created);
+
+	if (!semas[semid].count)
+		longjmp(thread_wait, 1);
+
+	semas[semid].count--;
+
+	return 0;
+}
+
+static void run_thread(struct irq_thread *t)
+{
+	expect(threads[t->thid].started);
+
+	if (!setjmp(thread_wait))
+		threads[t->thid].func(threads[t->thid].arg);
+}
+
+static void interrupt(unsigned int irq)
+{
+	if (spd_valid_irq(irq)) {
+		spd.stat |= BIT(irq - IRQ_IOP_SPD_BASE);
+		irq = IRQ_IOP_DEV9;
+	}
+
+	if (intrman[irq].enabled)
+		expect(intrman[irq].cb(intrman[irq].arg) == IRQ_HANDLED);
+}
+
+static bool actions_free(void)
+{
+	for (int i = 0; i < ARRAY_SIZE(irq_actions); i++)
+		if (irq_actions[i].cb)
+			return false;
+
+	for (int i = 0; i < ARRAY_SIZE(irq_chains); i++)
+		if (irq_chains[i])
+			return false;
+
+	return true;
+}
+
+static void reset_handlers(void)
+{
+	memset(handlers, 0, sizeof(handlers));
+}
+
+static void test_shared(void)
+{
+	struct irq_stat stat;
+
+	reset_handlers();
+
+	expect(request_irq(IRQ_SHARED, test_handler, &handlers[0]) == 0);
+	expect(intrman[IRQ_SHARED].enabled);
+	expect(request_irq(IRQ_SHARED, test_handler, &handlers[1]) == 0);
+
+	/* The most recently requested handler is called first. */
+	handlers[1].status = IRQ_HANDLED;
+	interrupt(IRQ_SHARED);
+	expect(handlers[0].calls == 0 && handlers[1].calls == 1);
+
+	handlers[1].status = IRQ_NONE;
+	handlers[0].status = IRQ_HANDLED;
+	interrupt(IRQ_SHARED);
+	expect(handlers[0].calls == 1 && handlers[1].calls == 2);
+
+	handlers[0].status = IRQ_NONE;
+	interrupt(IRQ_SHARED);
+
+	expect(irq_stat(IRQ_SHARED, &stat) == 0);
+	expect(stat.count == 3 && stat.spurious == 1);
+
+	/* Handlers are released by both callback and argument. */
+	expect(release_irq(IRQ_SHARED, test_handler, &handlers[2]) == -ENOENT);
+	expect(release_irq(IRQ_SHARED, test_handler, &handlers[0]) == 0);
+	expect(intrman[IRQ_SHARED].cb);
+
+	handlers[1].status = IRQ_HANDLED;
+	interrupt(IRQ_SHARED);
+	expect(handlers[0].calls == 2 && handlers[1].calls == 4);
+
+	expect(release_irq(IRQ_SHARED, test_handler, &handlers[1]) == 0);
+	expect(!intrman[IRQ_SHARED].cb && !intrman[IRQ_SHARED].enabled);
+	expect(actions_free());
+}
+
+/*
+ * The first SPD handler requests the DEV9 line from within request_irq(),
+ * and the last releases it from within release_irq().
+ */
+static void test_spd(void)
+{
+	reset_handlers();
+
+	/* Another handler already shares the DEV9 line, as irqrelay does. */
+	expect(request_irq(IRQ_IOP_DEV9, test_handler, &handlers[0]) == 0);
+	expect(request_irq(IRQ_IOP_SPD_ATA0, test_handler, &handlers[1]) == 0);
+	expect(request_irq(IRQ_IOP_SPD_RXEND, test_handler, &handlers[2]) == 0);
+	expect(irq_chains[IRQ_IOP_DEV9]->cb == spd_handle_irq);
+	expect(irq_chains[IRQ_IOP_DEV9]->next->cb == test_handler);
+	expect(spd.mask == (BIT(IRQ_IOP_SPD_ATA0 - IRQ_IOP_SPD_BASE) |
+		BIT(IRQ_IOP_SPD_RXEND - IRQ_IOP_SPD_BASE)));
+
+	handlers[1].status = IRQ_HANDLED;
+	handlers[2].status = IRQ_HANDLED;
+
+	interrupt(IRQ_IOP_SPD_RXEND);
+	expect(!spd.stat);
+	expect(handlers[0].calls == 0);
+	expect(handlers[1].calls == 0 && handlers[2].calls == 1);
+
+	interrupt(IRQ_IOP_SPD_ATA0);
+	expect(!spd.stat);
+	expect(handlers[1].calls == 1 && handlers[2].calls == 1);
+
+	/* Interrupts from other DEV9 devices are passed on. */
+	interrupt(IRQ_IOP_DEV9);
+	expect(handlers[0].calls == 1);
+
+	expect(release_irq(IRQ_IOP_SPD_ATA0, test_handler, &handlers[1]) == 0);
+	expect(release_irq(IRQ_IOP_SPD_RXEND, test_handler, &handlers[2]) == 0);
+	expect(!spd.mask);
+	expect(irq_chains[IRQ_IOP_DEV9]->cb == test_handler);
+	expect(!irq_chains[IRQ_IOP_DEV9]->next);
+
+	expect(release_irq(IRQ_IOP_DEV9, test_handler, &handlers[0]) == 0);
+	expect(!intrman[IRQ_IOP_DEV9].cb);
+	expect(actions_free());
+
+	/* The SPD controller alone requests and releases the DEV9 line. */
+	expect(request_irq(IRQ_IOP_SPD_TXEND, test_handler, &handlers[3]) == 0);
+	expect(intrman[IRQ_IOP_DEV9].cb && intrman[IRQ_IOP_DEV9].enabled);
+
+	handlers[3].status = IRQ_HANDLED;
+	interrupt(IRQ_IOP_SPD_TXEND);
+	expect(handlers[3].calls == 1 && !spd.stat);
+
+	expect(release_irq(IRQ_IOP_SPD_TXEND, test_handler, &handlers[3]) == 0);
+	expect(!intrman[IRQ_IOP_DEV9].cb);
+	expect(actions_free());
+}
+
+static void test_threaded(void)
+{
+	struct test_handler *h = &handlers[0];
+	struct irq_thread *t;
+
+	reset_handlers();
+
+	expect(request_irq(IRQ_SHARED, test_handler, &handlers[1]) == 0);
+	expect(request_threaded_irq(IRQ_SHARED,
+		test_handler, test_thread_fn, h) == 0);
+	t = irq_chains[IRQ_SHARED]->thread;
+	expect(t && threads[t->thid].priority == IRQ_THREAD_PRIORITY);
+	run_thread(t);		/* Waits for the first interrupt. */
+
+	/* Interrupts not for the threaded handler are passed on. */
+	h->status = IRQ_NONE;
+	handlers[1].status = IRQ_HANDLED;
+	interrupt(IRQ_SHARED);
+	expect(handlers[1].calls == 1 && !t->masked);
+
+	/* The line is masked until the thread function has completed. */
+	h->status = IRQ_WAKE_THREAD;
+	interrupt(IRQ_SHARED);
+	expect(t->masked && !intrman[IRQ_SHARED].enabled);
+	interrupt(IRQ_SHARED);
+	expect(h->calls == 2);
+
+	run_thread(t);
+	expect(h->thread_calls == 1);
+	expect(!t->masked && intrman[IRQ_SHARED].enabled);
+	expect(threads[t->thid].rotations == 0);
+
+	/* Polls after the first run below the workqueues. */
+	h->polls = 5;
+	interrupt(IRQ_SHARED);
+	run_thread(t);
+	expect(h->thread_calls == 1 + 6);
+	expect(threads[t->thid].rotations == 4);	/* Between polls */
+	expect(threads[t->thid].priority == IRQ_THREAD_PRIORITY);
+	expect(!t->masked && intrman[IRQ_SHARED].enabled);
+
+	/* Draining polls stay at the priority of the thread. */
+	expect(set_irq_poll(IRQ_SHARED, IRQ_POLL_DRAIN) == 0);
+	h->polls = 5;
+	interrupt(IRQ_SHARED);
+	run_thread(t);
+	expect(h->thread_calls == 7 + 6);
+	expect(threads[t->thid].rotations == 4);
+	expect(threads[t->thid].priority == IRQ_THREAD_PRIORITY);
+	expect(!t->masked && intrman[IRQ_SHARED].enabled);
+
+	/* Unmasked polls let the device interrupt in between. */
+	expect(set_irq_poll(IRQ_SHARED, IRQ_POLL_UNMASKED) == 0);
+	h->polls = 5;
+	interrupt(IRQ_SHARED);
+	expect(t->masked);
+	run_thread(t);
+	expect(h->thread_calls == 13 + 6);
+	expect(threads[t->thid].rotations == 4);
+	expect(!t->masked && intrman[IRQ_SHARED].enabled);
+
+	expect(set_irq_poll(IRQ_SHARED, IRQ_POLL_UNMASKED + 1) == -EINVAL);
+	expect(set_irq_poll(MAX_IRQS, IRQ_POLL_YIELD) == -EINVAL);
+	expect(set_irq_poll(IRQ_SHARED, IRQ_POLL_YIELD) == 0);
+
+	/* Releasing a masked threaded handler unmasks the shared line. */
+	interrupt(IRQ_SHARED);
+	expect(t->masked);
+
+	const int thid = t->thid;
+	const int sema_id = t->sema_id;
+
+	expect(release_irq(IRQ_SHARED, test_handler, h) == -ENOENT);
+	expect(release_irq(IRQ_SHARED, test_thread_fn, h) == 0);
+	expect(!threads[thid].created && !semas[sema_id].created);
+	expect(intrman[IRQ_SHARED].enabled);
+
+	expect(release_irq(IRQ_SHARED, test_handler, &handlers[1]) == 0);
+	expect(actions_free());
+}
+
+static void test_errors(void)
+{
+	static struct test_handler many[MAX_IRQ_ACTIONS + 1];
+
+	expect(request_irq(MAX_IRQS, test_handler, NULL) == -EINVAL);
+	expect(request_irq(IRQ_SHARED, NULL, NULL) == -EINVAL);
+	expect(release_irq(IRQ_SHARED, test_handler, NULL) == -ENOENT);
+
+	/* Failing controllers leave the action free. */
+	expect(request_irq(IRQ_FAILING, test_handler, NULL) < 0);
+	expect(actions_free());
+
+	for (int i = 0; i < MAX_IRQ_ACTIONS; i++)
+		expect(request_irq(IRQ_SHARED, test_handler, &many[i]) == 0);
+	expect(request_irq(IRQ_SHARED, test_handler,
+		&many[MAX_IRQ_ACTIONS]) == -ENOMEM);
+	expect(request_irq(IRQ_IOP_SPD_ATA0, test_handler, NULL) == -ENOMEM);
+	expect(!intrman[IRQ_IOP_DEV9].cb && !spd.mask);
+
+	/* The SPD handler takes the last action, leaving none for DEV9. */
+	expect(release_irq(IRQ_SHARED, test_handler, &many[0]) == 0);
+	expect(request_irq(IRQ_IOP_SPD_ATA0, test_handler, NULL) == -ENOMEM);
+	expect(!intrman[IRQ_IOP_DEV9].cb && !spd.mask);
+	expect(!irq_chains[IRQ_IOP_SPD_ATA0] && !irq_chains[IRQ_IOP_DEV9]);
+
+	for (int i = 1; i < MAX_IRQ_ACTIONS; i++)
+		expect(release_irq(IRQ_SHARED, test_handler, &many[i]) == 0);
+	expect(actions_free());
+	expect(!intrman[IRQ_SHARED].cb);
+}
+
+int main(int argc, char *argv[])
+{
+	test_shared();
+	test_spd();
+	test_threaded();
+	test_errors();
+
+	return 0;
+}
@@ -0,0 +1,194 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Replay a trace of relayed interrupts with known latencies, and compare
+ * the latency statistics of the IRQ relay with those of a reference.
+ */
+
+#include "../module/irqrelay.c"
+
+#include "iop.h"
+
+#define TRACE_LENGTH 20000
+
+/*
+ * Simulated time to notify the main processor, either by a SIF command or
+ * by an SMFLAG interrupt.
+ */
+static u32 notify_cycles;
+
+static struct {
+	size_t size;
+	struct iop_irq_relay relay;
+} last_cmd;
+
+static bool time_accounting;
+
+static struct {
+	irq_handler_t cb;
+	void *arg;
+} handlers[IRQ_IOP_SPD_BASE];
+
+int sif_cmd_opt_data(u32 cmd, u32 opt,
+	const void *payload, size_t payload_size,
+	main_addr_t dst, const void *src, size_t nbytes)
+{
+	expect(cmd == SIF_CMD_IRQ_RELAY);
+	expect(payload_size <= sizeof(last_cmd.relay));
+
+	last_cmd.size = payload_size;
+	memcpy(&last_cmd.relay, payload, payload_size);
+
+	test_clock += notify_cycles;
+
+	return 0;
+}
+
+void sifman_intr_main(void)
+{
+	test_clock += notify_cycles;
+}
+
+int request_irq(unsigned int irq, irq_handler_t cb, void *arg)
+{
+	expect(irq < ARRAY_SIZE(handlers));
+	expect(!handlers[irq].cb);
+
+	handlers[irq].cb = cb;
+	handlers[irq].arg = arg;
+
+	return 0;
+}
+
+void set_irq_time_accounting(bool enable)
+{
+	time_accounting = enable;
+}
+
+static void *rpc(int rpo, const void *request, size_t size)
+{
+	u8 buffer[sizeof(rpc_buffer)];
+
+	expect(size <= sizeof(buffer));
+	memcpy(buffer, request, size);
+
+	return irqrelay_service_rpc(rpo, buffer, size);
+}
+
+static void interrupt(unsigned int irq, u32 cycles)
+{
+	notify_cycles = cycles;
+	test_clock += test_random() % 1000;
+
+	expect(handlers[irq].cb(handlers[irq].arg) == IRQ_HANDLED);
+}
+
+static unsigned int reference_bucket(u32 cycles)
+{
+	unsigned int bucket = 0;
+
+	while (bucket < LATENCY_BUCKETS - 1 &&
+	       cycles >= 1u << (bucket + LATENCY_BUCKET_SHIFT))
+		bucket++;
+
+	return bucket;
+}
+
+static void test_buckets(void)
+{
+	expect(latency_bucket(0) == 0);
+	expect(latency_bucket((1 << LATENCY_BUCKET_SHIFT) - 1) == 0);
+	expect(latency_bucket(1 << LATENCY_BUCKET_SHIFT) == 1);
+	expect(latency_bucket(0xffffffff) == LATENCY_BUCKETS - 1);
+
+	for (int i = 0; i < TRACE_LENGTH; i++) {
+		const u32 cycles = test_random() >> (test_random() % 32);
+
+		expect(latency_bucket(cycles) == reference_bucket(cycles));
+	}
+}
+
+static void test_replay(void)
+{
+	const struct iop_rpc_relay_map maps[] = {
+		{ .iop = IRQ_IOP_USB,   .map = 3, .rpc = true },
+		{ .iop = IRQ_IOP_DEV9,  .map = 5, .rpc = false },
+	};
+	struct {
+		u32 count;
+		u32 min;
+		u32 max;
+		u64 sum;
+		u32 histogram[LATENCY_BUCKETS];
+	} reference[ARRAY_SIZE(maps)] = { };
+	const struct iop_rpc_relay_latency_mode on = { .enable = true };
+	const struct iop_rpc_relay_latency_mode off = { .enable = false };
+
+	for (int i = 0; i < ARRAY_SIZE(maps); i++)
+		expect(*(int *)rpc(rpo_request_irq,
+			&maps[i], sizeof(maps[i])) == 0);
+
+	/* Relays are not measured before the mode is enabled. */
+	interrupt(IRQ_IOP_USB, 100);
+	expect(last_cmd.size == sizeof(last_cmd.relay.irq));
+	expect(last_cmd.relay.irq == 3);
+
+	expect(*(int *)rpc(rpo_latency_mode, &on, sizeof(on)) == 0);
+	expect(time_accounting);
+
+	for (int i = 0; i < TRACE_LENGTH; i++) {
+		const int m = test_random() % ARRAY_SIZE(maps);
+		const u32 cycles = test_random() >> (8 + test_random() % 24);
+		const u32 entry = test_clock;
+
+		interrupt(maps[m].iop, cycles);
+
+		if (maps[m].rpc) {
+			expect(last_cmd.size == sizeof(last_cmd.relay));
+			expect(last_cmd.relay.irq == maps[m].map);
+			expect(last_cmd.relay.timestamp - entry < 1000);
+		}
+
+		if (!reference[m].count++ || cycles < reference[m].min)
+			reference[m].min = cycles;
+		reference[m].max = max(reference[m].max, cycles);
+		reference[m].sum += cycles;
+		reference[m].histogram[reference_bucket(cycles)]++;
+	}
+
+	expect(*(int *)rpc(rpo_latency_mode, &off, sizeof(off)) == 0);
+	expect(!time_accounting);
+
+	/* Relays are no longer measured once the mode is disabled. */
+	interrupt(IRQ_IOP_USB, 100);
+	expect(last_cmd.size == sizeof(last_cmd.relay.irq));
+
+	for (int i = 0; i < ARRAY_SIZE(maps); i++) {
+		const struct iop_rpc_relay_latency_query query = {
+			.iop = maps[i].iop
+		};
+		const struct iop_rpc_relay_latency_stat *stat =
+			rpc(rpo_latency_stat, &query, sizeof(query));
+
+		expect(stat->status == 0);
+		expect(stat->count == reference[i].count);
+		expect(stat->min == reference[i].min);
+		expect(stat->max == reference[i].max);
+		expect(stat->avg == reference[i].sum / reference[i].count);
+		expect(!memcmp(stat->histogram, reference[i].histogram,
+			sizeof(stat->histogram)));
+	}
+
+	/* Unmapped IRQs have no statistics. */
+	const struct iop_rpc_relay_latency_query query = { .iop = IRQ_IOP_SIO2 };
+	const struct iop_rpc_relay_latency_stat *stat =
+		rpc(rpo_latency_stat, &query, sizeof(query));
+	expect(stat->status == -ENXIO);
+}
+
+int main(int argc, char *argv[])
+{
+	test_buckets();
+	test_replay();
+
+	return 0;
+}
@@ -0,0 +1,626 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Write and read pages of a simulated memory card on a simulated SIO2, and
+ * check Hamming code correction, SIO2 ownership, transfer timeouts and card
+ * authentication. Also measure the host time, SIO2 register accesses and
+ * bytes on the wire per page.
+ */
+
+#include "../module/memcard.c"
+
+#include <stdio.h>
+
+#include "iop.h"
+
+#define CARD_PAGES	64
+#define CARD_PORT	2
+
+#define CARD_CMD_AUTH		0xf0	/* Stands in for the secrman exchange. */
+#define CARD_AUTH_CMD_SIZE	5
+
+#define BENCH_ROUNDS	200
+
+static struct {
+	u8 page[MEMCARD_PAGE_SIZE + MEMCARD_SPARE_SIZE];
+} card[CARD_PAGES];
+
+static struct {
+	bool authenticated;
+	bool refuse;		/* Authentication fails if set. */
+	int auths;
+} card_auth;
+
+static struct {
+	u32 cmd[SIO2_CMD_QUEUE_SIZE];
+	u32 port2_ctrl0;
+	struct {
+		u8 buf[4 * SIO2_FIFO_SIZE];
+		size_t head;
+		size_t tail;
+	} tx_fifo, rx_fifo;
+	const u8 *tx;
+	u8 *rx;
+	size_t tx_size;
+	size_t rx_size;
+	bool hang;		/* Command queues never complete if set. */
+} sio2_sim;
+
+static struct {
+	u32 ios;
+	u32 wire;
+} count;
+
+static struct memcard_dev *memcard;
+static bool sema_signalled;
+static struct timer_list *pending_timer;
+static int sio2_owned;
+
+static struct {
+	size_t size;
+	u8 data[MEMCARD_QUEUE_READ_PAGES * MEMCARD_PAGE_SIZE];
+} read_back;
+
+/* Card address cursor, set by address commands. */
+static struct {
+	u8 cmd;
+	u32 page;
+	size_t offset;
+} cursor;
+
+/* Returns the length of the command, which the SIO2 command must match. */
+static size_t card_cmd(const u8 *tx, u8 *rx)
+{
+	size_t length = MEMCARD_SHORT_CMD_SIZE;
+	const size_t size = tx[2];
+
+	expect(tx[0] == MEMCARD_PREFIX);
+
+	if (tx[1] == CARD_CMD_AUTH) {
+		length = CARD_AUTH_CMD_SIZE;
+		card_auth.authenticated = !card_auth.refuse;
+		goto reply;
+	}
+
+	/* Unauthenticated cards fail all other commands. */
+	if (!card_auth.authenticated) {
+		if (tx[1] == MEMCARD_CMD_READ || tx[1] == MEMCARD_CMD_WRITE)
+			length = MEMCARD_DATA_CMD_SIZE(size);
+		else if (tx[1] != MEMCARD_CMD_END &&
+			 tx[1] != MEMCARD_CMD_ERASE)
+			length = MEMCARD_ADDR_CMD_SIZE;
+		rx[length - 1] = 0xff;
+		return length;
+	}
+
+	switch (tx[1]) {
+	case MEMCARD_CMD_ERASE_ADDR:
+	case MEMCARD_CMD_WRITE_ADDR:
+	case MEMCARD_CMD_READ_ADDR:
+		length = MEMCARD_ADDR_CMD_SIZE;
+		expect(tx[7] == memcard_checksum(&tx[3], 4));
+		cursor.cmd = tx[1];
+		cursor.page = tx[3] | (tx[4] << 8) | (tx[5] << 16) | (tx[6] << 24);
+		cursor.offset = 0;
+		expect(cursor.page < CARD_PAGES);
+		break;
+
+	case MEMCARD_CMD_READ:
+		length = MEMCARD_DATA_CMD_SIZE(size);
+		expect(cursor.cmd == MEMCARD_CMD_READ_ADDR);
+		expect(cursor.offset + size <= sizeof(card[0].page));
+		memcpy(&rx[4], &card[cursor.page].page[cursor.offset], size);
+		rx[4 + size] = memcard_checksum(&rx[4], size);
+		cursor.offset += size;
+		break;
+
+	case MEMCARD_CMD_WRITE:
+		length = MEMCARD_DATA_CMD_SIZE(size);
+		expect(cursor.cmd == MEMCARD_CMD_WRITE_ADDR);
+		expect(cursor.offset + size <= sizeof(card[0].page));
+		expect(tx[3 + size] == memcard_checksum(&tx[3], size));
+		memcpy(&card[cursor.page].page[cursor.offset], &tx[3], size);
+		cursor.offset += size;
+		break;
+
+	case MEMCARD_CMD_ERASE:
+		expect(cursor.cmd == MEMCARD_CMD_ERASE_ADDR);
+		expect(cursor.page % MEMCARD_BLOCK_PAGES == 0);
+		for (int i = 0; i < MEMCARD_BLOCK_PAGES; i++)
+			memset(card[cursor.page + i].page, 0xff,
+				sizeof(card[0].page));
+		break;
+
+	case MEMCARD_CMD_END:
+		break;
+
+	default:
+		test_fail(__FILE__, __LINE__, "known command");
+	}
+
+reply:
+	rx[3] = MEMCARD_ACK;
+	rx[length - 1] = MEMCARD_TERMINATOR;
+
+	return length;
+}
+
+/*
+ * The transmit stream is the transmit FIFO followed by the transmit DMA
+ * buffer. The receive stream fills the receive DMA buffer first and the
+ * rest remains in the receive FIFO.
+ */
+static void sio2_start(void)
+{
+	static u8 tx[MEMCARD_QUEUE_BYTES + 4], rx[MEMCARD_QUEUE_BYTES + 4];
+	const size_t fifo_size = sio2_sim.tx_fifo.tail - sio2_sim.tx_fifo.head;
+	const size_t tx_size = fifo_size + sio2_sim.tx_size;
+	size_t offset = 0;
+
+	expect(sio2_owned == 1);
+	expect(tx_size <= sizeof(tx));
+
+	memcpy(tx, &sio2_sim.tx_fifo.buf[sio2_sim.tx_fifo.head], fifo_size);
+	if (sio2_sim.tx_size)
+		memcpy(&tx[fifo_size], sio2_sim.tx, sio2_sim.tx_size);
+
+	for (int i = 0; i < SIO2_CMD_QUEUE_SIZE; i++) {
+		struct sio2_cmd cmd;
+
+		memcpy(&cmd, &sio2_sim.cmd[i], sizeof(cmd));
+		if (!cmd.tx_size)
+			break;
+
+		expect(cmd.port == CARD_PORT);
+		expect(cmd.tx_size == cmd.rx_size);
+		expect(offset + cmd.tx_size <= tx_size);
+
+		/* Commands are sent without padding. */
+		expect(card_cmd(&tx[offset], &rx[offset]) == cmd.tx_size);
+		offset += cmd.tx_size;
+	}
+
+	/* Only the excess of the last word of DMA remains unsent. */
+	expect(tx_size - offset < 4);
+	sio2_sim.tx_fifo.head += fifo_size - min(fifo_size, tx_size - offset);
+	count.wire += offset;
+
+	expect(sio2_sim.rx_size <= offset);
+	if (sio2_sim.rx_size)
+		memcpy(sio2_sim.rx, rx, sio2_sim.rx_size);
+	expect(sio2_sim.rx_fifo.tail + offset - sio2_sim.rx_size <=
+		sizeof(sio2_sim.rx_fifo.buf));
+	memcpy(&sio2_sim.rx_fifo.buf[sio2_sim.rx_fifo.tail],
+		&rx[sio2_sim.rx_size], offset - sio2_sim.rx_size);
+	sio2_sim.rx_fifo.tail += offset - sio2_sim.rx_size;
+
+	sio2_sim.tx_size = 0;
+	sio2_sim.rx_size = 0;
+
+	if (!sio2_sim.hang)
+		expect(memcard_irq(memcard) == IRQ_HANDLED);
+}
+
+static void sio2_tx(u8 value)
+{
+	expect(sio2_sim.tx_fifo.tail < sizeof(sio2_sim.tx_fifo.buf));
+
+	sio2_sim.tx_fifo.buf[sio2_sim.tx_fifo.tail++] = value;
+}
+
+static u8 sio2_rx(void)
+{
+	expect(sio2_sim.rx_fifo.head < sio2_sim.rx_fifo.tail);
+
+	return sio2_sim.rx_fifo.buf[sio2_sim.rx_fifo.head++];
+}
+
+void iowr8(u8 value, u32 addr)
+{
+	count.ios++;
+
+	expect(addr == SIO2_REG_TX);
+	sio2_tx(value);
+}
+
+void iowr32(u32 value, u32 addr)
+{
+	count.ios++;
+
+	if (addr >= SIO2_REG_CMD_QUEUE &&
+	    addr < SIO2_REG_CMD_QUEUE + 4 * SIO2_CMD_QUEUE_SIZE) {
+		sio2_sim.cmd[(addr - SIO2_REG_CMD_QUEUE) / 4] = value;
+	} else if (addr == SIO2_REG_PORT2_CTRL0) {
+		sio2_sim.port2_ctrl0 = value;
+	} else if (addr == SIO2_REG_TX) {
+		for (int i = 0; i < 4; i++)
+			sio2_tx(value >> (8 * i));
+	} else if (addr == SIO2_REG_CTRL) {
+		struct sio2_ctrl ctrl;
+
+		memcpy(&ctrl, &value, sizeof(ctrl));
+		if (ctrl.reset_fifo) {
+			sio2_sim.tx_fifo.head = sio2_sim.tx_fifo.tail = 0;
+			sio2_sim.rx_fifo.head = sio2_sim.rx_fifo.tail = 0;
+		}
+		if (ctrl.start)
+			sio2_start();
+	}
+}
+
+u8 iord8(const u32 addr)
+{
+	count.ios++;
+
+	expect(addr == SIO2_REG_RX);
+
+	return sio2_rx();
+}
+
+u32 iord32(const u32 addr)
+{
+	count.ios++;
+
+	if (addr == SIO2_REG_RX) {
+		u32 value = 0;
+
+		for (int i = 0; i < 4; i++)
+			value |= sio2_rx() << (8 * i);
+
+		return value;
+	}
+
+	return 0;	/* No errors, and no interrupts to clear. */
+}
+
+int dmac_request(u32 channel, void *addr, u32 size, u32 count, int dir)
+{
+	if (channel == DMAC_CH_SIO2_IN) {
+		expect(dir == DMAC_FROM_MEM);
+		sio2_sim.tx = addr;
+		sio2_sim.tx_size = 4 * size * count;
+	} else {
+		expect(channel == DMAC_CH_SIO2_OUT);
+		expect(dir == DMAC_TO_MEM);
+		sio2_sim.rx = addr;
+		sio2_sim.rx_size = 4 * size * count;
+	}
+
+	return 1;
+}
+
+void dmac_transfer(u32 channel)
+{
+}
+
+int sio2_request(void)
+{
+	expect(!sio2_owned++);
+
+	return 0;
+}
+
+int sio2_try_request(void)
+{
+	return sio2_owned++ ? -EBUSY : 0;
+}
+
+void sio2_release(void)
+{
+	expect(sio2_owned-- == 1);
+}
+
+static secrman_mc_cmd_handler_t secrman_cmd;
+static secrman_mc_dev_id_handler_t secrman_dev_id;
+
+void secrman_set_mc_cmd_handler(secrman_mc_cmd_handler_t handler)
+{
+	secrman_cmd = handler;
+}
+
+void secrman_set_mc_dev_id_handler(secrman_mc_dev_id_handler_t handler)
+{
+	secrman_dev_id = handler;
+}
+
+/* Authenticates with one exchange, through the memory card module. */
+int secrman_auth_card(int port, int slot, int cnum)
+{
+	static u8 tx[CARD_AUTH_CMD_SIZE], rx[CARD_AUTH_CMD_SIZE];
+	struct secrman_sio2_transfer t = {
+		.port_ctrl0 = { [2] = 0xffc00505, [3] = 0xffc00505 },
+		.port_ctrl1 = { [2] = 0x000201f4, [3] = 0x000201f4 },
+		.tx_size = sizeof(tx),
+		.rx_size = sizeof(rx),
+		.tx = tx,
+		.rx = rx,
+	};
+	u32 cmd;
+
+	expect(port == CARD_PORT && !slot && !cnum);
+	expect(!sio2_owned);
+	expect(secrman_dev_id(port, slot) == SECRMAN_CARD_TYPE_PS2);
+
+	memcpy(&cmd, &(struct sio2_cmd) { .port = port, .cfg = 4,
+		.tx_size = sizeof(tx), .rx_size = sizeof(rx) }, sizeof(cmd));
+	t.cmd[0] = cmd;
+	tx[0] = MEMCARD_PREFIX;
+	tx[1] = CARD_CMD_AUTH;
+	memset(rx, 0, sizeof(rx));
+
+	card_auth.auths++;
+
+	if (!secrman_cmd(port, slot, &t))
+		return 0;
+
+	/* The port settings of the memory card module are restored. */
+	expect(!sio2_owned);
+	expect(sio2_sim.port2_ctrl0 == 0xff020405);
+
+	return rx[sizeof(rx) - 1] == MEMCARD_TERMINATOR &&
+		card_auth.authenticated;
+}
+
+void secrman_reset_auth_card(int port, int slot, int cnum)
+{
+}
+
+int request_irq(unsigned int irq, irq_handler_t cb, void *arg)
+{
+	expect(irq == IRQ_IOP_SIO2);
+	expect(cb == memcard_irq);
+
+	memcard = arg;
+
+	return 0;
+}
+
+void sif_request_cmd(int cid, sifcmd_handler handler, void *arg)
+{
+	expect(cid == SIF_CMD_MEMCARD);
+}
+
+int sif_cmd_opt_data(u32 cmd, u32 opt,
+	const void *payload, size_t payload_size,
+	main_addr_t dst, const void *src, size_t nbytes)
+{
+	expect(cmd == SIF_CMD_MEMCARD);
+	expect(nbytes <= sizeof(read_back.data));
+
+	read_back.size = nbytes;
+	memcpy(read_back.data, src, nbytes);
+
+	return 0;
+}
+
+int thsemap_create_sema(const struct iop_sema *sema)
+{
+	return 1;
+}
+
+int thsemap_isignal_sema(int semid)
+{
+	expect(!sema_signalled);
+	sema_signalled = true;
+
+	return 0;
+}
+
+/* Waits until the interrupt, or otherwise until the timer expires. */
+int thsemap_wait_sema(int semid)
+{
+	if (!sema_signalled && pending_timer) {
+		struct timer_list *timer = pending_timer;
+
+		pending_timer = NULL;
+		timer->function(timer);
+	}
+
+	expect(sema_signalled);
+	sema_signalled = false;
+
+	return 0;
+}
+
+u32 timer_jiffies(void)
+{
+	return 0;
+}
+
+int mod_timer(struct timer_list *timer, u32 expires)
+{
+	expect(expires == us_to_jiffies(MEMCARD_TIMEOUT_US));
+
+	pending_timer = timer;
+
+	return 0;
+}
+
+int del_timer(struct timer_list *timer)
+{
+	const bool pending = pending_timer == timer;
+
+	pending_timer = NULL;
+
+	return pending;
+}
+
+static void random_pages(u8 *data, size_t count)
+{
+	for (size_t i = 0; i < count * MEMCARD_PAGE_SIZE; i++)
+		data[i] = test_random();
+}
+
+static void test_ecc(void)
+{
+	for (int i = 0; i < 2000; i++) {
+		u8 chunk[MEMCARD_CHUNK_SIZE], copy[MEMCARD_CHUNK_SIZE];
+		u8 ecc[MEMCARD_ECC_SIZE];
+
+		for (int k = 0; k < sizeof(chunk); k++)
+			chunk[k] = test_random();
+		memcard_ecc(chunk, ecc);
+		memcpy(copy, chunk, sizeof(chunk));
+
+		expect(memcard_ecc_correct(copy, ecc) == 0);
+		expect(!memcmp(copy, chunk, sizeof(chunk)));
+
+		/* Single bit errors in data are corrected. */
+		const int bit = test_random() % (8 * sizeof(chunk));
+		copy[bit / 8] ^= 1 << (bit % 8);
+		expect(memcard_ecc_correct(copy, ecc) == 1);
+		expect(!memcmp(copy, chunk, sizeof(chunk)));
+
+		/* Single bit errors in the code leave data as it is. */
+		u8 bad[MEMCARD_ECC_SIZE];
+		const int code_bit = test_random() % (8 * sizeof(bad));
+		memcpy(bad, ecc, sizeof(bad));
+		bad[code_bit / 8] ^= 1 << (code_bit % 8);
+		const int n = memcard_ecc_correct(copy, bad);
+		expect(n == 0);
+		expect(!memcmp(copy, chunk, sizeof(chunk)));
+
+		/* Double bit errors in data are detected. */
+		const int other = (bit + 1 + test_random() %
+			(8 * sizeof(chunk) - 1)) % (8 * sizeof(chunk));
+		copy[bit / 8] ^= 1 << (bit % 8);
+		copy[other / 8] ^= 1 << (other % 8);
+		expect(memcard_ecc_correct(copy, ecc) == -EIO);
+	}
+
+	/* Erased chunks have erased codes. */
+	u8 erased[MEMCARD_CHUNK_SIZE];
+	u8 ecc[MEMCARD_ECC_SIZE];
+	memset(erased, 0xff, sizeof(erased));
+	memcard_ecc(erased, ecc);
+	expect(ecc[0] == 0x77 && ecc[1] == 0x7f && ecc[2] == 0x7f);
+}
+
+static void test_round_trip(void)
+{
+	static u8 data[MEMCARD_QUEUE_WRITE_PAGES * MEMCARD_PAGE_SIZE];
+
+	for (u32 page = 0; page < CARD_PAGES; page += 2) {
+		random_pages(data, 2);
+
+		expect(memcard_write(memcard, CARD_PORT, page, 2, data) == 0);
+		expect(!sio2_owned);
+
+		/* Flip a bit on the card, which reads correct it. */
+		const int bit = test_random() % (8 * MEMCARD_PAGE_SIZE);
+		card[page + 1].page[bit / 8] ^= 1 << (bit % 8);
+
+		expect(memcard_read(memcard, CARD_PORT, page, 2, 0x100000) == 0);
+		expect(!sio2_owned);
+		expect(read_back.size == 2 * MEMCARD_PAGE_SIZE);
+		expect(!memcmp(read_back.data, data, 2 * MEMCARD_PAGE_SIZE));
+	}
+
+	/* Two flipped bits in a chunk fail the read. */
+	card[0].page[0] ^= 0x01;
+	card[0].page[1] ^= 0x01;
+	expect(memcard_read(memcard, CARD_PORT, 0, 1, 0x100000) == -EIO);
+	expect(!sio2_owned);
+
+	/* Erased pages read back erased. */
+	expect(memcard_erase(memcard, CARD_PORT, 0, 1) == 0);
+	expect(memcard_read(memcard, CARD_PORT, 0, 1, 0x100000) == 0);
+	for (int i = 0; i < MEMCARD_PAGE_SIZE; i++)
+		expect(read_back.data[i] == 0xff);
+}
+
+static void test_auth(void)
+{
+	const int auths = card_auth.auths;
+	static u8 data[MEMCARD_PAGE_SIZE];
+
+	random_pages(data, 1);
+	expect(memcard_write(memcard, CARD_PORT, 8, 1, data) == 0);
+	expect(card_auth.auths == auths);
+
+	/* A replaced card fails once, and is then authenticated again. */
+	card_auth.authenticated = false;
+	expect(memcard_read(memcard, CARD_PORT, 8, 1, 0x100000) == -EIO);
+	expect(!sio2_owned);
+	expect(memcard_read(memcard, CARD_PORT, 8, 1, 0x100000) == 0);
+	expect(card_auth.auths == auths + 1);
+	expect(!memcmp(read_back.data, data, sizeof(data)));
+
+	/* Cards that fail authentication are not accessed. */
+	card_auth.authenticated = false;
+	card_auth.refuse = true;
+	expect(memcard_read(memcard, CARD_PORT, 8, 1, 0x100000) == -EIO);
+	expect(memcard_read(memcard, CARD_PORT, 8, 1, 0x100000) == -EACCES);
+	expect(memcard_write(memcard, CARD_PORT, 8, 1, data) == -EACCES);
+	expect(!sio2_owned);
+	expect(card_auth.auths == auths + 3);
+
+	card_auth.refuse = false;
+	expect(memcard_read(memcard, CARD_PORT, 8, 1, 0x100000) == 0);
+	expect(!memcmp(read_back.data, data, sizeof(data)));
+}
+
+static void bench(const char *name, int (*op)(u32 page, const u8 *data))
+{
+	static u8 data[MEMCARD_QUEUE_WRITE_PAGES * MEMCARD_PAGE_SIZE];
+	const u32 pages = BENCH_ROUNDS * 2;
+
+	random_pages(data, 2);
+	count.ios = 0;
+	count.wire = 0;
+
+	const u64 start = test_ns();
+	for (int i = 0; i < BENCH_ROUNDS; i++)
+		expect(op(2 * (i % (CARD_PAGES / 2)), data) == 0);
+	const u64 ns = test_ns() - start;
+
+	printf("memcard %s: %u ns, %u register accesses, "
+		"%u wire bytes per page\n", name, (u32)(ns / pages),
+		count.ios / pages, count.wire / pages);
+}
+
+static int bench_write(u32 page, const u8 *data)
+{
+	return memcard_write(memcard, CARD_PORT, page, 2, data);
+}
+
+static int bench_read(u32 page, const u8 *data)
+{
+	return memcard_read(memcard, CARD_PORT, page, 2, 0x100000);
+}
+
+static void test_timeout(void)
+{
+	static u8 data[MEMCARD_PAGE_SIZE];
+
+	random_pages(data, 1);
+
+	sio2_sim.hang = true;
+	expect(memcard_write(memcard, CARD_PORT, 4, 1, data) == -EIO);
+	expect(!memcard->busy);
+	expect(!sio2_owned);
+	sio2_sim.hang = false;
+
+	/* Late interrupts are not claimed. */
+	expect(memcard_irq(memcard) == IRQ_NONE);
+
+	expect(memcard_write(memcard, CARD_PORT, 4, 1, data) == 0);
+	expect(memcard_read(memcard, CARD_PORT, 4, 1, 0x100000) == 0);
+	expect(!memcmp(read_back.data, data, sizeof(data)));
+}
+
+int main(int argc, char *argv[])
+{
+	expect(memcard_init(argc, argv) == MODULE_RESIDENT);
+	expect(memcard);
+
+	test_ecc();
+	test_round_trip();
+	expect(card_auth.auths == 1);
+	test_auth();
+	test_timeout();
+
+	bench("write", bench_write);
+	bench("read", bench_read);
+
+	return 0;
+}
@@ -0,0 +1,153 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Allocate and free objects of pools at random, with fixed-length pools
+ * simulated in static memory, and check free lists and statistics.
+ */
+
+#include "../builtin/pool.c"
+
+#include <string.h>
+
+#include "iop.h"
+
+#define FPL_ID		7
+#define FPL_SIZE	65536
+#define MAX_OBJECTS	256
+#define ITERATIONS	100000
+
+static struct {
+	bool created;
+	bool allocated;
+	u32 block_size;
+	u8 memory[FPL_SIZE] __attribute__((aligned(16)));
+} fpl;
+
+int thfpool_create_fpl(struct iop_fpl_param *param)
+{
+	expect(!fpl.created);
+	expect(param->blocks == 1);
+
+	if (param->block_size > sizeof(fpl.memory))
+		return -400;	/* KE_NO_MEMORY */
+
+	fpl.created = true;
+	fpl.block_size = param->block_size;
+
+	return FPL_ID;
+}
+
+int thfpool_delete_fpl(int fplId)
+{
+	expect(fplId == FPL_ID);
+	expect(fpl.created);
+	expect(!fpl.allocated);
+
+	fpl.created = false;
+
+	return 0;
+}
+
+void *thfpool_pallocate_fpl(int fplId)
+{
+	expect(fplId == FPL_ID);
+	expect(fpl.created);
+	expect(!fpl.allocated);
+
+	fpl.allocated = true;
+
+	return fpl.memory;
+}
+
+int thfpool_free_fpl(int fplId, void *memory)
+{
+	expect(fplId == FPL_ID);
+	expect(fpl.allocated);
+	expect(memory == fpl.memory);
+
+	fpl.allocated = false;
+
+	return 0;
+}
+
+static void test_overflow(void)
+{
+	struct pool pool;
+
+	expect(pool_create(&pool, 16, 0) == -EINVAL);
+	expect(pool_create(&pool, 0x10000, 0x10000) == -EINVAL);
+	expect(pool_create(&pool, 0x40000000, 4) == -EINVAL);
+	expect(pool_create(&pool, 0xfffffffd, 1) == -EINVAL);
+	expect(pool_create(&pool, 0, 0x40000000) == -EINVAL);
+	expect(!fpl.created);
+
+	/* Too large for memory, but representable, fails in thfpool. */
+	expect(pool_create(&pool, 0x3fffffff & ~3, 1) == -EIO);
+	expect(!fpl.created);
+}
+
+static void test_objects(size_t size, u32 count)
+{
+	static void *objects[MAX_OBJECTS];
+	struct pool_stat stat;
+	struct pool pool;
+	u32 used = 0, max_used = 0, failed = 0;
+
+	expect(pool_create(&pool, size, count) == 0);
+	expect(pool.size >= size && pool.size % 4 == 0);
+	expect(fpl.block_size == pool.size * count);
+
+	for (int i = 0; i < ITERATIONS; i++) {
+		if (test_random() % 2) {
+			void *obj = pool_alloc(&pool);
+
+			if (used == count) {
+				expect(!obj);
+				failed++;
+				continue;
+			}
+
+			/* Objects are distinct, aligned and within the block. */
+			expect(obj);
+			expect((u8 *)obj >= fpl.memory);
+			expect((u8 *)obj - fpl.memory <= fpl.block_size - pool.size);
+			expect(((u8 *)obj - fpl.memory) % pool.size == 0);
+			for (u32 k = 0; k < used; k++)
+				expect(objects[k] != obj);
+
+			memset(obj, 0xa5, size);
+			objects[used++] = obj;
+			max_used = max(max_used, used);
+		} else if (used) {
+			const u32 k = test_random() % used;
+
+			pool_free(&pool, objects[k]);
+			objects[k] = objects[--used];
+		}
+	}
+
+	pool_free(&pool, NULL);
+
+	pool_stat(&pool, &stat);
+	expect(stat.count == count);
+	expect(stat.used == used);
+	expect(stat.max_used == max_used);
+	expect(stat.failed == failed);
+
+	while (used)
+		pool_free(&pool, objects[--used]);
+
+	pool_destroy(&pool);
+	expect(!fpl.created && !fpl.allocated);
+}
+
+int main(int argc, char *argv[])
+{
+	test_overflow();
+
+	test_objects(1, 1);
+	test_objects(5, 16);
+	test_objects(64, MAX_OBJECTS);
+	test_objects(130, 100);
+
+	return 0;
+}
@@ -0,0 +1,144 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Stress a ring buffer with a producer and a consumer thread, plain and
+ * paired with a semaphore, and check that entries arrive exactly once and
+ * in order. Threads yield when the ring is full or empty, so that the test
+ * also progresses on a single host processor.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+
+#include "iopmod/ring.h"
+
+#include "iop.h"
+
+#define ENTRIES		(1 << 22)
+
+static DECLARE_RING(test_ring, u32, 64) ring;
+
+static sem_t sema;
+
+int thsemap_create_sema(const struct iop_sema *iop_sema)
+{
+	expect(iop_sema->initial == 0);
+	expect(iop_sema->max == ring_capacity(&ring));
+	expect(sem_init(&sema, 0, 0) == 0);
+
+	return 1;
+}
+
+int thsemap_signal_sema(int semid)
+{
+	expect(semid == 1);
+
+	return sem_post(&sema);
+}
+
+int thsemap_wait_sema(int semid)
+{
+	expect(semid == 1);
+
+	return sem_wait(&sema);
+}
+
+static void *producer(void *arg)
+{
+	for (u32 i = 0; i < ENTRIES; i++) {
+		/* Vary the pace, to alternate between full and empty rings. */
+		if (test_random() % 1024 == 0)
+			sched_yield();
+
+		while (!ring_put(&ring, i))
+			sched_yield();
+	}
+
+	return NULL;
+}
+
+static void *consumer(void *arg)
+{
+	for (u32 i = 0; i < ENTRIES; i++) {
+		u32 value;
+
+		while (!ring_get(&ring, &value))
+			sched_yield();
+
+		expect(value == i);
+		expect(ring_count(&ring) <= ring_capacity(&ring));
+	}
+
+	return NULL;
+}
+
+/* Each entry is signalled once, so a wait always gets an entry. */
+static void *sema_producer(void *arg)
+{
+	const int sema_id = *(int *)arg;
+
+	for (u32 i = 0; i < ENTRIES; i++)
+		while (!ring_put_signal(&ring, i, sema_id))
+			sched_yield();
+
+	return NULL;
+}
+
+static void *sema_consumer(void *arg)
+{
+	const int sema_id = *(int *)arg;
+
+	for (u32 i = 0; i < ENTRIES; i++) {
+		u32 value;
+
+		expect(ring_wait_get(&ring, &value, sema_id));
+		expect(value == i);
+	}
+
+	return NULL;
+}
+
+static void run(void *(*produce)(void *), void *(*consume)(void *), void *arg)
+{
+	pthread_t p, c;
+
+	expect(pthread_create(&c, NULL, consume, arg) == 0);
+	expect(pthread_create(&p, NULL, produce, arg) == 0);
+	expect(pthread_join(p, NULL) == 0);
+	expect(pthread_join(c, NULL) == 0);
+
+	expect(ring_empty(&ring));
+}
+
+static void test_single_thread(void)
+{
+	u32 value;
+
+	expect(ring_empty(&ring));
+	expect(!ring_get(&ring, &value));
+
+	for (u32 i = 0; i < ring_capacity(&ring); i++)
+		expect(ring_put(&ring, i));
+	expect(ring_full(&ring));
+	expect(!ring_put(&ring, 0));
+
+	for (u32 i = 0; i < ring_capacity(&ring); i++) {
+		expect(ring_get(&ring, &value));
+		expect(value == i);
+	}
+	expect(ring_empty(&ring));
+}
+
+int main(int argc, char *argv[])
+{
+	test_single_thread();
+
+	/* The indices wrap around in the second run. */
+	ring.head = ring.tail = -ENTRIES / 2;
+	run(producer, consumer, NULL);
+
+	int sema_id = ring_create_sema(&ring);
+	run(sema_producer, sema_consumer, &sema_id);
+
+	return 0;
+}
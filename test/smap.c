@@ -0,0 +1,948 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Enable a simulated SMAP with its PHY and EEPROM, and check the MAC address,
+ * autonegotiated link modes, transmitted and received frames, frames per
+ * receive interrupt, transmit timeouts, the order of requests, receive ring
+ * announcements and polling selection. Also load the receive and transmit
+ * paths and measure them.
+ */
+
+#include "../module/smap.c"
+
+#include <stdio.h>
+
+#include "iop.h"
+
+#define RING_ADDR	0x100000
+#define RING_SIZE	16384
+#define FRAMES		20000
+#define BENCH_FRAMES	200000
+
+static const u8 eeprom_mac[] = { 0x00, 0x15, 0xc1, 0x2a, 0x3b, 0x4c };
+
+static struct smap_dev *smap;
+static sifcmd_handler smap_cmd;
+
+static struct {
+	u16 reg[0x4000 / 2];
+	u8 txfifo[SMAP_TX_BUFSIZE];
+	u8 rxfifo[SMAP_RX_BUFSIZE];
+	u16 tx_ptr;
+	u16 rx_ptr;
+	int tx_bd;
+	int rx_bd;
+	u16 rx_fifo_ptr;
+	bool hang;		/* Transmit FIFO never drains if set. */
+} sim;
+
+static struct sim_phy {
+	u16 bmcr;
+	u16 advertise;
+	u16 lpa;
+	int reset_reads;	/* Reads until the reset completes. */
+	bool autoneg;
+	bool link;
+} phy;
+
+static struct {
+	u16 word[64];
+	int edges;
+	u32 cmd;
+	bool dout;
+} eeprom;
+
+static struct {
+	irq_handler_t txend;
+	irq_handler_t rxend;
+	irq_handler_t rx_thread;
+	enum irq_poll rx_poll;
+} irq;
+
+static bool link_timer;
+static bool defer_work;
+static struct work_struct *deferred_work;
+static struct timer_list *pending_timer;
+static bool sema_signalled;
+static int dev9_use_count;
+
+static struct {
+	int count;
+	struct smap_sif_mac_ack mac;
+	struct smap_sif_ack tx;
+} ack;
+
+static u8 ring[RING_SIZE];
+
+/* Frames expected by the main processor, in order. */
+static struct {
+	u16 length;
+	u8 data[SMAP_FRAME_MAX];
+} rx_frames[SMAP_BD_COUNT], tx_frames[MAX_SMAP_SIF_TX];
+static int rx_head, rx_tail;
+static int tx_sent;
+
+static u16 *reg(u32 addr)
+{
+	const u32 offset = addr - SPD_REGBASE;
+
+	expect(offset < sizeof(sim.reg) && !(offset & 1));
+
+	return &sim.reg[offset / 2];
+}
+
+static u32 emac3(u32 offset)
+{
+	return (*reg(SMAP_REG(offset)) << 16) | *reg(SMAP_REG(offset + 2));
+}
+
+static void phy_write(u32 r, u16 value)
+{
+	switch (r) {
+	case SMAP_MII_BMCR:
+		if (value & SMAP_BMCR_RESET) {
+			phy = (struct sim_phy) {
+				.lpa = phy.lpa,
+				.link = phy.link
+			};
+			phy.bmcr = SMAP_BMCR_RESET;
+			phy.reset_reads = 3;
+		} else {
+			expect(!phy.reset_reads);
+			phy.bmcr = value & ~SMAP_BMCR_ANRESTART;
+			phy.autoneg = value & SMAP_BMCR_ANENABLE &&
+				value & SMAP_BMCR_ANRESTART;
+		}
+		break;
+	case SMAP_MII_ADVERTISE:
+		phy.advertise = value;
+		break;
+	default:
+		test_fail(__FILE__, __LINE__, "known PHY register");
+	}
+}
+
+static u16 phy_read(u32 r)
+{
+	switch (r) {
+	case SMAP_MII_BMCR:
+		if (phy.reset_reads && !--phy.reset_reads)
+			phy.bmcr = 0;
+		return phy.bmcr;
+	case SMAP_MII_BMSR:
+		return phy.autoneg && phy.link ?
+			SMAP_BMSR_LSTATUS | SMAP_BMSR_ANEGCOMPLETE : 0;
+	case SMAP_MII_LPA:
+		expect(phy.autoneg && phy.link);
+		return phy.lpa & phy.advertise;
+	default:
+		test_fail(__FILE__, __LINE__, "known PHY register");
+	}
+}
+
+/* The STA operation is started by writing the low half of the control. */
+static void sta_ctrl(void)
+{
+	u16 *hi = reg(SMAP_REG(SMAP_REG_EMAC3_STA_CTRL));
+	u16 *lo = hi + 1;
+
+	expect(((*lo >> SMAP_E3_PHY_ADDR_SHIFT) & 0x1f) == SMAP_PHY_ADDR);
+
+	if (*lo & SMAP_E3_PHY_READ)
+		*hi = phy_read(*lo & 0x1f);
+	else if (*lo & SMAP_E3_PHY_WRITE)
+		phy_write(*lo & 0x1f, *hi);
+	else
+		test_fail(__FILE__, __LINE__, "STA operation");
+
+	*lo |= SMAP_E3_PHY_OP_COMPLETE;
+}
+
+/* Serial EEPROM with commands clocked in on rising clock edges. */
+static void eeprom_pins(u8 pins)
+{
+	static u8 prev;
+
+	expect(*reg(SPD_REG(SPD_REG_PIO_DIR)) ==
+		(SPD_PIO_CSEL | SPD_PIO_SCLK | SPD_PIO_DIN));
+
+	if (!(pins & SPD_PIO_CSEL)) {
+		eeprom.edges = 0;
+		eeprom.cmd = 0;
+		eeprom.dout = false;
+	} else if ((pins & SPD_PIO_SCLK) && !(prev & SPD_PIO_SCLK)) {
+		const int n = ++eeprom.edges;
+		const int cmd_bits = 3 + SMAP_EEPROM_ADDR_BITS;
+
+		if (n <= cmd_bits)
+			eeprom.cmd = (eeprom.cmd << 1) | !!(pins & SPD_PIO_DIN);
+
+		if (n == cmd_bits) {
+			expect(eeprom.cmd >> SMAP_EEPROM_ADDR_BITS ==
+				(4 | SMAP_EEPROM_OP_READ));
+			eeprom.dout = false;	/* Dummy bit */
+		} else if (n > cmd_bits && n <= cmd_bits + 16) {
+			const u32 addr = eeprom.cmd &
+				((1 << SMAP_EEPROM_ADDR_BITS) - 1);
+
+			eeprom.dout = (eeprom.word[addr] >>
+				(cmd_bits + 16 - n)) & 1;
+		}
+	}
+
+	prev = pins;
+}
+
+u8 iord8(const u32 addr)
+{
+	expect(addr == SPD_REG(SPD_REG_PIO_DATA));
+
+	return eeprom.dout ? SPD_PIO_DOUT : 0;
+}
+
+void iowr8(u8 value, u32 addr)
+{
+	if (addr == SPD_REG(SPD_REG_PIO_DATA))
+		eeprom_pins(value);
+	else if (addr == SPD_REG(SPD_REG_PIO_DIR))
+		*reg(addr) = value;
+	else
+		expect(value == 1 &&
+			(addr == SMAP_REG(SMAP_REG_TXFIFO_FRAME_INC) ||
+			 addr == SMAP_REG(SMAP_REG_RXFIFO_FRAME_DEC)));
+}
+
+u16 iord16(const u32 addr)
+{
+	return *reg(addr);
+}
+
+void iowr16(u16 value, u32 addr)
+{
+	if (addr == SMAP_REG(SMAP_REG_TXFIFO_CTRL) ||
+	    addr == SMAP_REG(SMAP_REG_RXFIFO_CTRL))
+		value = 0;	/* Resets complete at once. */
+	else if (addr == SMAP_REG(SMAP_REG_EMAC3_MODE0))
+		value &= ~(SMAP_E3_SOFT_RESET >> 16);
+	else if (addr == SMAP_REG(SMAP_REG_TXFIFO_WR_PTR))
+		sim.tx_ptr = value;
+	else if (addr == SMAP_REG(SMAP_REG_RXFIFO_RD_PTR))
+		sim.rx_ptr = value % SMAP_RX_BUFSIZE;
+
+	*reg(addr) = value;
+
+	if (addr == SMAP_REG(SMAP_REG_EMAC3_STA_CTRL + 2))
+		sta_ctrl();
+}
+
+u32 iord32(const u32 addr)
+{
+	expect(addr == SMAP_REG(SMAP_REG_RXFIFO_DATA));
+
+	u32 value;
+	memcpy(&value, &sim.rxfifo[sim.rx_ptr], sizeof(value));
+	sim.rx_ptr = (sim.rx_ptr + 4) % SMAP_RX_BUFSIZE;
+
+	return value;
+}
+
+void iowr32(u32 value, u32 addr)
+{
+	expect(addr == SMAP_REG(SMAP_REG_TXFIFO_DATA));
+
+	memcpy(&sim.txfifo[sim.tx_ptr], &value, sizeof(value));
+	sim.tx_ptr = (sim.tx_ptr + 4) % SMAP_TX_BUFSIZE;
+}
+
+/* Send the frames that are ready, and interrupt unless already sent. */
+static void tx_drain(void)
+{
+	bool sent = false;
+
+	expect(emac3(SMAP_REG_EMAC3_MODE0) & SMAP_E3_TXMAC_ENABLE);
+
+	for (;;) {
+		const u32 bd = smap_tx_bd(sim.tx_bd);
+		const u16 stat = smap_rd_bd(bd, ctrl_stat);
+		const u16 length = smap_rd_bd(bd, length);
+		const u16 ptr = smap_rd_bd(bd, pointer) - SMAP_TX_BASE;
+
+		if (!(stat & SMAP_BD_TX_READY))
+			break;
+
+		expect(tx_sent < ARRAY_SIZE(tx_frames));
+		expect(length == tx_frames[tx_sent].length);
+		for (int i = 0; i < length; i++)
+			expect(sim.txfifo[(ptr + i) % SMAP_TX_BUFSIZE] ==
+				tx_frames[tx_sent].data[i]);
+
+		smap_wr_bd(0, bd, ctrl_stat);
+		sim.tx_bd = (sim.tx_bd + 1) % SMAP_BD_COUNT;
+		tx_sent++;
+		sent = true;
+	}
+
+	if (sent)
+		expect(irq.txend(smap) == IRQ_HANDLED);
+}
+
+int dev9_request(void)
+{
+	return !dev9_use_count++;
+}
+
+int dev9_release(void)
+{
+	expect(dev9_use_count-- > 0);
+
+	return 0;
+}
+
+int request_irq(unsigned int i, irq_handler_t cb, void *arg)
+{
+	expect(i == IRQ_IOP_SPD_TXEND && !irq.txend);
+	expect(dev9_use_count);
+
+	irq.txend = cb;
+
+	return 0;
+}
+
+int request_threaded_irq(unsigned int i, irq_handler_t handler,
+	irq_handler_t thread_fn, void *arg)
+{
+	expect(i == IRQ_IOP_SPD_RXEND && !irq.rxend);
+	expect(dev9_use_count);
+
+	irq.rxend = handler;
+	irq.rx_thread = thread_fn;
+
+	return 0;
+}
+
+int set_irq_poll(unsigned int i, enum irq_poll poll)
+{
+	expect(i == IRQ_IOP_SPD_RXEND);
+
+	if (poll > IRQ_POLL_UNMASKED)
+		return -EINVAL;
+
+	irq.rx_poll = poll;
+
+	return 0;
+}
+
+int release_irq(unsigned int i, irq_handler_t handler, void *arg)
+{
+	expect(dev9_use_count);
+
+	if (i == IRQ_IOP_SPD_TXEND) {
+		expect(handler == irq.txend);
+		irq.txend = NULL;
+	} else {
+		expect(i == IRQ_IOP_SPD_RXEND && handler == irq.rx_thread);
+		irq.rxend = NULL;
+		irq.rx_thread = NULL;
+	}
+
+	return 0;
+}
+
+/* Work is done at once, except for the link poll, done by the test. */
+bool queue_work(unsigned int wq, struct work_struct *work)
+{
+	expect(wq == WQ_NORMAL);
+
+	if (defer_work) {
+		expect(!deferred_work || deferred_work == work);
+		deferred_work = work;
+	} else
+		work->func(work);
+
+	return true;
+}
+
+static void run_deferred_work(void)
+{
+	struct work_struct *work = deferred_work;
+
+	expect(work);
+	defer_work = false;
+	deferred_work = NULL;
+	work->func(work);
+}
+
+static void poll_link(void)
+{
+	expect(link_timer);
+	link_timer = false;
+	smap->up.link_timer.function(&smap->up.link_timer);
+}
+
+void sif_request_cmd(int cid, sifcmd_handler handler, void *arg)
+{
+	expect(cid == SIF_CMD_SMAP);
+
+	smap_cmd = handler;
+	smap = arg;
+}
+
+static void command(int op, int count, const void *payload, size_t size)
+{
+	struct {
+		struct sif_cmd_header header;
+		u8 payload[CMD_PACKET_PAYLOAD_MAX];
+	} cmd = {
+		.header = {
+			.cmd = SIF_CMD_SMAP,
+			.opt = (union smap_sif_opt) {
+				.op = op,
+				.count = count
+			}.raw,
+		},
+	};
+
+	expect(size <= sizeof(cmd.payload));
+	memcpy(cmd.payload, payload, size);
+
+	smap_cmd(&cmd.header, smap);
+}
+
+static void sif_ack(union smap_sif_opt opt,
+	const void *payload, size_t payload_size)
+{
+	switch (opt.op) {
+	case rop_mac:
+		expect(payload_size == sizeof(ack.mac));
+		memcpy(&ack.mac, payload, payload_size);
+		break;
+	case rop_tx:
+		expect(payload_size == sizeof(ack.tx));
+		memcpy(&ack.tx, payload, payload_size);
+		break;
+	default:
+		return;
+	}
+
+	ack.count++;
+}
+
+/* Check received frames against those expected, and return the space. */
+static void sif_rx(union smap_sif_opt opt, const struct smap_sif_rx *rx,
+	main_addr_t dst, const void *src, size_t nbytes)
+{
+	expect(dst == RING_ADDR + rx->offset);
+	expect(rx->offset + nbytes <= RING_SIZE);
+
+	memcpy(&ring[rx->offset], src, nbytes);
+
+	u32 offset = rx->offset;
+	for (int i = 0; i < opt.count; i++) {
+		expect(rx_tail != rx_head);
+		expect(rx->length[i] == rx_frames[rx_tail].length);
+		expect(!memcmp(&ring[offset], rx_frames[rx_tail].data,
+			rx->length[i]));
+
+		offset += ALIGN(rx->length[i], SMAP_RX_ALIGN);
+		rx_tail = (rx_tail + 1) % SMAP_BD_COUNT;
+	}
+	expect(offset == rx->offset + nbytes);
+
+	const struct smap_sif_rx_done done = { .tail = rx->head };
+	command(rop_rx_done, 0, &done, sizeof(done));
+}
+
+int sif_cmd_opt_data(u32 cmd, u32 opt,
+	const void *payload, size_t payload_size,
+	main_addr_t dst, const void *src, size_t nbytes)
+{
+	const union smap_sif_opt o = { .raw = opt };
+
+	expect(cmd == SIF_CMD_SMAP);
+
+	if (o.op == rop_rx)
+		sif_rx(o, payload, dst, src, nbytes);
+	else
+		sif_ack(o, payload, payload_size);
+
+	return 0;
+}
+
+int thsemap_create_sema(const struct iop_sema *sema)
+{
+	return 1;
+}
+
+int thsemap_isignal_sema(int semid)
+{
+	sema_signalled = true;
+
+	return 0;
+}
+
+/* Waits until frames are sent, or otherwise until the timer expires. */
+int thsemap_wait_sema(int semid)
+{
+	if (!sema_signalled && !sim.hang)
+		tx_drain();
+
+	if (!sema_signalled && pending_timer) {
+		struct timer_list *timer = pending_timer;
+
+		pending_timer = NULL;
+		timer->function(timer);
+	}
+
+	expect(sema_signalled);
+	sema_signalled = false;
+
+	return 0;
+}
+
+int thbase_delay(int usec)
+{
+	test_clock += usec;
+
+	return 0;
+}
+
+u32 timer_jiffies(void)
+{
+	return 0;
+}
+
+int mod_timer(struct timer_list *timer, u32 expires)
+{
+	if (timer == &smap->up.link_timer) {
+		expect(expires == us_to_jiffies(SMAP_LINK_POLL_US));
+		link_timer = true;
+	} else {
+		expect(timer == &smap->tx.timeout);
+		expect(expires == us_to_jiffies(SMAP_TX_TIMEOUT_US));
+		pending_timer = timer;
+	}
+
+	return 0;
+}
+
+int del_timer(struct timer_list *timer)
+{
+	bool pending;
+
+	if (timer == &smap->up.link_timer) {
+		pending = link_timer;
+		link_timer = false;
+	} else {
+		pending = pending_timer == timer;
+		pending_timer = NULL;
+	}
+
+	return pending;
+}
+
+static void enable(const struct smap_sif_mac *mac)
+{
+	const int count = ack.count;
+
+	command(rop_mac, 0, mac, sizeof(*mac));
+
+	expect(ack.count == count + 1);
+}
+
+static void write_eeprom(const u8 *mac)
+{
+	u16 sum = 0;
+
+	for (int i = 0; i < SMAP_EEPROM_MAC_WORDS; i++) {
+		eeprom.word[i] = mac[2 * i] | (mac[2 * i + 1] << 8);
+		sum += eeprom.word[i];
+	}
+	eeprom.word[SMAP_EEPROM_MAC_WORDS] = sum;
+}
+
+static void test_enable(void)
+{
+	const struct smap_sif_mac zero = { };
+	const struct smap_sif_mac given = {
+		.addr = { 0x02, 0x11, 0x22, 0x33, 0x44, 0x55 }
+	};
+
+	/* A bad EEPROM checksum fails, and leaves DEV9 unused. */
+	write_eeprom(eeprom_mac);
+	eeprom.word[SMAP_EEPROM_MAC_WORDS] ^= 1;
+	enable(&zero);
+	expect(ack.mac.status == -EIO);
+	expect(!smap->up.enabled && !dev9_use_count && !irq.txend);
+
+	/* The EEPROM address is used unless one is given. */
+	write_eeprom(eeprom_mac);
+	enable(&zero);
+	expect(ack.mac.status == 0);
+	expect(!memcmp(ack.mac.mac.addr, eeprom_mac, sizeof(eeprom_mac)));
+	expect(emac3(SMAP_REG_EMAC3_ADDR_HI) == 0x0015);
+	expect(emac3(SMAP_REG_EMAC3_ADDR_LO) == 0xc12a3b4c);
+	expect(dev9_use_count == 1 && irq.txend && irq.rxend);
+
+	enable(&given);
+	expect(ack.mac.status == 0);
+	expect(!memcmp(ack.mac.mac.addr, given.addr, sizeof(given.addr)));
+	expect(emac3(SMAP_REG_EMAC3_ADDR_LO) == 0x22334455);
+	expect(dev9_use_count == 1);
+
+	/* The PHY was reset and autonegotiates all modes. */
+	expect(phy.autoneg);
+	expect(phy.advertise == (SMAP_LPA_100FULL | SMAP_LPA_100HALF |
+		SMAP_LPA_10FULL | SMAP_LPA_10HALF | SMAP_ADVERTISE_CSMA));
+}
+
+static void test_link(void)
+{
+	const struct {
+		u16 lpa;
+		bool fdx;
+		bool speed100;
+	} modes[] = {
+		{ SMAP_LPA_10HALF, false, false },
+		{ SMAP_LPA_10HALF | SMAP_LPA_10FULL, true, false },
+		{ SMAP_LPA_10FULL | SMAP_LPA_100HALF, false, true },
+		{ SMAP_LPA_100HALF | SMAP_LPA_100FULL, true, true },
+	};
+
+	for (int i = 0; i < ARRAY_SIZE(modes); i++) {
+		phy.link = false;
+		poll_link();
+		expect(!smap->up.link);
+		expect(!emac3(SMAP_REG_EMAC3_MODE0));
+
+		phy.lpa = modes[i].lpa;
+		phy.link = true;
+		poll_link();
+		expect(smap->up.link);
+
+		const u32 mode1 = emac3(SMAP_REG_EMAC3_MODE1);
+		expect(!!(mode1 & SMAP_E3_FDX_ENABLE) == modes[i].fdx);
+		expect(!!(mode1 & SMAP_E3_MEDIA_100M) == modes[i].speed100);
+		expect(emac3(SMAP_REG_EMAC3_MODE0) ==
+			(SMAP_E3_TXMAC_ENABLE | SMAP_E3_RXMAC_ENABLE));
+	}
+
+	/* The link remains up, and is polled again. */
+	poll_link();
+	expect(smap->up.link && link_timer);
+}
+
+/* Request a batch of frames, as many as fit in the transmit buffer. */
+static void tx_batch(int count, size_t min_length)
+{
+	struct smap_sif_tx sg;
+	size_t offset = 0;
+	int n = 0;
+
+	for (int i = 0; i < count; i++) {
+		const size_t length = min_length +
+			test_random() % (SMAP_FRAME_MAX - min_length + 1);
+
+		if (offset + ALIGN(length, 4) > sizeof(smap->wb))
+			break;
+
+		tx_frames[i].length = length;
+		for (size_t k = 0; k < length; k++)
+			tx_frames[i].data[k] = smap->wb[offset + k] =
+				test_random();
+
+		sg.entry[i] = (struct smap_sif_tx_entry) {
+			.offset = offset,
+			.length = length,
+		};
+		offset += ALIGN(length, 4);
+		n++;
+	}
+
+	tx_sent = 0;
+	command(rop_tx, n, &sg, n * sizeof(sg.entry[0]));
+}
+
+static void test_tx(void)
+{
+	const struct smap_sif_ring r = { .addr = RING_ADDR, .size = RING_SIZE };
+
+	command(rop_ring, 0, &r, sizeof(r));
+
+	for (int i = 0; i < 500; i++) {
+		const int count = ack.count;
+
+		tx_batch(1 + test_random() % MAX_SMAP_SIF_TX, 1);
+		expect(ack.count == count + 1);
+		expect(ack.tx.status == 0);
+
+		/* Frames in flight are sent before the next batch. */
+		tx_drain();
+		expect(!smap->tx.inflight);
+	}
+
+	expect(smap->stat.tx_frames > 500);
+	expect(!smap->stat.tx_errors);
+}
+
+static void test_tx_timeout(void)
+{
+	/* Frames beyond the FIFO space time out if it never drains. */
+	sim.hang = true;
+	tx_batch(MAX_SMAP_SIF_TX, SMAP_FRAME_MAX / 2);
+	expect(ack.tx.status == -EIO);
+	expect(!pending_timer);
+	sim.hang = false;
+
+	/* A reset recovers, and the link comes up again. */
+	enable(&(struct smap_sif_mac) { });
+	expect(ack.mac.status == 0);
+	poll_link();
+	expect(smap->up.link);
+
+	sim.tx_bd = 0;
+	tx_batch(4, 1);
+	expect(ack.tx.status == 0);
+	tx_drain();
+	expect(tx_sent == 4);
+
+	/* Transmissions fail without a link. */
+	phy.link = false;
+	poll_link();
+	tx_batch(1, 1);
+	expect(ack.tx.status == -EIO);
+	phy.link = true;
+	poll_link();
+}
+
+static u16 rx_frame_length(u16 length)
+{
+	const u32 bd = smap_rx_bd(sim.rx_bd);
+
+	expect(smap_rd_bd(bd, ctrl_stat) & SMAP_BD_RX_EMPTY);
+
+	rx_frames[rx_head].length = length;
+	for (int i = 0; i < ALIGN(length, 4); i++) {
+		const u8 byte = test_random();
+
+		sim.rxfifo[(sim.rx_fifo_ptr + i) % SMAP_RX_BUFSIZE] = byte;
+		if (i < length)
+			rx_frames[rx_head].data[i] = byte;
+	}
+	rx_head = (rx_head + 1) % SMAP_BD_COUNT;
+
+	smap_wr_bd(length, bd, length);
+	smap_wr_bd(SMAP_RX_BASE + sim.rx_fifo_ptr, bd, pointer);
+	smap_wr_bd(0, bd, ctrl_stat);
+
+	sim.rx_fifo_ptr = (sim.rx_fifo_ptr + ALIGN(length, 4)) %
+		SMAP_RX_BUFSIZE;
+	sim.rx_bd = (sim.rx_bd + 1) % SMAP_BD_COUNT;
+
+	return ALIGN(length, 4);
+}
+
+/* Mostly short frames, so that bursts exceed the receive budget. */
+static u16 rx_frame(void)
+{
+	return rx_frame_length(14 + test_random() % (test_random() % 4 ?
+		128 : SMAP_FRAME_MAX - 13));
+}
+
+static void rx_interrupt(void)
+{
+	expect(irq.rxend(smap) == IRQ_WAKE_THREAD);
+	while (irq.rx_thread(smap) == IRQ_WAKE_THREAD)
+		;
+}
+
+static void test_rx(void)
+{
+	const struct smap_sif_stat before = smap->stat;
+	u32 per_irq[ARRAY_SIZE(before.rx_per_irq)] = { };
+	int received = 0;
+
+	sim.rx_bd = smap->rx.bd;
+
+	while (received < FRAMES) {
+		const int burst = 1 + test_random() % (SMAP_BD_COUNT - 1);
+		size_t fifo = 0;
+		int i;
+
+		/* The receive FIFO holds the frames of a burst. */
+		for (i = 0; i < burst && fifo + ALIGN(SMAP_FRAME_MAX, 4) <=
+				SMAP_RX_BUFSIZE; i++, received++)
+			fifo += rx_frame();
+
+		rx_interrupt();
+
+		expect(rx_tail == rx_head);
+		per_irq[min_t(int, fls(i), ARRAY_SIZE(per_irq) - 1)]++;
+	}
+
+	expect(smap->stat.rx_frames == received);
+	expect(!smap->stat.rx_dropped && !smap->stat.rx_errors);
+
+	/* Each interrupt drains its burst. */
+	for (int i = 0; i < ARRAY_SIZE(per_irq); i++)
+		expect(smap->stat.rx_per_irq[i] - before.rx_per_irq[i] ==
+			per_irq[i]);
+
+	/* Interrupts without frames are reported too. */
+	rx_interrupt();
+	expect(smap->stat.rx_per_irq[0] == before.rx_per_irq[0] + 1);
+}
+
+static void test_ring(void)
+{
+	const struct smap_sif_ring r = { .addr = RING_ADDR, .size = RING_SIZE };
+	const u32 head = smap->ring.head;
+	const int frame = rx_head;
+
+	/* A new ring is taken into use by the receive thread. */
+	expect(head);
+	command(rop_ring, 0, &r, sizeof(r));
+	expect(smap->ring.head == head && smap->ring.announced);
+
+	rx_frame();
+	rx_interrupt();
+	expect(!smap->ring.announced);
+	expect(smap->ring.head ==
+		ALIGN(rx_frames[frame].length, SMAP_RX_ALIGN));
+}
+
+static void test_poll(void)
+{
+	/* The main processor selects how the receive thread is polled. */
+	command(rop_poll, 0, &(struct smap_sif_poll) {
+		.poll = IRQ_POLL_UNMASKED }, sizeof(struct smap_sif_poll));
+	expect(irq.rx_poll == IRQ_POLL_UNMASKED);
+
+	command(rop_poll, 0, &(struct smap_sif_poll) {
+		.poll = IRQ_POLL_UNMASKED + 1 }, sizeof(struct smap_sif_poll));
+	expect(irq.rx_poll == IRQ_POLL_UNMASKED);
+
+	command(rop_poll, 0, &(struct smap_sif_poll) {
+		.poll = IRQ_POLL_YIELD }, sizeof(struct smap_sif_poll));
+	expect(irq.rx_poll == IRQ_POLL_YIELD);
+}
+
+static void test_order(void)
+{
+	const struct smap_sif_mac zero = { };
+	const int count = ack.count;
+
+	/* Disabling after enabling, before the work runs, disables. */
+	defer_work = true;
+	command(rop_mac, 0, &zero, sizeof(zero));
+	command(rop_down, 0, NULL, 0);
+	run_deferred_work();
+	expect(ack.count == count + 1 && ack.mac.status == 0);
+	expect(!smap->up.enabled && !dev9_use_count && !link_timer);
+
+	/* Enabling after disabling enables. */
+	defer_work = true;
+	command(rop_down, 0, NULL, 0);
+	command(rop_mac, 0, &zero, sizeof(zero));
+	run_deferred_work();
+	expect(ack.count == count + 2 && ack.mac.status == 0);
+	expect(smap->up.enabled && dev9_use_count == 1 && link_timer);
+
+	poll_link();
+	expect(smap->up.link);
+}
+
+/* Bursts of frames of a length, each burst with a receive interrupt. */
+static void bench_rx(u16 length, int burst)
+{
+	const struct smap_sif_stat before = smap->stat;
+	int frames = 0;
+
+	sim.rx_bd = smap->rx.bd;
+	const u64 start = test_ns();
+	while (frames < BENCH_FRAMES) {
+		for (int i = 0; i < burst; i++, frames++)
+			rx_frame_length(length);
+
+		rx_interrupt();
+	}
+	const u64 ns = test_ns() - start;
+
+	const u32 irqs = smap->stat.rx_irqs - before.rx_irqs;
+	const u32 polls = smap->stat.rx_polls - before.rx_polls;
+
+	expect(smap->stat.rx_frames - before.rx_frames == frames);
+	expect(rx_tail == rx_head);
+
+	printf("smap rx %4u bytes, bursts of %2d: %5u ns per frame, "
+		"%.2f frames and %.2f polls per interrupt\n",
+		length, burst, (u32)(ns / frames),
+		(double)frames / irqs, (double)polls / irqs);
+}
+
+/* Batches of frames of at least a length, as many as fit the buffer. */
+static void bench_tx(size_t min_length)
+{
+	const u32 sent = smap->stat.tx_frames;
+	int batches = 0;
+
+	sim.tx_bd = smap->tx.bd;
+	const u64 start = test_ns();
+	while (smap->stat.tx_frames - sent < BENCH_FRAMES / 10) {
+		tx_batch(MAX_SMAP_SIF_TX, min_length);
+		expect(ack.tx.status == 0);
+		tx_drain();
+		batches++;
+	}
+	const u64 ns = test_ns() - start;
+
+	const u32 frames = smap->stat.tx_frames - sent;
+
+	printf("smap tx %4zu+ bytes: %5u ns per frame, %.2f frames per batch\n",
+		min_length, (u32)(ns / frames), (double)frames / batches);
+}
+
+/* Host time includes the simulated SMAP and the checks of the frames. */
+static void bench(void)
+{
+	bench_rx(64, 1);
+	bench_rx(64, 8);
+	bench_rx(64, 32);
+	bench_rx(64, SMAP_BD_COUNT - 1);
+	bench_rx(1514, SMAP_RX_BUFSIZE / 1516);
+	bench_tx(60);
+	bench_tx(SMAP_FRAME_MAX);
+}
+
+static void test_disable(void)
+{
+	command(rop_down, 0, NULL, 0);
+
+	expect(!smap->up.enabled && !smap->up.link);
+	expect(!dev9_use_count && !irq.txend && !irq.rxend);
+	expect(!link_timer);
+
+	tx_batch(1, 1);
+	expect(ack.tx.status == -ENODEV);
+}
+
+int main(int argc, char *argv[])
+{
+	/* The STA interface is idle. */
+	*reg(SMAP_REG(SMAP_REG_EMAC3_STA_CTRL + 2)) = SMAP_E3_PHY_OP_COMPLETE;
+
+	expect(smap_init(argc, argv) == MODULE_RESIDENT);
+	expect(smap && smap_cmd);
+	expect(!dev9_use_count);
+
+	test_enable();
+	test_link();
+	test_tx();
+	test_tx_timeout();
+	test_rx();
+	test_ring();
+	test_poll();
+	test_order();
+	bench();
+	test_disable();
+
+	return 0;
+}
@@ -0,0 +1,305 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Compare the builtin memory and string functions with byte-at-a-time
+ * references, for random alignments and sizes, and check that bytes around
+ * the destination are untouched. Also measure their throughput against the
+ * host C library.
+ */
+
+#define memcmp builtin_memcmp
+#define memcpy builtin_memcpy
+#define memmove builtin_memmove
+#define memset builtin_memset
+#define strlen builtin_strlen
+
+#include "../builtin/memcmp.c"
+#include "../builtin/memcpy.c"
+#include "../builtin/memmove.c"
+#include "../builtin/memset.c"
+#include "../builtin/strlen.c"
+
+#undef memcmp
+#undef memcpy
+#undef memmove
+#undef memset
+#undef strlen
+
+#include <stdio.h>
+#include <string.h>
+
+#include "iopmod/asm/macro.h"
+#include "iopmod/compare.h"
+
+#include "iop.h"
+
+#define BUFFER_SIZE	512
+#define ITERATIONS	200000
+
+#define BENCH_BYTES	(64 << 20)
+
+typedef void *(*copy_fn)(void *, const void *, size_t);
+typedef void *(*set_fn)(void *, int, size_t);
+typedef int (*cmp_fn)(const void *, const void *, size_t);
+typedef size_t (*strlen_fn)(const char *);
+
+static u8 src[BUFFER_SIZE] __attribute__((aligned(16)));
+static u8 dst[BUFFER_SIZE] __attribute__((aligned(16)));
+static u8 ref[BUFFER_SIZE] __attribute__((aligned(16)));
+
+static void random_bytes(u8 *b, size_t size)
+{
+	for (size_t i = 0; i < size; i++)
+		b[i] = test_random();
+}
+
+/* Mostly short sizes, with some large enough for the unrolled loops. */
+static size_t random_size(size_t max)
+{
+	const size_t size = test_random() % 4 ? test_random() % 40 :
+		test_random() % max;
+
+	return min(size, max);
+}
+
+static void test_memcpy(void)
+{
+	for (int i = 0; i < ITERATIONS; i++) {
+		const size_t d = test_random() % 64;
+		const size_t s = test_random() % 64;
+		const size_t n = random_size(BUFFER_SIZE - max(d, s));
+
+		random_bytes(src, sizeof(src));
+		random_bytes(dst, sizeof(dst));
+		memcpy(ref, dst, sizeof(ref));
+
+		for (size_t k = 0; k < n; k++)
+			ref[d + k] = src[s + k];
+
+		expect(builtin_memcpy(&dst[d], &src[s], n) == &dst[d]);
+		expect(!memcmp(dst, ref, sizeof(dst)));
+	}
+}
+
+static void test_memset(void)
+{
+	for (int i = 0; i < ITERATIONS; i++) {
+		const size_t d = test_random() % 64;
+		const size_t n = random_size(BUFFER_SIZE - d);
+		const int byte = test_random() % 2 ? test_random() % 256 :
+			(int)test_random();	/* Only the low byte counts. */
+
+		random_bytes(dst, sizeof(dst));
+		memcpy(ref, dst, sizeof(ref));
+
+		for (size_t k = 0; k < n; k++)
+			ref[d + k] = byte;
+
+		expect(builtin_memset(&dst[d], byte, n) == &dst[d]);
+		expect(!memcmp(dst, ref, sizeof(dst)));
+	}
+}
+
+/* Overlapping moves in both directions, within a single buffer. */
+static void test_memmove(void)
+{
+	for (int i = 0; i < ITERATIONS; i++) {
+		const size_t d = test_random() % (BUFFER_SIZE / 2);
+		const size_t s = test_random() % 8 ? d + test_random() % 16 - 8 :
+			test_random() % (BUFFER_SIZE / 2);
+		const size_t n = random_size(BUFFER_SIZE / 2 - 8);
+		u8 tmp[BUFFER_SIZE];
+
+		if (s >= BUFFER_SIZE / 2)
+			continue;	/* Wrapped below zero */
+
+		random_bytes(dst, sizeof(dst));
+		memcpy(ref, dst, sizeof(ref));
+
+		for (size_t k = 0; k < n; k++)
+			tmp[k] = ref[s + k];
+		for (size_t k = 0; k < n; k++)
+			ref[d + k] = tmp[k];
+
+		expect(builtin_memmove(&dst[d], &dst[s], n) == &dst[d]);
+		expect(!memcmp(dst, ref, sizeof(dst)));
+	}
+}
+
+static int sign(int x)
+{
+	return (x > 0) - (x < 0);
+}
+
+static void test_memcmp(void)
+{
+	for (int i = 0; i < ITERATIONS; i++) {
+		const size_t a = test_random() % 64;
+		const size_t b = test_random() % 64;
+		const size_t n = random_size(BUFFER_SIZE - max(a, b));
+
+		/* Equal bytes, with a difference at a random place, if any. */
+		random_bytes(src, sizeof(src));
+		memmove(&dst[b], &src[a], n);
+		if (n && test_random() % 4) {
+			const size_t k = test_random() % n;
+
+			dst[b + k] = test_random();
+		}
+
+		int expected = 0;
+		for (size_t k = 0; k < n && !expected; k++)
+			expected = sign(src[a + k] - dst[b + k]);
+
+		expect(sign(builtin_memcmp(&src[a], &dst[b], n)) == expected);
+	}
+}
+
+static void test_strlen(void)
+{
+	for (int i = 0; i < ITERATIONS; i++) {
+		const size_t s = test_random() % 64;
+		const size_t n = random_size(BUFFER_SIZE - s - 1);
+
+		/* Nonzero bytes, some with the high bit set, and a NUL. */
+		for (size_t k = 0; k < sizeof(src); k++)
+			src[k] = test_random() % 255 + 1;
+		src[s + n] = '\0';
+
+		expect(builtin_strlen((const char *)&src[s]) == n);
+	}
+}
+
+/* Sizes of short messages, SIF payloads and packets, aligned or not. */
+static const struct {
+	size_t size;
+	size_t offset;
+} bench_cases[] = {
+	{ 16, 0 }, { 16, 1 }, { 64, 0 }, { 64, 3 }, { 256, 0 }, { 256, 1 },
+};
+
+static void bench_report(const char *name, const char *impl,
+	size_t size, size_t offset, u64 ns)
+{
+	printf("%s %s: %zu bytes at offset %zu: %llu MB/s\n", name, impl,
+		size, offset, BENCH_BYTES * 1000ull / max_t(u64, ns, 1));
+}
+
+/* Calls go through a volatile pointer, so that none are inlined. */
+static void bench_copy(const char *name, const char *impl, copy_fn f)
+{
+	copy_fn volatile fn = f;
+
+	for (size_t i = 0; i < ARRAY_SIZE(bench_cases); i++) {
+		const size_t size = bench_cases[i].size;
+		const size_t offset = bench_cases[i].offset;
+		const u64 start = test_ns();
+
+		for (size_t n = 0; n < BENCH_BYTES; n += size)
+			fn(&dst[offset], &src[0], size);
+
+		bench_report(name, impl, size, offset, test_ns() - start);
+	}
+}
+
+static void bench_set(const char *name, const char *impl, set_fn f)
+{
+	set_fn volatile fn = f;
+
+	for (size_t i = 0; i < ARRAY_SIZE(bench_cases); i++) {
+		const size_t size = bench_cases[i].size;
+		const size_t offset = bench_cases[i].offset;
+		const u64 start = test_ns();
+
+		for (size_t n = 0; n < BENCH_BYTES; n += size)
+			fn(&dst[offset], n, size);
+
+		bench_report(name, impl, size, offset, test_ns() - start);
+	}
+}
+
+/* Overlapping moves, backwards, as when inserting into a buffer. */
+static void bench_move(const char *name, const char *impl, copy_fn f)
+{
+	copy_fn volatile fn = f;
+
+	for (size_t i = 0; i < ARRAY_SIZE(bench_cases); i++) {
+		const size_t size = bench_cases[i].size;
+		const size_t offset = bench_cases[i].offset;
+		const u64 start = test_ns();
+
+		for (size_t n = 0; n < BENCH_BYTES; n += size)
+			fn(&dst[offset + 4], &dst[0], size);
+
+		bench_report(name, impl, size, offset, test_ns() - start);
+	}
+}
+
+/* Equal buffers, so that all bytes are compared. */
+static void bench_cmp(const char *name, const char *impl, cmp_fn f)
+{
+	cmp_fn volatile fn = f;
+
+	memcpy(ref, src, sizeof(ref));
+
+	for (size_t i = 0; i < ARRAY_SIZE(bench_cases); i++) {
+		const size_t size = bench_cases[i].size;
+		const size_t offset = bench_cases[i].offset;
+		const u64 start = test_ns();
+
+		for (size_t n = 0; n < BENCH_BYTES; n += size)
+			expect(!fn(&src[offset], &ref[offset], size));
+
+		bench_report(name, impl, size, offset, test_ns() - start);
+	}
+}
+
+static void bench_strlen(const char *name, const char *impl, strlen_fn f)
+{
+	strlen_fn volatile fn = f;
+
+	for (size_t i = 0; i < ARRAY_SIZE(bench_cases); i++) {
+		const size_t size = bench_cases[i].size;
+		const size_t offset = bench_cases[i].offset;
+		const char *s = (const char *)&src[offset];
+
+		for (size_t k = 0; k < sizeof(src); k++)
+			src[k] = test_random() % 255 + 1;
+		src[offset + size] = '\0';
+
+		const u64 start = test_ns();
+
+		for (size_t n = 0; n < BENCH_BYTES; n += size)
+			expect(fn(s) == size);
+
+		bench_report(name, impl, size, offset, test_ns() - start);
+	}
+}
+
+static void bench(void)
+{
+	random_bytes(src, sizeof(src));
+
+	bench_copy("memcpy", "builtin", builtin_memcpy);
+	bench_copy("memcpy", "libc", memcpy);
+	bench_set("memset", "builtin", builtin_memset);
+	bench_set("memset", "libc", memset);
+	bench_move("memmove", "builtin", builtin_memmove);
+	bench_move("memmove", "libc", memmove);
+	bench_cmp("memcmp", "builtin", builtin_memcmp);
+	bench_cmp("memcmp", "libc", memcmp);
+	bench_strlen("strlen", "builtin", builtin_strlen);
+	bench_strlen("strlen", "libc", strlen);
+}
+
+int main(int argc, char *argv[])
+{
+	test_memcpy();
+	test_memset();
+	test_memmove();
+	test_memcmp();
+	test_strlen();
+
+	bench();
+
+	return 0;
+}
@@ -0,0 +1,286 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Add, modify and delete timers at random on a simulated system clock, and
+ * check that they expire on time with an alarm only for jiffies when timers
+ * expire or cascade, rather than for every jiffy.
+ */
+
+#include "../module/timer.c"
+
+#include "iopmod/struct.h"
+
+#include "iop.h"
+
+#define PERIOD		36864	/* System clock cycles per jiffy */
+#define TEST_TIMERS	64
+#define STEPS		200000
+
+static struct {
+	bool set;
+	u64 due;
+	u32 fired;
+} alarm;
+
+static bool irq_context;
+
+static struct test_timer {
+	struct timer_list timer;
+	bool armed;
+	u32 expires;
+	u32 added_at;
+	u32 period;
+	int periods;
+	int fired;
+} timers[TEST_TIMERS];
+
+int intrman_in_irq(void)
+{
+	return irq_context;
+}
+
+void thbase_us_to_sys_clock(u32 usec, struct iop_sys_clock *sys_clock)
+{
+	expect(usec == TIMER_TICK_US);
+
+	*sys_clock = (struct iop_sys_clock) { .lo = PERIOD };
+}
+
+static int set_alarm(struct iop_sys_clock *sys_clock,
+	unsigned int (*alarm_cb)(void *), void *arg)
+{
+	expect(!alarm.set);
+	expect(alarm_cb == timer_alarm);
+	expect(sys_clock->lo > 0 && !sys_clock->hi);
+
+	alarm.set = true;
+	alarm.due = test_clock + sys_clock->lo;
+
+	return 0;
+}
+
+int thbase_set_alarm(struct iop_sys_clock *sys_clock,
+	unsigned int (*alarm_cb)(void *), void *arg)
+{
+	expect(!irq_context);
+
+	return set_alarm(sys_clock, alarm_cb, arg);
+}
+
+int thbase_iset_alarm(struct iop_sys_clock *sys_clock,
+	unsigned int (*alarm_cb)(void *), void *arg)
+{
+	expect(irq_context);
+
+	return set_alarm(sys_clock, alarm_cb, arg);
+}
+
+static int cancel_alarm(unsigned int (*alarm_cb)(void *), void *arg)
+{
+	expect(alarm.set);
+	expect(alarm_cb == timer_alarm);
+
+	alarm.set = false;
+
+	return 0;
+}
+
+int thbase_cancel_alarm(unsigned int (*alarm_cb)(void *), void *arg)
+{
+	expect(!irq_context);
+
+	return cancel_alarm(alarm_cb, arg);
+}
+
+int thbase_icancel_alarm(unsigned int (*alarm_cb)(void *), void *arg)
+{
+	expect(irq_context);
+
+	return cancel_alarm(alarm_cb, arg);
+}
+
+/* The alarm is rearmed relative to when it was due, like the kernel does. */
+static void fire_alarm(void)
+{
+	expect(alarm.set);
+	expect(alarm.due >= test_clock);
+
+	test_clock = alarm.due;
+	irq_context = true;
+	const unsigned int cycles = timer_alarm(NULL);
+	irq_context = false;
+
+	alarm.fired++;
+	if (cycles)
+		alarm.due += cycles;
+	else
+		alarm.set = false;
+}
+
+static void timer_function(struct timer_list *timer)
+{
+	struct test_timer *t = container_of(timer, struct test_timer, timer);
+	const u32 now = timer_jiffies();
+
+	expect(t->armed);
+	expect(!timer_pending(timer));
+
+	/* Expiries that have passed expire on the next jiffy. */
+	if ((s32)(t->expires - t->added_at) > 0)
+		expect(now == t->expires);
+	else
+		expect(now - t->added_at <= 1);
+
+	t->fired++;
+
+	if (t->periods > 0) {
+		t->periods--;
+		t->added_at = now;
+		t->expires += t->period;
+		expect(mod_timer(timer, t->expires) == 0);
+	} else
+		t->armed = false;
+}
+
+static u32 random_delta(void)
+{
+	switch (test_random() % 8) {
+	case 0:
+		return -(test_random() % 4);	/* Already passed */
+	case 1:
+		return test_random() % (1 << 20);
+	case 2:
+	case 3:
+		return test_random() % (1 << 12);
+	default:
+		return test_random() % TIMER_SLOTS;
+	}
+}
+
+static void arm(struct test_timer *t, u32 expires, u32 period, int periods)
+{
+	const bool armed = t->armed;
+
+	t->added_at = timer_jiffies();
+	t->expires = expires;
+	t->period = period;
+	t->periods = periods;
+	t->armed = true;
+
+	expect(mod_timer(&t->timer, expires) == armed);
+	expect(alarm.set);
+}
+
+static bool any_armed(void)
+{
+	for (int i = 0; i < TEST_TIMERS; i++)
+		if (timers[i].armed)
+			return true;
+
+	return false;
+}
+
+static void advance_clock(void)
+{
+	const u64 cycles = test_random() % (16 * PERIOD);
+
+	if (alarm.set && alarm.due <= test_clock + cycles)
+		fire_alarm();
+	else
+		test_clock += cycles;
+}
+
+static void test_random_timers(void)
+{
+	for (int i = 0; i < STEPS; i++) {
+		struct test_timer *t = &timers[test_random() % TEST_TIMERS];
+
+		switch (test_random() % 4) {
+		case 0:
+			/* Interrupt handlers can modify timers too. */
+			irq_context = test_random() % 4 == 0;
+			arm(t, timer_jiffies() + random_delta(),
+				1 + test_random() % 100, test_random() % 3);
+			irq_context = false;
+			break;
+		case 1:
+			expect(del_timer(&t->timer) == t->armed);
+			t->armed = false;
+			break;
+		default:
+			advance_clock();
+		}
+	}
+
+	while (any_armed())
+		fire_alarm();
+
+	/* The alarm stops once no timers are pending. */
+	if (alarm.set)
+		fire_alarm();
+	expect(!alarm.set);
+	expect(!base.count);
+}
+
+static void test_sparse_timer(void)
+{
+	struct test_timer *t = &timers[0];
+
+	alarm.fired = 0;
+	arm(t, timer_jiffies() + 100000, 0, 0);
+	while (t->armed)
+		fire_alarm();
+
+	/* Some cascades and long alarms, but not one alarm per jiffy. */
+	expect(alarm.fired < 64);
+	expect(!alarm.set);
+}
+
+/*
+ * A timer due almost a full span of the second level ahead shares the
+ * current slot of that level, which is cascaded only when the level wraps
+ * around, after the slots following it.
+ */
+static void test_wrapped_slot(void)
+{
+	struct test_timer *far = &timers[0], *near = &timers[1];
+
+	test_clock += 100 * PERIOD;	/* Not at a slot boundary */
+	arm(far, timer_jiffies() + (1 << (3 * TIMER_BITS)) - 1, 0, 0);
+	arm(near, timer_jiffies() + 5000, 0, 0);
+
+	while (far->armed || near->armed)
+		fire_alarm();
+
+	expect(!alarm.set);
+}
+
+static void test_periodic_timer(void)
+{
+	struct test_timer *t = &timers[0];
+
+	alarm.fired = 0;
+	t->fired = 0;
+	arm(t, timer_jiffies() + 16, 16, 999);
+	while (t->armed)
+		fire_alarm();
+
+	expect(t->fired == 1000);
+	expect(alarm.fired <= 1000 + 16);
+}
+
+int main(int argc, char *argv[])
+{
+	test_clock = 123456789;
+	expect(timer_init(argc, argv) == MODULE_RESIDENT);
+	expect(timer_jiffies() == 0);
+
+	for (int i = 0; i < TEST_TIMERS; i++)
+		timer_setup(&timers[i].timer, timer_function);
+
+	test_random_timers();
+	test_sparse_timer();
+	test_wrapped_slot();
+	test_periodic_timer();
+
+	return 0;
+}
@@ -0,0 +1,165 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Compare the builtin 64-bit division with host division, for operands of
+ * random widths. Also measure it against host division and against the
+ * left-justifying shift-and-subtract loop it replaced.
+ */
+
+#define __udivmoddi4 builtin_udivmoddi4
+
+#include "../builtin/__udivmoddi4.c"
+
+#undef __udivmoddi4
+
+#include <stdio.h>
+
+#include "iopmod/asm/macro.h"
+
+#include "iop.h"
+
+#define ITERATIONS	1000000
+
+#define BENCH_OPERANDS	4096
+#define BENCH_ROUNDS	200
+
+typedef u64 (*udivmod_fn)(u64 num, u64 den, u64 *rem);
+
+/* Operands of all widths, so that every shift is exercised. */
+static u64 random_operand(void)
+{
+	const u64 x = (u64)test_random() << 32 | test_random();
+
+	return x >> (test_random() % 64);
+}
+
+static void check(u64 num, u64 den)
+{
+	u64 rem = ~num;
+
+	expect(builtin_udivmoddi4(num, den, &rem) == num / den);
+	expect(rem == num % den);
+	expect(builtin_udivmoddi4(num, den, NULL) == num / den);
+}
+
+static void test_random_operands(void)
+{
+	for (int i = 0; i < ITERATIONS; i++) {
+		const u64 den = random_operand();
+
+		if (den)
+			check(random_operand(), den);
+	}
+}
+
+static void test_edges(void)
+{
+	static const u64 edges[] = {
+		1, 2, 3, 0x7fffffff, 0x80000000, 0xffffffff,
+		0x100000000ull, 0x100000001ull, 0x7fffffffffffffffull,
+		0x8000000000000000ull, 0xfffffffffffffffeull,
+		0xffffffffffffffffull,
+	};
+
+	for (int i = 0; i < ARRAY_SIZE(edges); i++) {
+		for (int k = 0; k < ARRAY_SIZE(edges); k++)
+			check(edges[i], edges[k]);
+
+		check(0, edges[i]);
+	}
+
+	/* Division by zero gives zero, and leaves the remainder alone. */
+	u64 rem = 17;
+	expect(builtin_udivmoddi4(5, 0, &rem) == 0);
+	expect(rem == 17);
+}
+
+/* Shifts the denominator one bit at a time, for up to 64 iterations. */
+static u64 shift_udivmoddi4(u64 num, u64 den, u64 *rem_p)
+{
+	u64 quot = 0, qbit = 1;
+
+	if (den == 0)
+		return 0;
+
+	while ((s64)den >= 0) {
+		den <<= 1;
+		qbit <<= 1;
+	}
+
+	while (qbit) {
+		if (den <= num) {
+			num -= den;
+			quot += qbit;
+		}
+
+		den >>= 1;
+		qbit >>= 1;
+	}
+
+	if (rem_p)
+		*rem_p = num;
+
+	return quot;
+}
+
+static u64 host_udivmoddi4(u64 num, u64 den, u64 *rem_p)
+{
+	*rem_p = num % den;
+
+	return num / den;
+}
+
+static void bench_operands(const char *name, int num_bits, int den_bits,
+	udivmod_fn fns[3])
+{
+	static const char *impls[] = { "builtin", "shift", "host" };
+	static u64 num[BENCH_OPERANDS], den[BENCH_OPERANDS];
+
+	for (int i = 0; i < BENCH_OPERANDS; i++) {
+		num[i] = ((u64)test_random() << 32 | test_random()) >>
+			(64 - num_bits);
+		do {
+			den[i] = ((u64)test_random() << 32 | test_random()) >>
+				(64 - den_bits);
+		} while (!den[i]);
+	}
+
+	for (int k = 0; k < 3; k++) {
+		/* Calls go through a volatile pointer, so none are inlined. */
+		udivmod_fn volatile fn = fns[k];
+		u64 sum = 0, rem;
+
+		const u64 start = test_ns();
+		for (int r = 0; r < BENCH_ROUNDS; r++)
+			for (int i = 0; i < BENCH_OPERANDS; i++)
+				sum += fn(num[i], den[i], &rem) + rem;
+		const u64 ns = test_ns() - start;
+
+		printf("udivmoddi4 %s %s: %.2f ns per division (%llx)\n",
+			name, impls[k],
+			(double)ns / (BENCH_ROUNDS * BENCH_OPERANDS),
+			(unsigned long long)sum);
+	}
+}
+
+static void bench(void)
+{
+	udivmod_fn fns[3] = {
+		builtin_udivmoddi4, shift_udivmoddi4, host_udivmoddi4
+	};
+
+	bench_operands("32/32", 32, 32, fns);
+	bench_operands("64/32", 64, 32, fns);
+	bench_operands("64/64", 64, 64, fns);
+	bench_operands("64/16", 64, 16, fns);
+}
+
+int main(int argc, char *argv[])
+{
+	test_edges();
+	test_random_operands();
+
+	bench();
+
+	return 0;
+}
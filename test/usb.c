@@ -0,0 +1,313 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Write back done queues of a simulated OHCI host controller, and check
+ * that their transfer descriptors are reported in order of completion,
+ * that other interrupt causes are passed on, and that overlong done queues
+ * are reported as truncated.
+ */
+
+#include "../module/usb.c"
+
+#include <string.h>
+
+#include "iop.h"
+
+#define TEST_TDS	4096
+#define WRITEBACKS	5000
+
+static struct ohci_hcca hcca;
+static struct ohci_td tds[TEST_TDS] __attribute__((aligned(16)));
+
+static struct {
+	u32 status;
+	u32 enable;
+	int mie_toggles;
+} ohci;
+
+static struct usb_dev *usb;
+static sifcmd_handler usb_cmd;
+
+static struct {
+	irq_handler_t handler;
+	irq_handler_t thread_fn;
+} irq;
+
+static struct {
+	s32 status;
+	int count;
+} ack;
+
+/* Transfer descriptors reported by the module, in order. */
+static struct {
+	u32 td[TEST_TDS];
+	size_t count;
+	int cmds;
+	bool truncated;
+} reported;
+
+static struct usb_sif_stat stat;
+
+u32 iord32(const u32 addr)
+{
+	switch (addr) {
+	case OHCI_REG(OHCI_REG_INTR_STATUS):
+		return ohci.status;
+	case OHCI_REG(OHCI_REG_INTR_ENABLE):
+		return ohci.enable;
+	case OHCI_REG(OHCI_REG_HCCA):
+		return (u32)&hcca;
+	default:
+		test_fail(__FILE__, __LINE__, "known OHCI register");
+	}
+}
+
+void iowr32(u32 value, u32 addr)
+{
+	switch (addr) {
+	case OHCI_REG(OHCI_REG_INTR_STATUS):
+		ohci.status &= ~value;
+		break;
+	case OHCI_REG(OHCI_REG_INTR_ENABLE):
+		if (value & OHCI_INTR_MIE && !(ohci.enable & OHCI_INTR_MIE))
+			ohci.mie_toggles++;
+		ohci.enable |= value;
+		break;
+	case OHCI_REG(OHCI_REG_INTR_DISABLE):
+		ohci.enable &= ~value;
+		break;
+	default:
+		test_fail(__FILE__, __LINE__, "known OHCI register");
+	}
+}
+
+int request_threaded_irq(unsigned int i, irq_handler_t handler,
+	irq_handler_t thread_fn, void *arg)
+{
+	expect(i == IRQ_IOP_USB && !irq.thread_fn);
+	expect(arg == usb);
+
+	irq.handler = handler;
+	irq.thread_fn = thread_fn;
+
+	return 0;
+}
+
+int release_irq(unsigned int i, irq_handler_t handler, void *arg)
+{
+	expect(i == IRQ_IOP_USB && handler == irq.thread_fn);
+	expect(arg == usb);
+
+	irq.handler = NULL;
+	irq.thread_fn = NULL;
+
+	return 0;
+}
+
+bool queue_work(unsigned int wq, struct work_struct *work)
+{
+	expect(wq == WQ_NORMAL);
+
+	work->func(work);
+
+	return true;
+}
+
+void sif_request_cmd(int cid, sifcmd_handler handler, void *arg)
+{
+	expect(cid == SIF_CMD_USB);
+
+	usb_cmd = handler;
+	usb = arg;
+}
+
+int sif_cmd_opt_data(u32 cmd, u32 opt,
+	const void *payload, size_t payload_size,
+	main_addr_t dst, const void *src, size_t nbytes)
+{
+	const union usb_sif_opt o = { .raw = opt };
+
+	expect(cmd == SIF_CMD_USB);
+	expect(!nbytes);
+
+	switch (o.op) {
+	case rop_enable:
+	case rop_disable:
+		expect(payload_size == sizeof(struct usb_sif_ack));
+		ack.status = ((const struct usb_sif_ack *)payload)->status;
+		ack.count++;
+		break;
+	case rop_done:
+		expect(o.count && o.count <= MAX_USB_SIF_DONE);
+		expect(payload_size == o.count * sizeof(u32));
+		expect(!reported.truncated);
+		expect(reported.count + o.count <= ARRAY_SIZE(reported.td));
+
+		memcpy(&reported.td[reported.count], payload, payload_size);
+		reported.count += o.count;
+		reported.cmds++;
+		reported.truncated = o.truncated;
+		break;
+	case rop_stat:
+		expect(payload_size == sizeof(stat));
+		memcpy(&stat, payload, sizeof(stat));
+		break;
+	default:
+		test_fail(__FILE__, __LINE__, "known op");
+	}
+
+	return 0;
+}
+
+static void command(int op)
+{
+	const struct sif_cmd_header header = {
+		.cmd = SIF_CMD_USB,
+		.opt = (union usb_sif_opt) { .op = op }.raw,
+	};
+
+	usb_cmd(&header, usb);
+}
+
+/* Complete transfer descriptors, the most recent first in the done queue. */
+static u32 done_queue(const int *order, size_t count)
+{
+	u32 head = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		tds[order[i]].next = head;
+		head = (u32)&tds[order[i]];
+	}
+
+	return head;
+}
+
+/* Interrupt, passing it on as the irq module would, and run the thread. */
+static bool interrupt(void)
+{
+	const enum irq_status status = irq.handler(usb);
+
+	if (status == IRQ_NONE)
+		return false;
+
+	expect(status == IRQ_WAKE_THREAD);
+	expect(irq.thread_fn(usb) == IRQ_HANDLED);
+
+	return true;
+}
+
+static void writeback(u32 head, u32 other)
+{
+	hcca.done_head = head | (other ? 1 : 0);
+	ohci.status |= OHCI_INTR_WDH | other;
+	reported.count = 0;
+	reported.cmds = 0;
+	reported.truncated = false;
+
+	const int toggles = ohci.mie_toggles;
+
+	expect(interrupt());
+	expect(!hcca.done_head);
+	expect(!(ohci.status & OHCI_INTR_WDH));
+
+	/* Other causes raise the line again, for the next handler. */
+	expect(ohci.mie_toggles == toggles + !!other);
+	expect(ohci.enable & OHCI_INTR_MIE);
+	if (other)
+		expect(!interrupt());
+	ohci.status &= ~other;
+}
+
+static void test_writebacks(void)
+{
+	static int order[TEST_TDS];
+	u32 tds_total = 0, cmds_total = 0, max_tds = 0;
+
+	for (int w = 0; w < WRITEBACKS; w++) {
+		const size_t count = 1 + test_random() %
+			(test_random() % 8 ? 8 : USB_DONE_MAX);
+		const u32 other = test_random() % 4 ? 0 : OHCI_INTR_RHSC;
+
+		/* Distinct descriptors in random order of completion. */
+		for (size_t i = 0; i < count; i++)
+			order[i] = i;
+		for (size_t i = count - 1; i > 0; i--) {
+			const size_t k = test_random() % (i + 1);
+			const int t = order[i];
+
+			order[i] = order[k];
+			order[k] = t;
+		}
+
+		writeback(done_queue(order, count), other);
+
+		expect(reported.count == count);
+		expect(!reported.truncated);
+		for (size_t i = 0; i < count; i++)
+			expect(reported.td[i] == (u32)&tds[order[i]]);
+		expect(reported.cmds == (count + MAX_USB_SIF_DONE - 1) /
+			MAX_USB_SIF_DONE);
+
+		tds_total += count;
+		cmds_total += reported.cmds;
+		max_tds = max_t(u32, max_tds, count);
+	}
+
+	command(rop_stat);
+	expect(stat.writebacks == WRITEBACKS);
+	expect(stat.tds == tds_total);
+	expect(stat.cmds == cmds_total);
+	expect(stat.max_tds == max_tds);
+	expect(!stat.truncated);
+}
+
+static void test_truncated(void)
+{
+	static int order[USB_DONE_MAX + 100];
+
+	/* Overlong done queues report their most recent descriptors. */
+	for (size_t i = 0; i < ARRAY_SIZE(order); i++)
+		order[i] = i;
+	writeback(done_queue(order, ARRAY_SIZE(order)), 0);
+
+	expect(reported.count == USB_DONE_MAX);
+	expect(reported.truncated);
+	for (size_t i = 0; i < USB_DONE_MAX; i++)
+		expect(reported.td[i] == (u32)&tds[order[i + 100]]);
+
+	/* So do corrupt done queues that loop. */
+	tds[0].next = (u32)&tds[1];
+	tds[1].next = (u32)&tds[0];
+	writeback((u32)&tds[0], 0);
+
+	expect(reported.count == USB_DONE_MAX);
+	expect(reported.truncated);
+
+	command(rop_stat);
+	expect(stat.truncated == 2);
+}
+
+int main(int argc, char *argv[])
+{
+	expect(usb_init(argc, argv) == MODULE_RESIDENT);
+	expect(usb && usb_cmd);
+
+	command(rop_enable);
+	expect(ack.count == 1 && ack.status == 0);
+	expect(irq.handler && irq.thread_fn);
+
+	ohci.enable = OHCI_INTR_MIE | OHCI_INTR_WDH | OHCI_INTR_RHSC;
+
+	/* Interrupts without a writeback are passed on. */
+	ohci.status = OHCI_INTR_RHSC;
+	expect(!interrupt());
+	ohci.status = 0;
+
+	test_writebacks();
+	test_truncated();
+
+	command(rop_disable);
+	expect(ack.count == 2 && ack.status == 0);
+	expect(!irq.handler && !irq.thread_fn);
+
+	return 0;
+}
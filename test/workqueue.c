@@ -0,0 +1,401 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Run the workers of the shared workqueues as simulated threads, and check
+ * that work starts in the order it was queued, that a work item that sleeps
+ * does not hold up the other worker, that work items are never reentered,
+ * and that delayed work is queued by timers of the timer wheel.
+ */
+
+#include <setjmp.h>
+
+#include "../module/workqueue.c"
+
+#include "iop.h"
+
+#define TEST_THREADS 8
+#define TEST_SEMAS 4
+
+static struct {
+	void (*func)(void *arg);
+	void *arg;
+	int priority;
+	bool created;
+	bool started;
+} threads[TEST_THREADS];
+
+static struct {
+	int count;
+	int max;
+	bool created;
+} semas[TEST_SEMAS];
+
+static jmp_buf *thread_wait;
+static bool irq_context;
+
+static struct timer_list *pending_timer;
+
+/* Work under test records the order it runs in. */
+struct test_work {
+	struct work_struct work;
+	struct delayed_work dwork;
+	int calls;
+	int depth;
+	void (*during)(struct test_work *w);
+};
+
+static struct test_work works[4];
+static struct test_work *ran[16];
+static int ran_count;
+
+int intrman_in_irq(void)
+{
+	return irq_context;
+}
+
+int thbase_create(const struct iop_thread *thread)
+{
+	for (int i = 0; i < ARRAY_SIZE(threads); i++)
+		if (!threads[i].created) {
+			threads[i] = (typeof(threads[i])) {
+				.func = thread->thread,
+				.priority = thread->priority,
+				.created = true,
+			};
+
+			return i;
+		}
+
+	test_fail(__FILE__, __LINE__, "free thread");
+}
+
+int thbase_start(int thid, void *arg)
+{
+	expect(threads[thid].created && !threads[thid].started);
+
+	threads[thid].arg = arg;
+	threads[thid].started = true;
+
+	return 0;
+}
+
+int thbase_terminate(int thid)
+{
+	expect(threads[thid].started);
+
+	threads[thid].started = false;
+
+	return 0;
+}
+
+int thbase_delete(int thid)
+{
+	expect(threads[thid].created && !threads[thid].started);
+
+	threads[thid].created = false;
+
+	return 0;
+}
+
+int thsemap_create_sema(const struct iop_sema *sema)
+{
+	for (int i = 0; i < ARRAY_SIZE(semas); i++)
+		if (!semas[i].created) {
+			semas[i].count = sema->initial;
+			semas[i].max = sema->max;
+			semas[i].created = true;
+
+			return i;
+		}
+
+	test_fail(__FILE__, __LINE__, "free semaphore");
+}
+
+int thsemap_delete_sema(int semid)
+{
+	expect(semas[semid].created);
+
+	semas[semid].created = false;
+
+	return 0;
+}
+
+int thsemap_signal_sema(int semid)
+{
+	expect(semas[semid].created && !irq_context);
+	expect(semas[semid].count < semas[semid].max);
+
+	semas[semid].count++;
+
+	return 0;
+}
+
+int thsemap_isignal_sema(int semid)
+{
+	expect(semas[semid].created && irq_context);
+	expect(semas[semid].count < semas[semid].max);
+
+	semas[semid].count++;
+
+	return 0;
+}
+
+/* Threads run until they would block, and then return to the caller. */
+int thsemap_wait_sema(int semid)
+{
+	expect(semas[semid].created && !irq_context);
+
+	if (!semas[semid].count)
+		longjmp(*thread_wait, 1);
+
+	semas[semid].count--;
+
+	return 0;
+}
+
+u32 timer_jiffies(void)
+{
+	return 1000;
+}
+
+int mod_timer(struct timer_list *timer, u32 expires)
+{
+	expect(!timer_pending(timer) && !pending_timer);
+	expect(timer->function);
+
+	timer->expires = expires;
+	timer->pprev = &pending_timer;
+	pending_timer = timer;
+
+	return 0;
+}
+
+int del_timer(struct timer_list *timer)
+{
+	if (!timer_pending(timer))
+		return 0;
+
+	expect(pending_timer == timer);
+
+	timer->pprev = NULL;
+	pending_timer = NULL;
+
+	return 1;
+}
+
+static void expire_timer(void)
+{
+	struct timer_list *timer = pending_timer;
+
+	expect(timer);
+	del_timer(timer);
+
+	irq_context = true;
+	timer->function(timer);
+	irq_context = false;
+}
+
+/* Workers can be run from within work functions, as if those slept. */
+static void run_worker(unsigned int wq, int i)
+{
+	const int thid = workqueues[wq].thid[i];
+	jmp_buf wait, *outer = thread_wait;
+
+	expect(threads[thid].started);
+
+	thread_wait = &wait;
+	if (!setjmp(wait))
+		threads[thid].func(threads[thid].arg);
+	thread_wait = outer;
+}
+
+static void test_work_func(struct work_struct *work)
+{
+	struct test_work *w = container_of(work, struct test_work, work);
+
+	/* Work items are never reentered. */
+	expect(!w->depth && work->running && !irq_context);
+
+	expect(ran_count < ARRAY_SIZE(ran));
+	ran[ran_count++] = w;
+	w->calls++;
+
+	w->depth++;
+	if (w->during)
+		w->during(w);
+	w->depth--;
+}
+
+static void test_delayed_func(struct work_struct *work)
+{
+	struct delayed_work *dwork = to_delayed_work(work);
+	struct test_work *w = container_of(dwork, struct test_work, dwork);
+
+	expect(ran_count < ARRAY_SIZE(ran));
+	ran[ran_count++] = w;
+	w->calls++;
+}
+
+static void reset_works(void)
+{
+	for (int i = 0; i < ARRAY_SIZE(works); i++) {
+		works[i] = (struct test_work) { };
+		INIT_WORK(&works[i].work, test_work_func);
+		INIT_DELAYED_WORK(&works[i].dwork, test_delayed_func);
+	}
+
+	ran_count = 0;
+}
+
+static void test_init(void)
+{
+	expect(workqueue_init(0, NULL) == MODULE_RESIDENT);
+
+	for (int i = 0; i < ARRAY_SIZE(workqueues); i++) {
+		const struct workqueue *wq = &workqueues[i];
+
+		expect(semas[wq->sema_id].created);
+		for (int k = 0; k < WQ_WORKERS; k++) {
+			expect(threads[wq->thid[k]].started);
+			expect(threads[wq->thid[k]].priority == wq->priority);
+		}
+	}
+}
+
+static void test_order(void)
+{
+	reset_works();
+
+	expect(queue_work(WQ_NORMAL, &works[0].work));
+	expect(queue_work(WQ_NORMAL, &works[1].work));
+	expect(queue_work(WQ_NORMAL, &works[2].work));
+	expect(!queue_work(WQ_NORMAL, &works[0].work));	/* Pending */
+	expect(!queue_work(WQ_COUNT, &works[3].work));
+
+	/* One worker runs them all, in order, when the other is busy. */
+	run_worker(WQ_NORMAL, 0);
+	expect(ran_count == 3);
+	for (int i = 0; i < 3; i++)
+		expect(ran[i] == &works[i] && !works[i].work.running);
+}
+
+static void run_other_worker(struct test_work *w)
+{
+	run_worker(WQ_NORMAL, 1);
+}
+
+static void test_concurrent(void)
+{
+	reset_works();
+
+	/* Work that sleeps lets the other worker run later work. */
+	works[0].during = run_other_worker;
+	expect(queue_work(WQ_NORMAL, &works[0].work));
+	expect(queue_work(WQ_NORMAL, &works[1].work));
+
+	run_worker(WQ_NORMAL, 0);
+	expect(ran_count == 2 && ran[0] == &works[0] && ran[1] == &works[1]);
+	expect(!semas[workqueues[WQ_NORMAL].sema_id].count);
+}
+
+static void requeue_and_sleep(struct test_work *w)
+{
+	if (w->calls == 1) {
+		expect(queue_work(WQ_NORMAL, &w->work));
+		run_worker(WQ_NORMAL, 1);
+	}
+}
+
+static void test_reentrant(void)
+{
+	const struct workqueue *wq = &workqueues[WQ_NORMAL];
+
+	reset_works();
+
+	/*
+	 * Work queued again while it runs is skipped by the other worker,
+	 * which runs later work instead, and is run again once it returns.
+	 */
+	works[0].during = requeue_and_sleep;
+	expect(queue_work(WQ_NORMAL, &works[0].work));
+	expect(queue_work(WQ_NORMAL, &works[1].work));
+
+	run_worker(WQ_NORMAL, 0);
+	expect(works[0].calls == 2 && works[1].calls == 1);
+	expect(ran[0] == &works[0] && ran[1] == &works[1] &&
+	       ran[2] == &works[0]);
+	expect(!wq->head && !wq->deferred && !semas[wq->sema_id].count);
+
+	/* Deferred work is signalled again for whichever worker is idle. */
+	reset_works();
+	works[0].during = requeue_and_sleep;
+	expect(queue_work(WQ_NORMAL, &works[0].work));
+
+	run_worker(WQ_NORMAL, 0);
+	expect(works[0].calls == 2);
+	expect(!wq->head && !wq->deferred && !semas[wq->sema_id].count);
+}
+
+static void test_cancel(void)
+{
+	const struct workqueue *wq = &workqueues[WQ_HIGHPRI];
+
+	reset_works();
+
+	expect(queue_work(WQ_HIGHPRI, &works[0].work));
+	expect(queue_work(WQ_HIGHPRI, &works[1].work));
+	expect(cancel_work(&works[0].work));
+	expect(!cancel_work(&works[0].work));
+
+	/* Cancelled work leaves the semaphore signalled, to no effect. */
+	run_worker(WQ_HIGHPRI, 1);
+	expect(ran_count == 1 && ran[0] == &works[1]);
+	expect(!wq->head && !wq->deferred && !semas[wq->sema_id].count);
+}
+
+static void test_delayed(void)
+{
+	struct delayed_work *dwork = &works[0].dwork;
+
+	reset_works();
+
+	/* Delays are rounded up to jiffies of the timer wheel. */
+	expect(queue_delayed_work(WQ_HIGHPRI, dwork, 2500));
+	expect(timer_pending(&dwork->timer));
+	expect(dwork->timer.expires == timer_jiffies() + 3);
+	expect(!queue_delayed_work(WQ_HIGHPRI, dwork, 2500));
+	expect(!queue_delayed_work(WQ_COUNT, dwork, 2500));
+
+	expect(cancel_delayed_work(dwork));
+	expect(!timer_pending(&dwork->timer));
+	expect(!cancel_delayed_work(dwork));
+
+	/* The timer queues the work in the interrupt context. */
+	expect(queue_delayed_work(WQ_NORMAL, dwork, 1));
+	expect(dwork->timer.expires == timer_jiffies() + 1);
+	expire_timer();
+	expect(dwork->work.pending && !timer_pending(&dwork->timer));
+	expect(!queue_delayed_work(WQ_NORMAL, dwork, 1));
+
+	run_worker(WQ_NORMAL, 1);
+	expect(ran_count == 1 && ran[0] == &works[0]);
+
+	/* Without a delay, the work is queued at once. */
+	expect(queue_delayed_work(WQ_HIGHPRI, dwork, 0));
+	expect(dwork->work.pending && !timer_pending(&dwork->timer));
+	expect(cancel_delayed_work(dwork));
+
+	run_worker(WQ_HIGHPRI, 0);
+	expect(ran_count == 1);
+}
+
+int main(int argc, char *argv[])
+{
+	test_init();
+	test_order();
+	test_concurrent();
+	test_reentrant();
+	test_cancel();
+	test_delayed();
+
+	return 0;
+}